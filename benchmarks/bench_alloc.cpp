@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <unistd.h>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include <common/rand_r_32.h>
+#include <common/barrier.hpp>
+#include <common/ssmem_wrapper.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+/* Allocation throughput with objects of mixed sizes. Every thread keeps a
+   window of live objects; each operation allocates an object of a size
+   picked at random from the given sizes and frees the oldest object of the
+   window. Objects are tagged at both ends when allocated and checked when
+   freed, so memory handed out twice or reused for an object of a larger
+   size shows up as a validation failure. With stall_ms > 0, thread 0 stops
+   for that long in the middle of the run without reaching a quiescent
+   point, which keeps the other threads' garbage from being reused. */
+struct AllocBenchmark : Benchmark {
+
+  struct Object {
+    void* ptr;
+    size_t size;
+  };
+
+  AllocBenchmark(int _thread_count, vector<size_t> _sizes, int _live, bool _use_malloc, double _runtime,
+                 int _stall_ms): Benchmark(), thread_count(_thread_count), sizes(_sizes), live(_live),
+                     use_malloc(_use_malloc), runtime(_runtime), stall_ms(_stall_ms) {}
+
+  void* allocate(size_t size) {
+    return use_malloc ? malloc(size) : ssmem.alloc(size, false);
+  }
+
+  void deallocate(void* p, size_t size) {
+    if(use_malloc) free(p);
+    else ssmem.free(p, size, false);
+  }
+
+  static uint64_t tag(const Object& o) {
+    return ((uint64_t) o.ptr) ^ o.size;
+  }
+
+  // the tag goes into the first and the last word of the object
+  static void write_tag(const Object& o) {
+    uint64_t* w = (uint64_t*) o.ptr;
+    w[0] = w[o.size / sizeof(uint64_t) - 1] = tag(o);
+  }
+
+  static bool check_tag(const Object& o) {
+    uint64_t* w = (uint64_t*) o.ptr;
+    return w[0] == tag(o) && w[o.size / sizeof(uint64_t) - 1] == tag(o);
+  }
+
+  void bench() override {
+    std::vector<long long int> ops(thread_count);
+    std::vector<long long int> errors(thread_count);
+    std::vector<std::thread> threads;
+
+    std::atomic<bool> start = false;
+    std::atomic<bool> done = false;
+    Barrier barrier(thread_count+1);
+
+    for (int p = 0; p < thread_count; p++) {
+      threads.emplace_back([&barrier, &start, &done, this, &ops, &errors, p]() {
+        my_rand::init(p);
+        long long int localOps = 0;
+        long long int localErrors = 0;
+        vector<Object> window(live);
+        for(Object& o : window) {
+          o.size = sizes[my_rand::get_rand() % sizes.size()];
+          o.ptr = allocate(o.size);
+          write_tag(o);
+        }
+        barrier.wait();
+        while(!start);
+
+        for (int i = 0; !done; localOps++, i = (i+1 == live) ? 0 : i+1) {
+          if(p == 0 && stall_ms > 0 && localOps == 1000) usleep(stall_ms*1000);
+          Object& o = window[i];
+          if(!check_tag(o)) localErrors++;
+          deallocate(o.ptr, o.size);
+          o.size = sizes[my_rand::get_rand() % sizes.size()];
+          o.ptr = allocate(o.size);
+          write_tag(o);
+        }
+        for(Object& o : window) {
+          if(!check_tag(o)) localErrors++;
+          deallocate(o.ptr, o.size);
+        }
+        ops[p] = localOps;
+        errors[p] = localErrors;
+      });
+    }
+
+    barrier.wait();
+    start_timer();
+    start = true;
+    // sample the garbage while the threads run
+    size_t max_garbage = 0;
+    while(read_timer() < runtime) {
+      usleep(1000);
+      if(!use_malloc) max_garbage = std::max(max_garbage, ssmem_garbage_bytes(-1));
+    }
+    if(!use_malloc) ssmem_garbage_print();
+    done = true;
+    double elapsed_seconds = read_timer();
+    for (auto& t : threads) t.join();
+
+    long long int totalOps = std::accumulate(std::begin(ops), std::end(ops), 0LL);
+    long long int totalErrors = std::accumulate(std::begin(errors), std::end(errors), 0LL);
+    if(totalErrors == 0)
+      cout << "\tValidation Passed" << endl;
+    else
+      cout << "\tValidation Failed: " << totalErrors << " objects were overwritten" << endl;
+    std::cout << "\tThroughput = " << totalOps/1000000.0/elapsed_seconds << " M alloc+free/s" << std::endl;
+    if(!use_malloc)
+      std::cout << "\tPeak garbage = " << max_garbage/(1024.0*1024) << " MB" << std::endl;
+    std::cout << "\tElapsed time = " << elapsed_seconds << " second(s)" << std::endl;
+  }
+
+  void print_name() {
+    std::cout << "----------------------------------------------------------------" << std::endl;
+    std::cout << "\t" << (use_malloc ? "malloc" : "ssmem") << ", sizes =";
+    for(size_t s : sizes) {
+      std::cout << " " << s;
+      if(!use_malloc) std::cout << " (" << ssmem_class_size(ssmem_size_class(s)) << ")";
+    }
+    std::cout << std::endl;
+    std::cout << "\tAllocation Benchmark: P = " << thread_count << ", live objects per thread = " << live
+              << ", runtime = " << runtime << "s";
+    if(stall_ms > 0) std::cout << ", stall = " << stall_ms << "ms";
+    std::cout << std::endl;
+    std::cout << "--------------------------------------------------------------" << std::endl;
+  }
+
+  const int thread_count;
+  const vector<size_t> sizes;
+  const int live;
+  const bool use_malloc;
+  const double runtime;
+  const int stall_ms;
+};
+
+int main(int argc, char *argv[]) {
+  po::options_description description("Usage:");
+
+  description.add_options()
+  ("help,h", "Display this help message")
+  ("threads,t", po::value<int>()->default_value(4), "Number of Threads")
+  ("sizes,s", po::value<string>()->default_value("64,128,192,448,1024,4096"),
+                      "Comma separated object sizes in bytes (multiples of 8)")
+  ("live,l", po::value<int>()->default_value(100000), "Live objects per thread")
+  ("allocator,a", po::value<string>()->default_value("ssmem"), "Choose one of: ssmem, malloc")
+  ("runtime,r", po::value<double>()->default_value(0.5), "Runtime of Benchmark (seconds)")
+  ("stall", po::value<int>()->default_value(0), "Stall thread 0 for this many ms during the run");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(description).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help")){
+    cout << description;
+    exit(0);
+  }
+
+  vector<size_t> sizes;
+  stringstream ss(vm["sizes"].as<string>());
+  string item;
+  while(getline(ss, item, ',')) {
+    size_t s = stoul(item);
+    if(s < 8 || s % 8 != 0 || s > SSMEM_MAX_CLASS_SIZE) {
+      cerr << "Object sizes must be multiples of 8 between 8 and " << SSMEM_MAX_CLASS_SIZE << endl;
+      exit(1);
+    }
+    sizes.push_back(s);
+  }
+  string allocator = vm["allocator"].as<string>();
+  if(sizes.empty() || vm["live"].as<int>() < 1 || (allocator != "ssmem" && allocator != "malloc")) {
+    cerr << "Invalid sizes, live objects or allocator" << endl;
+    exit(1);
+  }
+
+  AllocBenchmark benchmark(vm["threads"].as<int>(), sizes, vm["live"].as<int>(),
+                           allocator == "malloc", vm["runtime"].as<double>(), vm["stall"].as<int>());
+  benchmark.print_name();
+  benchmark.bench();
+  return 0;
+}
@@ -1,6 +1,7 @@
 
 #include <algorithm>
 #include <chrono>
+#include <fstream>
 #include <iostream>
 #include <numeric>
 #include <vector>
@@ -11,6 +12,7 @@
 
 #include <common/rand_r_32.h>
 #include <common/barrier.hpp>
+#include <common/perf_counter.hpp>
 
 #include <harris-linkedlist/ListOriginal.hpp>
 #include <harris-linkedlist/ListDurableAutomatic.hpp>
@@ -38,14 +40,39 @@
 #include <persist/persist_hash.hpp>
 #include <persist/persist_offset.hpp>
 #include <persist/persist_hash_cacheline.hpp>
+#include <persist/persist_striped.hpp>
+#include <persist/persist_adaptive.hpp>
+#include <persist/persist_hash_numa.hpp>
 #include <persist/persist_interface.hpp>
 #include <persist/persist_simple.hpp>
+#include <persist/persist_eadr.hpp>
+#include <persist/persist_buffered.hpp>
 
 #include "common.hpp"
 
 using namespace std;
 namespace po = boost::program_options;
 
+// Size of a durable link for the selected persist variant, 0 if unknown
+size_t persist_word_size = 0;
+
+// Persistence epoch period of --persist buffered, 0 if not buffered
+int epoch_period_us = 0;
+
+// CSV file for the per operation type statistics (PMEM_STATS builds)
+string stats_file = "";
+
+// Thread placement: "none" leaves it to the OS, "local" pins every thread
+// to node 0 and "cross" pins thread p to node p % num_nodes
+string numa_placement = "none";
+
+void place_thread(int p) {
+  if(numa_placement == "none") return;
+  int node = (numa_placement == "cross") ? p % numa::num_nodes() : 0;
+  if(!numa::pin_thread_to_node(node))
+    cerr << "unable to pin thread " << p << " to node " << node << endl;
+}
+
 /* Set is a datastructure where the keys and values are both integers */
 template<class Set>
 struct FixedSizeBenchmark : Benchmark {
@@ -73,10 +100,13 @@ struct FixedSizeBenchmark : Benchmark {
     bool parallel_init = false;
 
     Barrier barrier(processor_count+1);
+    // opened before the threads start, so that it follows them
+    PerfCounter dtlb(PERF_TYPE_HW_CACHE, PerfCounter::DTLB_LOAD_MISSES);
 
     for (int p = 0; p < processor_count; p++) {
       threads.emplace_back([&barrier, &start, &done, this, &ops, &numKeys, &keySum, p, parallel_init]() {
         // disable_flushes = true;
+        place_thread(p);
         ssmem.alloc(ALIGNMENT); // for ssmem to initialize
         my_rand::init(p);
         long long int localNumKeys = 0;
@@ -120,23 +150,38 @@ struct FixedSizeBenchmark : Benchmark {
 
             int update_or_lookup = my_rand::get_rand()%100;
             int key = my_rand::get_rand()%range;
+            #ifdef PMEM_STATS
+              pmem_counters before = read_pmem_counters();
+            #endif
             //cout << asp_index << endl;
             if(update_or_lookup < update_percent) { // update
               if(add_or_remove == 0) { // add
-                if(set.add(key, range+key)) {
+                bool success = set.add(key, range+key);
+                if(success) {
                   localNumKeys++;
                   localkeySum += key;
                 }
+                #ifdef PMEM_STATS
+                  record_pmem_op(PMEM_OP_ADD, success, before);
+                #endif
               } else {                // remove
-                if(set.remove(key)) {
+                bool success = set.remove(key);
+                if(success) {
                   localNumKeys--;
                   localkeySum -= key;
                 }
+                #ifdef PMEM_STATS
+                  record_pmem_op(PMEM_OP_REMOVE, success, before);
+                #endif
               }
             } else {  // contains
-                if(set.contains(key)){
+                bool success = set.contains(key);
+                if(success){
                     dummy += 1; // to prevent contains from being optimized out
                 }
+                #ifdef PMEM_STATS
+                  record_pmem_op(PMEM_OP_CONTAINS, success, before);
+                #endif
 	          }
           }   
         }
@@ -154,9 +199,13 @@ struct FixedSizeBenchmark : Benchmark {
 
     // Check initial size of data structure
     assert(set.size() == size);
+    // this thread allocated the set, it must not hold back reclamation while it waits
+    ssmem_thread_offline();
 
     // Run benchmark for fixed amount of time
+    buffered_epochs::reset_stats();
     start_timer();
+    dtlb.start();
     start = true;
     usleep(runtime*1000000);
     // double elapsed_seconds = 0;
@@ -165,8 +214,12 @@ struct FixedSizeBenchmark : Benchmark {
     // }
     done = true;
     double elapsed_seconds = read_timer();
+    dtlb.stop();
     
     for (auto& t : threads) t.join();
+    ssmem_thread_online();
+    // the last epoch is made durable before the set is validated
+    buffered_epochs::stop();
 
     // Accumulate results
     long long int totalOps = std::accumulate(std::begin(ops), std::end(ops), 0LL);
@@ -181,9 +234,25 @@ struct FixedSizeBenchmark : Benchmark {
       cout << "\tValidation Failed: expected keySum = " << totalKeySum << ", actual keySum = " << actualKeySum << endl;
     std::cout << "\tThroughput = " << totalOps/1000000.0/elapsed_seconds << " Mop/s" << std::endl;
     std::cout << "\tElapsed time = " << elapsed_seconds << " second(s)" << std::endl;
+    if(dtlb.available())
+      std::cout << "\tdTLB load misses = " << dtlb.read() << " (" << dtlb.read()/(double)totalOps << " per op)" << std::endl;
+    else
+      std::cout << "\tdTLB load misses = unavailable" << std::endl;
+    if(ssmem_numa_route)
+      std::cout << "\tssmem objects routed to their home node = " << ssmem_routed_objs() << std::endl;
+    if(ssmem_page_fallbacks > 0)
+      std::cout << "\t" << ssmem_page_fallbacks << " chunk(s) fell back to 4KB pages" << std::endl;
+    if(epoch_period_us)
+      buffered_epochs::print_stats(totalOps);
 
     #ifdef PMEM_STATS
       print_pmem_stats(totalOps);
+      print_pmem_op_stats();
+      if(stats_file != "") {
+        std::ofstream out(stats_file);
+        if(out) write_pmem_op_stats(out);
+        else cerr << "Could not write " << stats_file << endl;
+      }
       // reset_pmem_stats();
     #endif
   }
@@ -194,6 +263,18 @@ struct FixedSizeBenchmark : Benchmark {
     std::cout << "\tFixed-Size Benchmark: P = " << thread_count << ", size = " << size << 
                  ", Updates = " << update_percent << "%, runtime = " << runtime << "s" << std::endl;
     std::cout << "\tInitialized with " << (processor_count) << " thread(s)" << endl;
+    if(numa_placement != "none")
+      std::cout << "\tNUMA placement = " << numa_placement << ", " << numa::num_nodes() << " node(s)"
+                << (ssmem_numa_route ? ", remote frees routed home" : "") << endl;
+    if(ssmem_page_policy != SSMEM_PAGES_DEFAULT || ssmem_page_prefault)
+      std::cout << "\tssmem pages = " << ssmem_get_page_policy() << (ssmem_page_prefault ? ", prefaulted" : "") << endl;
+    if(persist_word_size)
+      std::cout << "\tPersist word size = " << persist_word_size << " bytes" << endl;
+    if(epoch_period_us)
+      std::cout << "\tPersistence epoch period = " << epoch_period_us << "us" << endl;
+    #ifdef PMEM_EMULATION
+      std::cout << "\t" << get_pmem_emulation() << endl;
+    #endif
     std::cout << "--------------------------------------------------------------" << std::endl;
   }
 
@@ -225,6 +306,7 @@ template <template<typename, bool> typename PERSIST>
 void process_arguments(po::variables_map& vm) {
   string set = vm["ds"].as<string>();
   string version = vm["version"].as<string>();
+  persist_word_size = sizeof(PERSIST<std::atomic<void*>, flush_option::flush>);
 
   if(set == "list")
   {
@@ -311,7 +393,26 @@ int main(int argc, char *argv[]) {
   ("version,v", po::value<string>()->default_value("auto"), 
                       "Choose one of: original, auto, manual, traverse")
   ("persist,p", po::value<string>()->default_value("counter"), 
-                      "Choose one of: counter, hash12/16/20, simple, link, interface");
+                      "Choose one of: counter, counter16/32, hash12/16/20, hash20w16/w32, numa16/20, striped16/20, adaptive16/20, simple, link, interface, eadr, buffered")
+  ("epoch-period", po::value<int>()->default_value(1000), 
+                      "Persistence epoch period of --persist buffered (microseconds)")
+  ("numa", po::value<string>()->default_value("none"), 
+                      "Thread placement, choose one of: none, local (all on node 0), cross (round robin over nodes)")
+  ("huge-pages", po::value<string>()->default_value("default"), 
+                      "Pages of the ssmem chunks, choose one of: default, thp, nothp, 2mb, 1gb")
+  ("prefault", "Touch every page of a new ssmem chunk when it is allocated")
+  ("no-route", "Keep objects freed on another NUMA node in the free sets of the freeing thread")
+  ("flush,f", po::value<string>(), 
+                      "Force flush instruction, choose one of: auto, clflush, clflushopt, clwb")
+#ifdef PMEM_STATS
+  ("stats-file", po::value<string>()->default_value(""), "Write the per operation type statistics to this CSV file")
+#endif
+#ifdef PMEM_EMULATION
+  ("flush-latency", po::value<double>()->default_value(0), "Emulated write-back latency per flush (ns)")
+  ("fence-latency", po::value<double>()->default_value(0), "Emulated drain cost per fence (ns)")
+  ("bandwidth", po::value<double>()->default_value(0), "Emulated write-back bandwidth per thread (MB/s, 0 = unlimited)")
+#endif
+  ;
 
 
   po::variables_map vm;
@@ -323,8 +424,40 @@ int main(int argc, char *argv[]) {
     exit(0);
   }
   
+  if(vm.count("flush")) {
+    #ifdef PWB_IS_RUNTIME
+      if(!set_flush_instruction(vm["flush"].as<string>())) exit(1);
+    #else
+      cerr << "Flush instruction fixed at compile time, ignoring --flush" << endl;
+    #endif
+  }
+
+  #ifdef PMEM_STATS
+    stats_file = vm["stats-file"].as<string>();
+  #endif
+
+  #ifdef PMEM_EMULATION
+    set_pmem_emulation(vm["flush-latency"].as<double>(), vm["fence-latency"].as<double>(),
+                       vm["bandwidth"].as<double>());
+  #endif
+
+  if(!ssmem_set_page_policy(vm["huge-pages"].as<string>().c_str(), vm.count("prefault"))) {
+    cerr << "Invalid huge page policy" << endl;
+    exit(1);
+  }
+
+  if(vm.count("no-route")) ssmem_numa_route = false;
+
+  numa_placement = vm["numa"].as<string>();
+  if(numa_placement != "none" && numa_placement != "local" && numa_placement != "cross") {
+    cerr << "Invalid numa placement" << endl;
+    exit(1);
+  }
+
   string persist_type = vm["persist"].as<string>();
   if(persist_type == "counter") process_arguments<persist_counter>(vm);
+  else if(persist_type == "counter16") process_arguments<persist_counter_w16>(vm);
+  else if(persist_type == "counter32") process_arguments<persist_counter_w32>(vm);
   // else if(persist_type == "hash") process_arguments<persist_hash>(vm);
   // else if(persist_type == "hash10") process_arguments<persist_hash_cacheline_10>(vm);
   // else if(persist_type == "hash11") process_arguments<persist_hash_cacheline_11>(vm);
@@ -337,11 +470,37 @@ int main(int argc, char *argv[]) {
   // else if(persist_type == "hash18") process_arguments<persist_hash_cacheline_18>(vm);
   // else if(persist_type == "hash19") process_arguments<persist_hash_cacheline_19>(vm);
   else if(persist_type == "hash20") process_arguments<persist_hash_cacheline_20>(vm);
+  else if(persist_type == "hash20w16") process_arguments<persist_hash_cacheline_20_w16>(vm);
+  else if(persist_type == "hash20w32") process_arguments<persist_hash_cacheline_20_w32>(vm);
   else if(persist_type == "hash23") process_arguments<persist_hash_cacheline_23>(vm);
   else if(persist_type == "hash26") process_arguments<persist_hash_cacheline_26>(vm);
+  else if(persist_type == "numa16") process_arguments<persist_hash_numa_16>(vm);
+  else if(persist_type == "numa20") process_arguments<persist_hash_numa_20>(vm);
+  else if(persist_type == "striped16") process_arguments<persist_striped_16>(vm);
+  else if(persist_type == "striped20") process_arguments<persist_striped_20>(vm);
+  else if(persist_type == "adaptive16") process_arguments<persist_adaptive_16>(vm);
+  else if(persist_type == "adaptive20") process_arguments<persist_adaptive_20>(vm);
   else if(persist_type == "simple") process_arguments<persist_simple>(vm);
   else if(persist_type == "link") process_arguments<link_and_persist_2>(vm);
   else if(persist_type == "interface") process_arguments<persist_interface>(vm);
+  else if(persist_type == "eadr") {
+    // explicit flushes in the data structures are no-ops on eADR as well
+    #ifdef PWB_IS_RUNTIME
+      set_flush_instruction("eadr");
+    #elif !defined(PWB_IS_EADR)
+      cerr << "Flush instruction fixed at compile time, explicit flushes will still be issued" << endl;
+    #endif
+    process_arguments<persist_eadr>(vm);
+  }
+  else if(persist_type == "buffered") {
+    epoch_period_us = vm["epoch-period"].as<int>();
+    if(epoch_period_us <= 0) {
+      cerr << "Invalid epoch period" << endl;
+      exit(1);
+    }
+    if(!buffered_epochs::start(epoch_period_us)) exit(1);
+    process_arguments<persist_buffered>(vm);
+  }
   //else if(persist_type == "offset") process_arguments<persist_offset_spec>(vm);
   else {
     cerr << "Invalid persist name" << endl;
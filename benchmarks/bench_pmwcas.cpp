@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <vector>
+#include <thread>
+#include <unistd.h>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include <common/rand_r_32.h>
+#include <common/barrier.hpp>
+
+#include <persist/persist.hpp>
+#include <persist/persist_counter.hpp>
+#include <persist/persist_hash_cacheline.hpp>
+#include <persist/persist_simple.hpp>
+#include <persist/persist_eadr.hpp>
+#include <persist/pmwcas.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+/* Each operation reads k distinct words chosen at random from an array of 
+   num_words shared words and tries to increment all of them with one 
+   persistent multi-word CAS. Fewer words means more contention. */
+template<template<typename, bool> typename PERSIST>
+struct PmwcasBenchmark : Benchmark {
+  using word = typename pmwcas<PERSIST>::word;
+
+  struct alignas(64) Slot {
+    word val;
+    Slot() : val(0) {}
+  };
+
+  PmwcasBenchmark(int _thread_count, int _num_words, int _k, double _runtime): 
+                     Benchmark(), slots(_num_words), thread_count(_thread_count), 
+                     num_words(_num_words), k(_k), runtime(_runtime) {}
+
+  void bench() override {
+    std::vector<long long int> ops(thread_count);
+    std::vector<long long int> successes(thread_count);
+    std::vector<std::thread> threads;
+
+    std::atomic<bool> start = false;
+    std::atomic<bool> done = false;
+    Barrier barrier(thread_count+1);
+
+    for (int p = 0; p < thread_count; p++) {
+      threads.emplace_back([&barrier, &start, &done, this, &ops, &successes, p]() {
+        my_rand::init(p);
+        long long int localOps = 0;
+        long long int localSuccesses = 0;
+        int idx[pmwcas<PERSIST>::MAX_WORDS];
+        #ifdef PMEM_STATS
+          reset_pmem_stats();
+        #endif
+        barrier.wait();
+        while(!start);
+
+        for (; !done; localOps++) {
+          OperationLifetime op;
+          for(int i = 0; i < k; i++) {
+            bool dup;
+            do {
+              idx[i] = my_rand::get_rand()%num_words;
+              dup = false;
+              for(int j = 0; j < i; j++) dup |= (idx[j] == idx[i]);
+            } while(dup);
+          }
+          pmwcas<PERSIST> m;
+          for(int i = 0; i < k; i++) {
+            uint64_t v = pmwcas<PERSIST>::read(slots[idx[i]].val);
+            m.add(slots[idx[i]].val, v, v+1);
+          }
+          if(m.execute()) localSuccesses++;
+        }
+        ops[p] = localOps;
+        successes[p] = localSuccesses;
+        #ifdef PMEM_STATS
+          aggregate_pmem_stats();
+        #endif
+      });
+    }
+
+    barrier.wait();
+    start_timer();
+    start = true;
+    usleep(runtime*1000000);
+    done = true;
+    double elapsed_seconds = read_timer();
+    for (auto& t : threads) t.join();
+
+    long long int totalOps = std::accumulate(std::begin(ops), std::end(ops), 0LL);
+    long long int totalSuccesses = std::accumulate(std::begin(successes), std::end(successes), 0LL);
+    uint64_t sum = 0;
+    for(auto& s : slots) sum += pmwcas<PERSIST>::read(s.val);
+    if(sum == (uint64_t) totalSuccesses*k)
+      cout << "\tValidation Passed" << endl;
+    else
+      cout << "\tValidation Failed: expected sum = " << totalSuccesses*k << ", actual sum = " << sum << endl;
+    std::cout << "\tThroughput = " << totalOps/1000000.0/elapsed_seconds << " Mop/s" << std::endl;
+    std::cout << "\tSuccessful PMwCAS = " << totalSuccesses/1000000.0/elapsed_seconds << " Mop/s (" 
+              << 100.0*totalSuccesses/totalOps << "%)" << std::endl;
+    std::cout << "\tElapsed time = " << elapsed_seconds << " second(s)" << std::endl;
+    #ifdef PMEM_STATS
+      print_pmem_stats(totalOps);
+    #endif
+  }
+
+  void print_name() {
+    std::cout << "----------------------------------------------------------------" << std::endl;
+    std::cout << "\t" << pmwcas<PERSIST>::get_name() << ", " << get_flush_instruction() << endl;
+    std::cout << "\tPMwCAS Benchmark: P = " << thread_count << ", words per op = " << k << 
+                 ", shared words = " << num_words << ", runtime = " << runtime << "s" << std::endl;
+    std::cout << "--------------------------------------------------------------" << std::endl;
+  }
+
+  std::vector<Slot> slots;
+  const int thread_count, num_words, k;
+  const double runtime;
+};
+
+template<template<typename, bool> typename PERSIST>
+void run_benchmark(const po::variables_map &vm) {
+  int k = vm["k"].as<int>();
+  int num_words = vm["words"].as<int>();
+  if(k < 1 || k > pmwcas<PERSIST>::MAX_WORDS || num_words < k) {
+    cerr << "Words per operation must be between 1 and " << pmwcas<PERSIST>::MAX_WORDS 
+         << " and at most the number of shared words" << endl;
+    exit(1);
+  }
+  PmwcasBenchmark<PERSIST> benchmark(vm["threads"].as<int>(), num_words, k, vm["runtime"].as<double>());
+  benchmark.print_name();
+  benchmark.bench();
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description description("Usage:");
+
+  description.add_options()
+  ("help,h", "Display this help message")
+  ("threads,t", po::value<int>()->default_value(4), "Number of Threads")
+  ("k,k", po::value<int>()->default_value(2), "Words per PMwCAS (2-8)")
+  ("words,w", po::value<int>()->default_value(64), "Number of shared words (fewer = more contention)")
+  ("runtime,r", po::value<double>()->default_value(0.5), "Runtime of Benchmark (seconds)")
+  ("persist,p", po::value<string>()->default_value("counter"), 
+                      "Choose one of: counter, hash20, simple, eadr");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(description).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help")){
+    cout << description;
+    exit(0);
+  }
+
+  string persist_type = vm["persist"].as<string>();
+  if(persist_type == "counter") run_benchmark<persist_counter>(vm);
+  else if(persist_type == "hash20") run_benchmark<persist_hash_cacheline_20>(vm);
+  else if(persist_type == "simple") run_benchmark<persist_simple>(vm);
+  else if(persist_type == "eadr") {
+    #ifdef PWB_IS_RUNTIME
+      set_flush_instruction("eadr");
+    #endif
+    run_benchmark<persist_eadr>(vm);
+  }
+  else {
+    cerr << "Invalid persist name" << endl;
+    exit(1);
+  }
+
+  return 0;
+}
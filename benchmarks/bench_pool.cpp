@@ -0,0 +1,143 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include <common/rand_r_32.h>
+
+#include <harris-linkedlist/ListDurableNvTraverse.hpp>
+#include <hashtable/HashtableDurableNvTraverse.hpp>
+#include <aravind-bst/AravindBstDurableNvTraverse.hpp>
+#include <skiplist/SkiplistDurableNvTraverse.hpp>
+
+#include <persist/persist.hpp>
+#include <persist/persist_counter.hpp>
+
+#include <common/ssmem_pool.h>
+
+using namespace std;
+namespace po = boost::program_options;
+
+/* Measures how long it takes to get a durable data structure back from a
+   pool file: a child process creates the pool and fills the structure, then
+   the parent (standing in for the restarted process) maps the pool, looks up
+   the root and traverses the structure once, with and without prefaulting
+   the mapping. */
+
+double seconds_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+template<class Set>
+void create(const string& path, size_t pool_size, int size, int threads) {
+  auto start = chrono::steady_clock::now();
+  if(ssmem_pool_open(path.c_str(), pool_size) != 1) {
+    cerr << "could not create " << path << endl;
+    exit(1);
+  }
+  Set* set = ssmem_pool_root<Set>("set", size);
+  cout << "\tCreate pool = " << seconds_since(start) << " s" << endl;
+
+  start = chrono::steady_clock::now();
+  vector<thread> workers;
+  for(int p = 0; p < threads; p++) {
+    workers.emplace_back([set, p, size, threads] () {
+      my_rand::init(p);
+      int share = size/threads + (p < size%threads);
+      for(int i = 0; i < share;)
+        if(set->add(my_rand::get_rand()%(2*size), 0)) i++;
+    });
+  }
+  for(auto& t : workers) t.join();
+  cout << "\tFill " << size << " keys = " << seconds_since(start) << " s, pool used = "
+       << ssmem_pool_used()/(1024*1024) << " MB" << endl;
+}
+
+template<class Set>
+void reopen(const string& path, int size, bool populate) {
+  auto start = chrono::steady_clock::now();
+  if(ssmem_pool_open(path.c_str(), 0, SSMEM_POOL_DEFAULT_BASE, populate ? SSMEM_POOL_POPULATE : 0) != 0) {
+    cerr << "could not reopen " << path << endl;
+    exit(1);
+  }
+  double map_time = seconds_since(start);
+  Set* set = (Set*) ssmem_pool_get_root("set");
+  double root_time = seconds_since(start);
+  long long keys = set->size();
+  double traversal_time = seconds_since(start);
+  cout << "\t" << (populate ? "Prefaulted" : "Lazy") << " reopen: map = " << map_time*1000 << " ms, root = "
+       << root_time*1000 << " ms, first traversal = " << traversal_time*1000 << " ms" << endl;
+  if(keys != size) {
+    cerr << "\tValidation Failed: expected " << size << " keys, found " << keys << endl;
+    exit(1);
+  }
+  ssmem_pool_close();
+}
+
+template<class Set>
+void run(const po::variables_map& vm) {
+  string path = vm["pool"].as<string>();
+  size_t pool_size = (size_t) (vm["pool-size"].as<double>() * (1ull << 30));
+  int size = vm["size"].as<int>();
+  int threads = vm["threads"].as<int>();
+
+  cout << "----------------------------------------------------------------" << endl;
+  cout << "\tDatastructure: " << Set::get_name() << ", pool " << path << " ("
+       << pool_size/(1024*1024) << " MB)" << endl;
+  cout << "--------------------------------------------------------------" << endl;
+
+  unlink(path.c_str());
+  // the child's exit stands in for a restart
+  pid_t pid = fork();
+  if(pid == 0) {
+    create<Set>(path, pool_size, size, threads);
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) exit(1);
+
+  reopen<Set>(path, size, false);
+  reopen<Set>(path, size, true);
+  cout << "\tValidation Passed" << endl;
+  if(!vm.count("keep")) unlink(path.c_str());
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description description("Usage:");
+
+  description.add_options()
+  ("help,h", "Display this help message")
+  ("pool", po::value<string>()->default_value("/dev/shm/ssmem-bench.pool"), "Pool file (on DAX or tmpfs)")
+  ("pool-size", po::value<double>()->default_value(4), "Pool size (GB)")
+  ("size,s", po::value<int>()->default_value(1000000), "Number of keys")
+  ("threads,t", po::value<int>()->default_value(4), "Threads filling the data structure")
+  ("ds,d", po::value<string>()->default_value("hash"), "Choose one of: list, bst, hash, skiplist")
+  ("keep", "Keep the pool file")
+  ;
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(description).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help")){
+    cout << description;
+    exit(0);
+  }
+
+  string ds = vm["ds"].as<string>();
+  if(ds == "list") run<ListDurableNvTraverse<int, persist_counter>>(vm);
+  else if(ds == "hash") run<HashtableDurableNvTraverse<int, persist_counter>>(vm);
+  else if(ds == "bst") run<AravindBstDurableNvTraverse<int, persist_counter>>(vm);
+  else if(ds == "skiplist") run<SkiplistDurableNvTraverse<int, persist_counter>>(vm);
+  else {
+    cerr << "Invalid datastructure name" << endl;
+    exit(1);
+  }
+  return 0;
+}
@@ -0,0 +1,194 @@
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <string>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include <common/rand_r_32.h>
+
+#include <harris-linkedlist/ListDurableNvTraverse.hpp>
+#include <hashtable/HashtableDurableNvTraverse.hpp>
+#include <aravind-bst/AravindBstDurableNvTraverse.hpp>
+#include <skiplist/SkiplistDurableNvTraverse.hpp>
+
+#include <persist/persist.hpp>
+#include <persist/persist_counter.hpp>
+
+#include <common/ssmem_pool.h>
+#include <common/recovery.hpp>
+
+using namespace std;
+namespace po = boost::program_options;
+
+/* Measures how long it takes to recover a durable data structure after a
+   restart. A child process creates a pool, fills the structure and, with
+   --churn, keeps updating it until it is killed. Then, for every thread
+   count, a fresh process maps the pool and runs the recovery: repair of the
+   structure (recover()) and the sweep that hands unreachable slots and the
+   unused ends of the chunks back to ssmem (recovery::end()). The time is
+   also given per GB of the pool that was handed out. */
+
+double seconds_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+template<class Set>
+void create(const string& path, size_t pool_size, int size, int threads, int churn_ms, int fill_done) {
+  if(ssmem_pool_open(path.c_str(), pool_size) != 1) {
+    cerr << "could not create " << path << endl;
+    exit(1);
+  }
+  Set* set = ssmem_pool_root<Set>("set", size);
+
+  auto start = chrono::steady_clock::now();
+  vector<thread> workers;
+  for(int p = 0; p < threads; p++) {
+    workers.emplace_back([set, p, size, threads] () {
+      my_rand::init(p);
+      int share = size/threads + (p < size%threads);
+      for(int i = 0; i < share;)
+        if(set->add(my_rand::get_rand()%(2*size), 0)) i++;
+    });
+  }
+  for(auto& t : workers) t.join();
+  cout << "\tFill " << size << " keys = " << seconds_since(start) << " s, pool used = "
+       << ssmem_pool_used()/(1024*1024) << " MB" << endl;
+  if(write(fill_done, "x", 1) != 1 || churn_ms == 0) return;
+
+  // updates in flight when the parent kills the process leave marked nodes,
+  // partial towers and unpublished nodes behind
+  workers.clear();
+  for(int p = 0; p < threads; p++) {
+    workers.emplace_back([set, p, size] () {
+      my_rand::init(p + 1000);
+      while(true) {
+        int key = my_rand::get_rand()%(2*size);
+        if(my_rand::get_rand()%2) set->add(key, 0);
+        else set->remove(key);
+      }
+    });
+  }
+  for(auto& t : workers) t.join();
+}
+
+template<class Set>
+void recover(const string& path, int threads) {
+  auto start = chrono::steady_clock::now();
+  if(ssmem_pool_open(path.c_str(), 0) != 0) {
+    cerr << "could not reopen " << path << endl;
+    exit(1);
+  }
+  Set* set = (Set*) ssmem_pool_get_root("set");
+  double map_time = seconds_since(start);
+
+  recovery::begin();
+  start = chrono::steady_clock::now();
+  set->recover(threads);
+  double repair_time = seconds_since(start);
+  start = chrono::steady_clock::now();
+  recovery::end(threads);
+  double sweep_time = seconds_since(start);
+
+  double total = map_time + repair_time + sweep_time;
+  double gb = (double) ssmem_pool_used() / (1ull << 30);
+  cout << "\tThreads = " << threads << ": map = " << map_time*1000 << " ms, repair = "
+       << repair_time*1000 << " ms, sweep = " << sweep_time*1000 << " ms, total = "
+       << total << " s (" << total / gb << " s/GB, "
+       << recovery::nodes / repair_time / 1e6 << " M nodes/s)" << endl;
+  recovery::print_stats();
+  long long keys = set->size();
+  cout << "\tKeys after recovery = " << keys << endl;
+}
+
+template<class Set>
+void run(const po::variables_map& vm) {
+  string path = vm["pool"].as<string>();
+  size_t pool_size = (size_t) (vm["pool-size"].as<double>() * (1ull << 30));
+  int size = vm["size"].as<int>();
+  int fill_threads = vm["fill-threads"].as<int>();
+  int churn_ms = vm["churn"].as<int>();
+
+  cout << "----------------------------------------------------------------" << endl;
+  cout << "\tDatastructure: " << Set::get_name() << ", pool " << path << " ("
+       << pool_size/(1024*1024) << " MB)" << endl;
+  cout << "--------------------------------------------------------------" << endl;
+
+  unlink(path.c_str());
+  // the child reports the end of the fill through the pipe
+  int fill_done[2];
+  if(pipe(fill_done) != 0) exit(1);
+  pid_t pid = fork();
+  if(pid == 0) {
+    create<Set>(path, pool_size, size, fill_threads, churn_ms, fill_done[1]);
+    exit(0);
+  }
+  char c;
+  if(read(fill_done[0], &c, 1) != 1) {
+    cerr << "fill failed" << endl;
+    exit(1);
+  }
+  int status;
+  if(churn_ms > 0) {
+    this_thread::sleep_for(chrono::milliseconds(churn_ms));
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+  } else {
+    waitpid(pid, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) exit(1);
+  }
+
+  stringstream ss(vm["threads"].as<string>());
+  string t;
+  while(getline(ss, t, ',')) {
+    pid = fork();
+    if(pid == 0) {
+      recover<Set>(path, stoi(t));
+      exit(0);
+    }
+    waitpid(pid, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) exit(1);
+  }
+  if(!vm.count("keep")) unlink(path.c_str());
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description description("Usage:");
+
+  description.add_options()
+  ("help,h", "Display this help message")
+  ("pool", po::value<string>()->default_value("/dev/shm/ssmem-recovery.pool"), "Pool file (on DAX or tmpfs)")
+  ("pool-size", po::value<double>()->default_value(16), "Pool size (GB)")
+  ("size,s", po::value<int>()->default_value(10000000), "Number of keys")
+  ("threads,t", po::value<string>()->default_value("1,2,4,8"), "Recovery thread counts, comma separated")
+  ("fill-threads", po::value<int>()->default_value(8), "Threads filling the data structure")
+  ("churn", po::value<int>()->default_value(0), "Milliseconds of updates before the fill process is killed (0: exit normally)")
+  ("ds,d", po::value<string>()->default_value("hash"), "Choose one of: list, bst, hash, skiplist")
+  ("keep", "Keep the pool file")
+  ;
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(description).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help")){
+    cout << description;
+    exit(0);
+  }
+
+  string ds = vm["ds"].as<string>();
+  if(ds == "list") run<ListDurableNvTraverse<int, persist_counter>>(vm);
+  else if(ds == "hash") run<HashtableDurableNvTraverse<int, persist_counter>>(vm);
+  else if(ds == "bst") run<AravindBstDurableNvTraverse<int, persist_counter>>(vm);
+  else if(ds == "skiplist") run<SkiplistDurableNvTraverse<int, persist_counter>>(vm);
+  else {
+    cerr << "Invalid datastructure name" << endl;
+    exit(1);
+  }
+  return 0;
+}
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <vector>
+#include <thread>
+#include <unistd.h>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include <common/rand_r_32.h>
+#include <common/barrier.hpp>
+
+#include <persist/persist.hpp>
+#include <persist/persist_counter.hpp>
+#include <persist/persist_hash_cacheline.hpp>
+#include <persist/persist_striped.hpp>
+#include <persist/persist_adaptive.hpp>
+#include <persist/persist_interface.hpp>
+#include <persist/persist_simple.hpp>
+#include <persist/persist_eadr.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+/* Compares durable fetch-and-add against fetch-and-add emulated with a
+   CAS loop. Every thread repeatedly picks one of num_words shared words and
+   increments it; fewer words means more contention. */
+template<template<typename, bool> typename PERSIST>
+struct RmwBenchmark : Benchmark {
+
+  struct alignas(64) Word {
+    PERSIST<std::atomic<uint64_t>, flush_option::flush> val;
+    Word() : val(0) {}
+  };
+
+  RmwBenchmark(int _thread_count, int _num_words, bool _use_cas, double _runtime): 
+                     Benchmark(), words(_num_words), thread_count(_thread_count), 
+                     num_words(_num_words), use_cas(_use_cas), runtime(_runtime) {}
+
+  void bench() override {
+    std::vector<long long int> ops(thread_count);
+    std::vector<long long int> retries(thread_count);
+    std::vector<std::thread> threads;
+
+    std::atomic<bool> start = false;
+    std::atomic<bool> done = false;
+    Barrier barrier(thread_count+1);
+
+    for (int p = 0; p < thread_count; p++) {
+      threads.emplace_back([&barrier, &start, &done, this, &ops, &retries, p]() {
+        my_rand::init(p);
+        long long int localOps = 0;
+        long long int localRetries = 0;
+        #ifdef PMEM_STATS
+          reset_pmem_stats();
+        #endif
+        barrier.wait();
+        while(!start);
+
+        for (; !done; localOps++) {
+          OperationLifetime op;
+          Word& w = words[my_rand::get_rand()%num_words];
+          if(use_cas) {
+            uint64_t old = w.val.load();
+            while(!w.val.compare_exchange_strong(old, old+1)) 
+              localRetries++;
+          } else {
+            w.val.fetch_add(1);
+          }
+        }
+        ops[p] = localOps;
+        retries[p] = localRetries;
+        #ifdef PMEM_STATS
+          aggregate_pmem_stats();
+        #endif
+      });
+    }
+
+    barrier.wait();
+    start_timer();
+    start = true;
+    usleep(runtime*1000000);
+    done = true;
+    double elapsed_seconds = read_timer();
+    for (auto& t : threads) t.join();
+
+    long long int totalOps = std::accumulate(std::begin(ops), std::end(ops), 0LL);
+    long long int totalRetries = std::accumulate(std::begin(retries), std::end(retries), 0LL);
+    uint64_t sum = 0;
+    for(auto& w : words) sum += w.val.load();
+    if(sum == (uint64_t) totalOps)
+      cout << "\tValidation Passed" << endl;
+    else
+      cout << "\tValidation Failed: expected sum = " << totalOps << ", actual sum = " << sum << endl;
+    std::cout << "\tThroughput = " << totalOps/1000000.0/elapsed_seconds << " Mop/s" << std::endl;
+    std::cout << "\tCAS retries per operation = " << 1.0*totalRetries/totalOps << std::endl;
+    std::cout << "\tElapsed time = " << elapsed_seconds << " second(s)" << std::endl;
+    #ifdef PMEM_STATS
+      print_pmem_stats(totalOps);
+    #endif
+  }
+
+  void print_name() {
+    std::cout << "----------------------------------------------------------------" << std::endl;
+    std::cout << "\tPrimitive: " << (use_cas ? "CAS loop" : "fetch_add") << ", " 
+              << PERSIST<std::atomic<uint64_t>, flush_option::flush>::get_name() << ", " 
+              << get_flush_instruction() << endl;
+    std::cout << "\tRMW Benchmark: P = " << thread_count << ", words = " << num_words << 
+                 ", runtime = " << runtime << "s" << std::endl;
+    std::cout << "--------------------------------------------------------------" << std::endl;
+  }
+
+  std::vector<Word> words;
+  const int thread_count, num_words;
+  const bool use_cas;
+  const double runtime;
+};
+
+template<template<typename, bool> typename PERSIST>
+void run_benchmark(const po::variables_map &vm) {
+  string primitive = vm["primitive"].as<string>();
+  if(primitive != "faa" && primitive != "cas") {
+    cerr << "Invalid primitive name" << endl;
+    exit(1);
+  }
+  RmwBenchmark<PERSIST> benchmark(vm["threads"].as<int>(), vm["words"].as<int>(), 
+                                  primitive == "cas", vm["runtime"].as<double>());
+  benchmark.print_name();
+  benchmark.bench();
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description description("Usage:");
+
+  description.add_options()
+  ("help,h", "Display this help message")
+  ("threads,t", po::value<int>()->default_value(4), "Number of Threads")
+  ("words,w", po::value<int>()->default_value(1), "Number of shared words (fewer = more contention)")
+  ("runtime,r", po::value<double>()->default_value(0.5), "Runtime of Benchmark (seconds)")
+  ("primitive,o", po::value<string>()->default_value("faa"), 
+                      "Choose one of: faa (fetch_add), cas (CAS loop emulation)")
+  ("persist,p", po::value<string>()->default_value("counter"), 
+                      "Choose one of: counter, counter16/32, hash20, hash20w16/w32, striped20, adaptive20, simple, interface, eadr");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(description).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help")){
+    cout << description;
+    exit(0);
+  }
+
+  string persist_type = vm["persist"].as<string>();
+  if(persist_type == "counter") run_benchmark<persist_counter>(vm);
+  else if(persist_type == "counter16") run_benchmark<persist_counter_w16>(vm);
+  else if(persist_type == "counter32") run_benchmark<persist_counter_w32>(vm);
+  else if(persist_type == "hash20") run_benchmark<persist_hash_cacheline_20>(vm);
+  else if(persist_type == "hash20w16") run_benchmark<persist_hash_cacheline_20_w16>(vm);
+  else if(persist_type == "hash20w32") run_benchmark<persist_hash_cacheline_20_w32>(vm);
+  else if(persist_type == "striped20") run_benchmark<persist_striped_20>(vm);
+  else if(persist_type == "adaptive20") run_benchmark<persist_adaptive_20>(vm);
+  else if(persist_type == "simple") run_benchmark<persist_simple>(vm);
+  else if(persist_type == "interface") run_benchmark<persist_interface>(vm);
+  else if(persist_type == "eadr") run_benchmark<persist_eadr>(vm);
+  else {
+    cerr << "Invalid persist name" << endl;
+    exit(1);
+  }
+
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <unistd.h>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include <common/rand_r_32.h>
+#include <common/ssmem_wrapper.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+namespace po = boost::program_options;
+
+/* Threads that come and go, as in a thread pool that recycles its workers.
+   Every round starts a batch of threads that each run a number of
+   operations and exit. An operation allocates an object and swaps it into a
+   random slot of a shared array, and frees the object it took out, which was
+   mostly allocated by a thread of an earlier round. Every few rounds the
+   benchmark prints the time per round, the timestamps ssmem keeps, the
+   chunks of the threads that exited, the resident memory and the garbage:
+   with the memory of exiting threads handed over to the next ones, all of
+   these stay flat. */
+struct ThreadChurnBenchmark : Benchmark {
+
+  ThreadChurnBenchmark(int _thread_count, int _rounds, int _ops, int _slots, int _report):
+                       Benchmark(), thread_count(_thread_count), rounds(_rounds), ops(_ops), slots(_slots),
+                       report(_report), shared(_slots) {
+    for(auto& s : shared) s = nullptr;
+  }
+
+  static size_t resident_mb() {
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if(f == nullptr) return 0;
+    if(fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+  }
+
+  static int orphan_chunks() {
+    std::lock_guard<std::mutex> lock(ssmem_orphan_lock);
+    int n = 0;
+    for(ssmem_list_t* c = ssmem_orphan_chunks; c != nullptr; c = c->next) n++;
+    return n;
+  }
+
+  void bench() override {
+    std::cout << "\tround  ms/round  timestamps  chunks  resident MB  garbage MB" << std::endl;
+    start_timer();
+    double last = 0;
+    for(int r = 1; r <= rounds; r++) {
+      std::vector<std::thread> threads;
+      for(int p = 0; p < thread_count; p++) {
+        threads.emplace_back([this, r, p]() {
+          my_rand::init(r * thread_count + p);
+          for(int i = 0; i < ops; i++) {
+            void* o = ssmem.alloc(OBJECT_SIZE, false);
+            void* old = shared[my_rand::get_rand() % slots].exchange(o);
+            if(old != nullptr) ssmem.free(old, OBJECT_SIZE, false);
+          }
+        });
+      }
+      for(auto& t : threads) t.join();
+
+      if(r % report == 0 || r == rounds) {
+        double now = read_timer();
+        printf("\t%5d  %8.2f  %10u  %6d  %11zu  %10.2f\n", r, (now - last) * 1000 / report, ssmem_ts_list_len,
+               orphan_chunks(), resident_mb(), ssmem_garbage_bytes() / (1024.0 * 1024));
+        last = now;
+      }
+    }
+    std::cout << "\tElapsed time = " << read_timer() << " second(s)" << std::endl;
+  }
+
+  void print_name() {
+    std::cout << "----------------------------------------------------------------" << std::endl;
+    std::cout << "\tThread Churn Benchmark: P = " << thread_count << " per round, rounds = " << rounds
+              << ", operations per thread = " << ops << ", slots = " << slots << std::endl;
+    std::cout << "--------------------------------------------------------------" << std::endl;
+  }
+
+  static const size_t OBJECT_SIZE = 64;
+  const int thread_count, rounds, ops, slots, report;
+  std::vector<std::atomic<void*>> shared;
+};
+
+int main(int argc, char *argv[]) {
+  po::options_description description("Usage:");
+
+  description.add_options()
+  ("help,h", "Display this help message")
+  ("threads,t", po::value<int>()->default_value(4), "Threads started per round")
+  ("rounds,r", po::value<int>()->default_value(1000), "Number of rounds")
+  ("ops,o", po::value<int>()->default_value(10000), "Operations per thread")
+  ("slots,s", po::value<int>()->default_value(100000), "Objects shared by the threads")
+  ("report", po::value<int>()->default_value(100), "Print statistics every this many rounds");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(description).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help")){
+    cout << description;
+    exit(0);
+  }
+
+  if(vm["threads"].as<int>() < 1 || vm["rounds"].as<int>() < 1 || vm["slots"].as<int>() < 1 ||
+     vm["report"].as<int>() < 1) {
+    cerr << "Invalid threads, rounds, slots or report interval" << endl;
+    exit(1);
+  }
+
+  ThreadChurnBenchmark benchmark(vm["threads"].as<int>(), vm["rounds"].as<int>(), vm["ops"].as<int>(),
+                                 vm["slots"].as<int>(), vm["report"].as<int>());
+  benchmark.print_name();
+  benchmark.bench();
+  return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef PERF_COUNTER_HPP_
+#define PERF_COUNTER_HPP_
+
+#include <stdint.h>
+#include <string.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Hardware event counter of this process through perf_event_open. The counter
+// follows the threads that are created after it was opened, and their counts
+// are added to it when they exit, so it must be opened before the threads are
+// started and read after they were joined. Without permission to count
+// (perf_event_paranoid, containers) or without the event on this CPU, the
+// counter is not available and reads return -1.
+class PerfCounter {
+public:
+  PerfCounter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  ~PerfCounter() {
+    if(fd >= 0) close(fd);
+  }
+
+  PerfCounter(const PerfCounter&) = delete;
+  PerfCounter& operator=(const PerfCounter&) = delete;
+
+  // config of the data TLB misses of loads (type PERF_TYPE_HW_CACHE)
+  static const uint64_t DTLB_LOAD_MISSES = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+  bool available() const {
+    return fd >= 0;
+  }
+
+  void start() {
+    if(fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  void stop() {
+    if(fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+
+  long long read() const {
+    uint64_t count;
+    if(fd < 0 || ::read(fd, &count, sizeof(count)) != sizeof(count)) return -1;
+    return count;
+  }
+
+private:
+  int fd;
+};
+
+#endif /* PERF_COUNTER_HPP_ */
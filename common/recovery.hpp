@@ -0,0 +1,175 @@
+#ifndef RECOVERY_HPP_
+#define RECOVERY_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "ssmem_wrapper.hpp"
+
+// Recovery of the durable data structures after a restart.
+//
+// Every durable set has a recover(threads) method that walks the persistent
+// image from its root and repairs what the operations in flight at the crash
+// left behind: nodes that were marked but are still linked, skiplist towers
+// that are only partly linked, pending BST deletions. While it walks, it
+// reports every node that is still part of the structure with reachable().
+//
+// Nodes that were allocated but never published, and nodes that were
+// removed but not reclaimed yet, are not reported. With a pool
+// (common/ssmem_pool.h), recovery of all structures in the pool is bracketed
+// by begin() and end(), and end() hands every slot of the pool chunks that
+// was not reported back to ssmem. Without a pool, recover() only repairs.
+//
+// The free lists, pending sets and bump pointers of ssmem are volatile, so
+// this is the only record of the pool memory that survives a crash: a slot
+// is live if it is reachable, everything else in a chunk up to its
+// persistent high-water mark (used) is free, and the end of the chunk past
+// that mark was never handed out. That end goes back to ssmem as well, as
+// the remnant of a chunk that the next allocator of its size class carves
+// on, so a restart does not leave any pool memory behind.
+//
+//   ssmem_pool_open(path, 0);
+//   recovery::begin();
+//   for every root: set->recover();
+//   recovery::end();
+//
+// Recovery must run before any thread uses the structures or allocates with
+// ssmem, and every structure in the pool must be recovered before end().
+// Slots are found by the size class recorded in each chunk.
+namespace recovery {
+
+  // slots per recovered free set
+  const size_t FREE_SET_SIZE = 4096;
+
+  // one bit per cache line of the pool, set for reported nodes
+  std::atomic<uint64_t>* reachable_map = nullptr;
+
+  // statistics of the current recovery
+  std::atomic<long long> nodes(0);          // nodes reported reachable
+  std::atomic<long long> unlinked(0);       // removed nodes unlinked
+  std::atomic<long long> relinked(0);       // index links rewritten (skiplist)
+  std::atomic<long long> reclaimed(0);      // slots handed back to ssmem
+  std::atomic<long long> tails(0);          // chunk ends handed back to ssmem
+  std::atomic<long long> tail_bytes(0);
+
+  inline int default_threads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // Calls f(i) for every i in [0, n) on up to threads threads
+  template<typename F>
+  void parallel_for(int threads, size_t n, F f) {
+    if(threads <= 1 || n <= 1) {
+      for(size_t i = 0; i < n; i++) f(i);
+      return;
+    }
+    // indices are handed out in blocks, e.g. for the buckets of a hash table
+    size_t block = std::max((size_t) 1, n / (threads * 64));
+    std::atomic<size_t> next(0);
+    auto work = [&next, n, block, &f] () {
+      size_t i;
+      while((i = next.fetch_add(block)) < n)
+        for(size_t j = i; j < std::min(i + block, n); j++) f(j);
+    };
+    std::vector<std::thread> workers;
+    for(size_t t = 1; t < std::min((size_t) threads, n); t++)
+      workers.emplace_back(work);
+    work();
+    for(auto& w : workers) w.join();
+  }
+
+  inline void reachable(void* p) {
+    if(reachable_map == nullptr || !ssmem_pool_contains(p)) return;
+    uint64_t line = ((char*) p - ssmem_pool_global.base) / CACHE_LINE_SIZE;
+    reachable_map[line / 64].fetch_or(1ull << (line % 64), std::memory_order_relaxed);
+  }
+
+  inline bool is_reachable(void* p) {
+    uint64_t line = ((char*) p - ssmem_pool_global.base) / CACHE_LINE_SIZE;
+    return reachable_map[line / 64].load(std::memory_order_relaxed) & (1ull << (line % 64));
+  }
+
+  inline void add_stats(long long n, long long u, long long r = 0) {
+    nodes += n;
+    unlinked += u;
+    if(r) relinked += r;
+  }
+
+  inline void reset_stats() {
+    nodes = unlinked = relinked = reclaimed = tails = tail_bytes = 0;
+  }
+
+  inline void begin() {
+    reset_stats();
+    if(!ssmem_pool_is_open()) return;
+    size_t lines = ssmem_pool_global.size / CACHE_LINE_SIZE;
+    reachable_map = (std::atomic<uint64_t>*) calloc(lines / 64 + 1, sizeof(uint64_t));
+    assert(reachable_map != nullptr);
+  }
+
+  // Hands the end of chunk c past its high-water mark, from the first slot
+  // that was never handed out, to the remnants of ssmem
+  inline void reclaim_tail(ssmem_pool_chunk_t* c) {
+    uint64_t size = c->obj_size;
+    uint64_t curr = size == 0 ? 0 : c->used / size * size;
+    if(curr + std::max<uint64_t>(size, 1) > c->size) return;
+    {
+      std::lock_guard<std::mutex> lock(ssmem_orphan_lock);
+      ssmem_orphan_remnant_add(ssmem_pool_chunk_mem(c), curr, c->size, c->used,
+                               size == 0 ? -1 : ssmem_size_class(size));
+    }
+    tails++;
+    tail_bytes += c->size - curr;
+  }
+
+  // Sweeps the pool chunks: every slot that was not reported goes to the
+  // recovered sets of ssmem, from which the allocators take memory before
+  // they carve out new objects, and the end of every chunk to its remnants.
+  // Returns the number of reclaimed slots.
+  inline long long end(int threads = default_threads()) {
+    if(reachable_map == nullptr) return 0;
+    std::vector<ssmem_pool_chunk_t*> chunks;
+    for(ssmem_pool_chunk_t* c = ssmem_pool_first_chunk(); c != nullptr; c = ssmem_pool_next_chunk(c))
+      chunks.push_back(c);
+
+    parallel_for(threads, chunks.size(), [&chunks] (size_t i) {
+      ssmem_pool_chunk_t* c = chunks[i];
+      uint64_t size = c->obj_size;
+      if(size == 0 || (size <= SSMEM_MAX_CLASS_SIZE && ssmem_class_size(ssmem_size_class(size)) == size))
+        reclaim_tail(c);
+      if(size == 0) return;
+      char* mem = (char*) ssmem_pool_chunk_mem(c);
+      ssmem_free_set_t* fs = nullptr;
+      long long n = 0;
+      for(uint64_t off = 0; off + size <= c->used; off += size) {
+        if(is_reachable(mem + off)) continue;
+        if(fs == nullptr) fs = ssmem_free_set_new(FREE_SET_SIZE, nullptr);
+        fs->set[fs->curr++] = (uintptr_t) (mem + off);
+        n++;
+        if(fs->curr == (long) fs->size) {
+          ssmem_recovered_push(size, fs);
+          fs = nullptr;
+        }
+      }
+      if(fs != nullptr) ssmem_recovered_push(size, fs);
+      reclaimed += n;
+    });
+
+    free(reachable_map);
+    reachable_map = nullptr;
+    return reclaimed;
+  }
+
+  inline void print_stats() {
+    std::cout << "\tRecovered nodes = " << nodes << std::endl;
+    std::cout << "\tUnlinked removed nodes = " << unlinked << std::endl;
+    if(relinked) std::cout << "\tRelinked index links = " << relinked << std::endl;
+    std::cout << "\tReclaimed slots = " << reclaimed << std::endl;
+    std::cout << "\tReclaimed chunk ends = " << tails << " (" << tail_bytes / (1024 * 1024) << " MB)" << std::endl;
+  }
+}
+
+#endif /* RECOVERY_HPP_ */
@@ -39,17 +39,32 @@
 /* parameters */
 /* **************************************************************************************** */
 
-#define SSMEM_TRANSPARENT_HUGE_PAGES 0 /* Use or not Linux transparent huge pages */
 #define SSMEM_ZERO_MEMORY            0 /* Initialize allocated memory to 0 or not */
 #define SSMEM_GC_FREE_SET_SIZE 507 /* mem objects to free before doing a GC pass */
 #define SSMEM_GC_RLSE_SET_SIZE 3   /* num of released object before doing a GC pass */
-#define SSMEM_DEFAULT_MEM_SIZE (32 * 1024 * 1024L) /* memory-chunk size that each threads
-                gives to the allocators */
-#define SSMEM_MEM_SIZE_DOUBLE  0 /* if the allocator is out of memory, should it allocate
-          a 2x larger chunk than before? (in order to stop asking
-         for memory again and again */
+#define SSMEM_DEFAULT_MEM_SIZE (32 * 1024 * 1024L) /* largest memory-chunk size that each
+                thread gives to a size class of its allocators */
+#define SSMEM_MEM_SIZE_MIN     (256 * 1024L) /* size of the first chunk of a size class */
+/* The chunks of a size class start at SSMEM_MEM_SIZE_MIN and double with every new
+   chunk up to the size of the allocator (SSMEM_DEFAULT_MEM_SIZE), so a thread maps
+   256KB for each class it uses rather than 32MB, i.e. at most 8.5MB instead of 1088MB
+   for all SSMEM_NUM_CLASSES classes. A class that keeps allocating gets 32MB chunks
+   after 7 smaller ones (32MB in total). Page policies with huge pages round every
+   chunk up to the page size (ssmem_chunk_size()). */
+#define SSMEM_MEM_SIZE_DOUBLE  0 /* should the chunks keep doubling beyond the size of
+          the allocator? (in order to stop asking for memory again and again */
 #define SSMEM_MEM_SIZE_MAX     (4 * 1024 * 1024 * 1024LL) /* absolute max chunk size 
                  (e.g., if doubling is 1) */
+#define SSMEM_MAX_AVAILABLE_SETS 256 /* empty free sets an allocator keeps for reuse */
+#define SSMEM_MAX_THREADS      512 /* capacity of a timestamp set. Threads may subscribe
+          after a set was collected, so sets are not sized by ssmem_ts_list_len */
+
+/* Objects are rounded up to a size class. Every class has its own bump region and
+   free/collected sets in each allocator, so that freed memory is only reused for
+   objects of the same class. Classes are 16 bytes apart up to 256 bytes, 64 bytes
+   apart up to 1 KB, and powers of two up to SSMEM_MAX_CLASS_SIZE. */
+#define SSMEM_NUM_CLASSES      34
+#define SSMEM_MAX_CLASS_SIZE   (64 * 1024)
 
 /* increase the thread-local timestamp of activity on each ssmem_alloc() and/or ssmem_free() 
    call. If enabled (>0), after some memory is alloced and/or freed, the thread should not 
@@ -64,6 +79,42 @@
 #define SSMEM_TS_INCR_ON_FREE   3
 
 #define SSMEM_TS_INCR_ON        SSMEM_TS_INCR_ON_FREE
+
+/* how ssmem decides that a full free set can be reused. Both backends rely on the
+   quiescent points above (ssmem_ts_next()).
+   - timestamps: a full free set records the timestamps of all threads, and is reused
+   once every thread has advanced past them. Recording and comparing take O(threads).
+   - epochs (DEBRA-style): every quiescent point announces the global epoch and checks
+   the announcement of one other thread; once all threads announced the current epoch,
+   it advances. A full free set is stamped with the epoch and reused two epochs later. */
+#define SSMEM_RECLAIM_TIMESTAMPS 0
+#define SSMEM_RECLAIM_EPOCHS     1
+
+#ifndef SSMEM_RECLAIM
+#  define SSMEM_RECLAIM SSMEM_RECLAIM_EPOCHS
+#endif
+#define SSMEM_EPOCH_CHECK_PERIOD 16 /* quiescent points per check of another thread */
+#define SSMEM_EPOCH_OFFLINE ((size_t)-1) /* announced by threads that hold no references */
+#define SSMEM_TS_INACTIVE   ((size_t)-1) /* timestamp recorded for ids without a thread */
+
+/* A thread that exits (ssmem_alloc_orphan(), called by ~ssmem_wrapper) leaves its
+   memory to the threads that remain: its collected sets and the unused part of its
+   chunks are adopted by the next allocators that run out of memory in the class, and
+   its free sets become reusable once all threads have moved on. The thread then
+   unsubscribes and its id is reused by the next thread that subscribes, together with
+   its timestamp, so the number of timestamps to check stays bounded by the largest
+   number of threads that ran at the same time. */
+
+/* On machines with several NUMA nodes, the chunks of a thread are placed on the node
+   it runs on when it subscribes (ssmem_thread_set_node() changes it). An object freed
+   by a thread on another node does not go into the free sets of that thread: it is
+   batched per home node and size class, and once the batch is safe to reuse it is
+   pushed to a lock-free inbox of the home node, from which the allocators there take
+   memory before they carve new objects. A batch is sealed when it is full, and every
+   SSMEM_REMOTE_FLUSH_PERIOD quiescent points even if it is not, so a thread that
+   stops freeing remote objects does not keep them. ssmem_numa_route turns the
+   routing on or off at runtime; it is on by default on NUMA machines. */
+#define SSMEM_REMOTE_FLUSH_PERIOD 4096
 /* **************************************************************************************** */
 /* help definitions */
 /* **************************************************************************************** */
@@ -74,6 +125,21 @@
 /* data structures used by ssmem */
 /* **************************************************************************************** */
 
+/* the memory of one size class in an allocator */
+typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_class
+{
+  void* mem;    /* the chunk objects of this class are carved out of (nullptr until used) */
+  size_t mem_curr;    /* pointer to the next addrr to be allocated */
+  size_t mem_size;    /* size of mem chunk */
+  size_t mem_used;    /* part of mem whose use is recorded in the pool chunk header */
+  struct ssmem_free_set* free_set_list; /* list of free_set. A free set holds freed mem 
+           that has not yet been reclaimed (nullptr until the first free) */
+  size_t free_set_num;  /* number of sets in the free_set_list */
+  struct ssmem_free_set* collected_set_list; /* list of collected_set. A collected set
+          contains mem that has been reclaimed */
+  size_t collected_set_num; /* number of sets in the collected_set_list */
+} ssmem_class_t;
+
 /* an ssmem allocator */
 typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_allocator
 {
@@ -81,28 +147,28 @@ typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_allocator
   {
     struct
     {
-      void* mem;    /* the actual memory the allocator uses */
-      size_t mem_curr;    /* pointer to the next addrr to be allocated */
-      size_t mem_size;    /* size of mem chunk */
+      size_t mem_size;    /* size of new mem chunks */
       size_t tot_size;    /* total memory that the allocator uses */
       size_t fs_size;   /* size (in objects) of free_sets */
       struct ssmem_list* mem_chunks; /* list of mem chunks (used to free the mem) */
 
       struct ssmem_ts* ts;  /* timestamp object associated with the allocator */
 
-      struct ssmem_free_set* free_set_list; /* list of free_set. A free set holds freed mem 
-               that has not yet been reclaimed */
-      size_t free_set_num;  /* number of sets in the free_set_list */
-      struct ssmem_free_set* collected_set_list; /* list of collected_set. A collected set
-              contains mem that has been reclaimed */
-      size_t collected_set_num; /* number of sets in the collected_set_list */
       struct ssmem_free_set* available_set_list; /* list of set structs that are not used
               and can be used as free sets */
       size_t released_num;  /* number of released memory objects */
       struct ssmem_released* released_mem_list; /* list of release memory objects */
+      size_t available_set_num; /* number of sets in the available_set_list */
+
+      struct ssmem_free_set** remote_sets; /* the set that collects objects of each home node
+              and class, indexed by node * SSMEM_NUM_CLASSES + class (nullptr until the first
+              remote free) */
+      struct ssmem_free_set* remote_pending_list; /* full remote sets that may still be accessed */
+      size_t remote_pending_num;
     };
     uint8_t padding[2 * CACHE_LINE_SIZE];
   };
+  ssmem_class_t classes[SSMEM_NUM_CLASSES];
 } ssmem_allocator_t;
 
 /* a timestamp used by a thread */
@@ -115,6 +181,12 @@ typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_ts
       size_t version;
       size_t id;
       struct ssmem_ts* next;
+      size_t epoch;   /* last global epoch announced at a quiescent point */
+      size_t garbage_objs;  /* objects freed by the thread that cannot be reused yet */
+      size_t garbage_bytes;
+      size_t node;    /* NUMA node of the chunks of the thread */
+      size_t routed_objs; /* objects freed by the thread that were routed to another node */
+      size_t active;  /* 0 once the thread exited, until its id is reused */
     };
   };
   uint8_t padding[CACHE_LINE_SIZE];
@@ -134,6 +206,9 @@ typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_free_set
   long int curr;    
   struct ssmem_free_set* set_next;
   uintptr_t* set;
+  size_t epoch;   /* global epoch when the set became full (epochs backend) */
+  int node;   /* home node and class of the objects of a remote set */
+  int cls;
 } ssmem_free_set_t;
 
 
@@ -155,9 +230,26 @@ typedef struct ssmem_released
 typedef struct ssmem_list
 {
   void* obj;
+  size_t size; /* length of the mapping of a chunk that is unmapped when freed, 0 otherwise */
+  size_t len;  /* length of a chunk */
   struct ssmem_list* next;
 } ssmem_list_t;
 
+/*
+ * the unused end of the chunk of a size class, left by a thread that exited
+ * or found by a recovery pass; a pool chunk that no object was carved out of
+ * yet has cls -1 and goes to any class
+ */
+typedef struct ssmem_remnant
+{
+  void* mem;
+  size_t mem_curr;
+  size_t mem_size;
+  size_t mem_used;
+  int cls;
+  struct ssmem_remnant* next;
+} ssmem_remnant_t;
+
 /* **************************************************************************************** */
 /* ssmem interface */
 /* **************************************************************************************** */
@@ -170,15 +262,31 @@ void ssmem_alloc_init_fs_size(ssmem_allocator_t* a, size_t size, size_t free_set
 void ssmem_gc_thread_init(ssmem_allocator_t* a, int id);
 /* terminate the system (all allocators) and free all memory */
 void ssmem_term();
+/* hand the memory of allocator a over to the other threads, and unsubscribe the thread
+ * after its last allocator. For threads that exit while other threads may still use
+ * objects allocated by a */
+void ssmem_alloc_orphan(ssmem_allocator_t* a);
+/* the lowest thread id that is not in use, and giving it back */
+int ssmem_id_acquire();
+void ssmem_id_release(int id);
 /* terminate the allocator a and free all its memory
  * This function should NOT be used if the memory allocated by this allocator
  * might have been freed (and is still in use) by other allocators */
 void ssmem_alloc_term(ssmem_allocator_t* a);
 
+/* the size class of objects of size bytes, a constant expression for constant sizes */
+constexpr int ssmem_size_class(size_t size);
+/* the size of the objects of class c */
+constexpr size_t ssmem_class_size(int c);
+
 /* allocate some memory using allocator a */
 void* ssmem_alloc(ssmem_allocator_t* a, size_t size, bool flush);
-/* free some memory using allocator a */
-void ssmem_free(ssmem_allocator_t* a, void* obj, bool flush);
+/* allocate an object of class c using allocator a */
+void* ssmem_alloc_class(ssmem_allocator_t* a, int c, bool flush);
+/* free some memory of size bytes using allocator a */
+void ssmem_free(ssmem_allocator_t* a, void* obj, size_t size, bool flush);
+/* free an object of class c using allocator a */
+void ssmem_free_class(ssmem_allocator_t* a, void* obj, int c, bool flush);
 
 /* release some memory to the OS using allocator a */
 void ssmem_release(ssmem_allocator_t* a, void* obj);
@@ -189,6 +297,23 @@ this point. */
 void ssmem_ts_next();
 #define SSMEM_SAFE_TO_RECLAIM() ssmem_ts_next()
 
+/* the calling thread holds no ssmem-allocated memory references until it calls
+   ssmem_thread_online(), so it does not hold back reclamation while it is idle
+   (epochs only, no effect with timestamps) */
+void ssmem_thread_offline();
+void ssmem_thread_online();
+
+/* the NUMA node whose memory the chunks of the calling thread use from now on */
+void ssmem_thread_set_node(int node);
+/* objects freed on another node than their home node, of thread id or of all threads (-1) */
+size_t ssmem_routed_objs(int id);
+
+/* print, for every thread, the memory it freed that cannot be reused yet */
+void ssmem_garbage_print();
+/* bytes freed that cannot be reused yet, of thread id or of all threads (-1, including
+   the threads that exited) */
+size_t ssmem_garbage_bytes(int id);
+
 
 /* debug/help functions */
 void ssmem_ts_list_print();
@@ -231,15 +356,39 @@ void ssmem_all_list_print(ssmem_allocator_t* a, int id);
 #include <assert.h>
 #include <string.h>
 #include <iostream>
+#include <atomic>
+#include <mutex>
 
 #include <persist/pmem_utils.hpp>
 #include <persist/utils.hpp>
+#include <persist/numa_utils.hpp>
+
+#include "ssmem_pages.h"
 
 ssmem_ts_t *ssmem_ts_list = nullptr;
 volatile uint32_t ssmem_ts_list_len = 0;
+ssmem_ts_t *ssmem_ts_table[SSMEM_MAX_THREADS]; /* the timestamps by thread id */
+volatile uint32_t ssmem_ts_table_len = 0; /* 1 + highest subscribed id */
+ALIGNED(CACHE_LINE_SIZE) std::atomic<size_t> ssmem_epoch(1);
+__thread uint32_t ssmem_epoch_next_check = 0; /* next thread whose announcement to check */
 __thread volatile ssmem_ts_t *ssmem_ts_local = nullptr;
 __thread size_t ssmem_num_allocators = 0;
 __thread ssmem_list_t *ssmem_allocator_list = nullptr;
+bool ssmem_numa_route = numa::num_nodes() > 1;
+/* safe remote sets by home node and class */
+std::atomic<ssmem_free_set_t *> ssmem_numa_inbox[numa::MAX_NODES][SSMEM_NUM_CLASSES];
+std::atomic<uint64_t> ssmem_ids[SSMEM_MAX_THREADS / 64]; /* thread ids in use */
+
+/* memory left by threads that exited (ssmem_alloc_orphan()) */
+std::mutex ssmem_orphan_lock;
+ssmem_free_set_t *ssmem_orphan_pending_list = nullptr; /* free sets that may still be accessed */
+std::atomic<size_t> ssmem_orphan_pending_num(0);
+ssmem_remnant_t *ssmem_orphan_remnants = nullptr;
+std::atomic<size_t> ssmem_orphan_remnants_num(0);
+ssmem_list_t *ssmem_orphan_chunks = nullptr; /* freed by ssmem_term() */
+ssmem_released_t *ssmem_orphan_released_list = nullptr; /* freed by ssmem_term() */
+std::atomic<size_t> ssmem_orphan_garbage_objs(0); /* objects of the pending sets */
+std::atomic<size_t> ssmem_orphan_garbage_bytes(0);
 
 inline int
 ssmem_get_id()
@@ -251,7 +400,49 @@ ssmem_get_id()
   return -1;
 }
 
-static ssmem_list_t *ssmem_list_node_new(void *mem, ssmem_list_t *next, bool flush);
+int ssmem_id_acquire()
+{
+  for (int w = 0; w < SSMEM_MAX_THREADS / 64; w++)
+  {
+    uint64_t used = ssmem_ids[w].load();
+    while (~used != 0)
+    {
+      int b = __builtin_ctzll(~used);
+      if (ssmem_ids[w].compare_exchange_weak(used, used | (1ull << b)))
+      {
+        return w * 64 + b;
+      }
+    }
+  }
+  fprintf(stderr, "[ALLOC] more than %d threads\n", SSMEM_MAX_THREADS);
+  abort();
+}
+
+void ssmem_id_release(int id)
+{
+  ssmem_ids[id / 64].fetch_and(~(1ull << (id % 64)));
+}
+
+static ssmem_list_t *ssmem_list_node_new(void *mem, ssmem_list_t *next, bool flush, size_t size = 0, size_t len = 0);
+
+constexpr int
+ssmem_size_class(size_t size)
+{
+  return size <= 256 ? (size <= 16 ? 0 : (size - 1) / 16)
+       : size <= 1024 ? 16 + (size - 257) / 64
+       : 28 + (64 - __builtin_clzll(size - 1)) - 11;
+}
+
+constexpr size_t
+ssmem_class_size(int c)
+{
+  return c < 16 ? 16 * (c + 1)
+       : c < 28 ? 256 + 64 * (c - 15)
+       : (size_t)2048 << (c - 28);
+}
+
+static_assert(ssmem_class_size(SSMEM_NUM_CLASSES - 1) == SSMEM_MAX_CLASS_SIZE, "size classes");
+static_assert(ssmem_size_class(SSMEM_MAX_CLASS_SIZE) == SSMEM_NUM_CLASSES - 1, "size classes");
 
 /* 
  * explicitely subscribe to the list of threads in order to used timestamps for GC
@@ -259,14 +450,38 @@ static ssmem_list_t *ssmem_list_node_new(void *mem, ssmem_list_t *next, bool flu
 void ssmem_gc_thread_init(ssmem_allocator_t *a, int id)
 {
   a->ts = (ssmem_ts_t *)ssmem_ts_local;
-  if (a->ts == nullptr)
+  if (a->ts == nullptr && id < SSMEM_MAX_THREADS && ssmem_ts_table[id] != nullptr)
+  {
+    /* the id of a thread that exited: its timestamp continues from where it stopped */
+    a->ts = ssmem_ts_table[id];
+    ssmem_ts_local = a->ts;
+    a->ts->node = numa::current_node();
+    __atomic_store_n(&a->ts->epoch, ssmem_epoch.load(), __ATOMIC_SEQ_CST);
+    __atomic_store_n(&a->ts->active, 1, __ATOMIC_SEQ_CST);
+  }
+  else if (a->ts == nullptr)
   {
     a->ts = (ssmem_ts_t *)aligned_alloc(CACHE_LINE_SIZE, sizeof(ssmem_ts_t));
     assert(a->ts != nullptr);
     ssmem_ts_local = a->ts;
 
+    assert(id < SSMEM_MAX_THREADS);
     a->ts->id = id;
     a->ts->version = 0;
+    /* a new thread holds no references, it is quiescent in the current epoch */
+    a->ts->epoch = ssmem_epoch.load();
+    a->ts->garbage_objs = 0;
+    a->ts->garbage_bytes = 0;
+    a->ts->node = numa::current_node();
+    a->ts->routed_objs = 0;
+    a->ts->active = 1;
+    ssmem_ts_table[id] = a->ts;
+    uint32_t len;
+    do
+    {
+      len = ssmem_ts_table_len;
+    } while (len < (uint32_t)id + 1 &&
+             !__sync_bool_compare_and_swap(&ssmem_ts_table_len, len, (uint32_t)id + 1));
 
     do
     {
@@ -290,38 +505,25 @@ void ssmem_alloc_init_fs_size(ssmem_allocator_t *a, size_t size, size_t free_set
   ssmem_num_allocators++;
   ssmem_allocator_list = ssmem_list_node_new((void *)a, ssmem_allocator_list, true);
 
-#if SSMEM_TRANSPARENT_HUGE_PAGES == 1
-  int ret = posix_memalign(&a->mem, CACHE_LINE_SIZE, size);
-  assert(ret == 0);
-#else
-  a->mem = (void *)aligned_alloc(CACHE_LINE_SIZE, size);
-#endif
-  assert(a->mem != nullptr);
-#if SSMEM_ZERO_MEMORY == 1
-  memset(a->mem, 0, size);
-#endif
-
-  a->mem_curr = 0;
+  /* the chunk of a class is allocated by its first ssmem_alloc() */
+  memset(a->classes, 0, sizeof(a->classes));
   a->mem_size = size;
-  a->tot_size = size;
+  a->tot_size = 0;
   a->fs_size = free_set_size;
 
-  a->mem_chunks = ssmem_list_node_new(a->mem, nullptr, true);
-  FLUSH(&a->mem_chunks);
-  FENCE();    
+  a->mem_chunks = nullptr;
 
   ssmem_gc_thread_init(a, id);
 
-  a->free_set_list = ssmem_free_set_new(a->fs_size, nullptr);
-  a->free_set_num = 1;
-
-  a->collected_set_list = nullptr;
-  a->collected_set_num = 0;
-
   a->available_set_list = nullptr;
+  a->available_set_num = 0;
 
   a->released_mem_list = nullptr;
   a->released_num = 0;
+
+  a->remote_sets = nullptr;
+  a->remote_pending_list = nullptr;
+  a->remote_pending_num = 0;
 }
 
 /* 
@@ -338,12 +540,14 @@ void ssmem_alloc_init(ssmem_allocator_t *a, size_t size, int id)
  * 
  */
 static ssmem_list_t *
-ssmem_list_node_new(void *mem, ssmem_list_t *next, bool flush = true)
+ssmem_list_node_new(void *mem, ssmem_list_t *next, bool flush, size_t size, size_t len)
 {
   ssmem_list_t *mc;
   mc = (ssmem_list_t *)malloc(sizeof(ssmem_list_t));
   assert(mc != nullptr);
   mc->obj = mem;
+  mc->size = size;
+  mc->len = len;
   mc->next = next;
   if(flush) {
     FLUSH(mc);
@@ -359,7 +563,7 @@ inline ssmem_released_t *
 ssmem_released_node_new(void *mem, ssmem_released_t *next)
 {
   ssmem_released_t *rel;
-  rel = (ssmem_released_t *)malloc(sizeof(ssmem_released_t) + (ssmem_ts_list_len * sizeof(size_t)));
+  rel = (ssmem_released_t *)calloc(1, sizeof(ssmem_released_t) + (SSMEM_MAX_THREADS * sizeof(size_t)));
   assert(rel != nullptr);
   rel->mem = mem;
   rel->next = next;
@@ -399,6 +603,7 @@ ssmem_free_set_get_avail(ssmem_allocator_t *a, size_t size, ssmem_free_set_t *ne
   {
     fs = a->available_set_list;
     a->available_set_list = fs->set_next;
+    a->available_set_num--;
 
     fs->curr = 0;
     fs->set_next = next;
@@ -430,9 +635,16 @@ static inline void
 ssmem_free_set_make_avail(ssmem_allocator_t *a, ssmem_free_set_t *set)
 {
   /* printf("[ALLOC] added to avail_set : %p\n", set); */
+  if (__builtin_expect(a->available_set_num >= SSMEM_MAX_AVAILABLE_SETS, 0))
+  {
+    /* sets routed from other nodes would pile up here otherwise */
+    ssmem_free_set_free(set);
+    return;
+  }
   set->curr = 0;
   set->set_next = a->available_set_list;
   a->available_set_list = set;
+  a->available_set_num++;
 }
 
 /* 
@@ -443,13 +655,13 @@ void ssmem_alloc_term(ssmem_allocator_t *a)
   /* printf("[ALLOC] term() : ~ total mem used: %zu bytes = %zu KB = %zu MB\n", */
   /*   a->tot_size, a->tot_size / 1024, a->tot_size / (1024 * 1024)); */
   ssmem_list_t *mcur = a->mem_chunks;
-  do
+  while (mcur != nullptr)
   {
     ssmem_list_t *mnxt = mcur->next;
-    free(mcur->obj);
+    ssmem_chunk_free(mcur->obj, mcur->len, mcur->size);
     free(mcur);
     mcur = mnxt;
-  } while (mcur != nullptr);
+  }
 
   ssmem_list_t *prv = ssmem_allocator_list;
   ssmem_list_t *cur = ssmem_allocator_list;
@@ -479,19 +691,43 @@ void ssmem_alloc_term(ssmem_allocator_t *a)
     free(a->ts);
   }
 
-  /* printf("[ALLOC] free(free_set)\n"); fflush(stdout); */
-  /* freeing free sets */
-  ssmem_free_set_t *fs = a->free_set_list;
-  while (fs != nullptr)
+  ssmem_free_set_t *fs;
+  for (int c = 0; c < SSMEM_NUM_CLASSES; c++)
   {
-    ssmem_free_set_t *nxt = fs->set_next;
-    ssmem_free_set_free(fs);
-    fs = nxt;
+    /* printf("[ALLOC] free(free_set)\n"); fflush(stdout); */
+    /* freeing free sets */
+    fs = a->classes[c].free_set_list;
+    while (fs != nullptr)
+    {
+      ssmem_free_set_t *nxt = fs->set_next;
+      ssmem_free_set_free(fs);
+      fs = nxt;
+    }
+
+    /* printf("[ALLOC] free(collected_set)\n"); fflush(stdout); */
+    /* freeing collected sets */
+    fs = a->classes[c].collected_set_list;
+    while (fs != nullptr)
+    {
+      ssmem_free_set_t *nxt = fs->set_next;
+      ssmem_free_set_free(fs);
+      fs = nxt;
+    }
   }
 
-  /* printf("[ALLOC] free(collected_set)\n"); fflush(stdout); */
-  /* freeing collected sets */
-  fs = a->collected_set_list;
+  /* freeing the remote sets */
+  if (a->remote_sets != nullptr)
+  {
+    for (int i = 0; i < numa::MAX_NODES * SSMEM_NUM_CLASSES; i++)
+    {
+      if (a->remote_sets[i] != nullptr)
+      {
+        ssmem_free_set_free(a->remote_sets[i]);
+      }
+    }
+    free(a->remote_sets);
+  }
+  fs = a->remote_pending_list;
   while (fs != nullptr)
   {
     ssmem_free_set_t *nxt = fs->set_next;
@@ -529,8 +765,112 @@ void ssmem_term()
   {
     ssmem_alloc_term((ssmem_allocator_t *)ssmem_allocator_list->obj);
   }
+
+  /* the memory of the threads that exited */
+  std::lock_guard<std::mutex> lock(ssmem_orphan_lock);
+  while (ssmem_orphan_chunks != nullptr)
+  {
+    ssmem_list_t *nxt = ssmem_orphan_chunks->next;
+    ssmem_chunk_free(ssmem_orphan_chunks->obj, ssmem_orphan_chunks->len, ssmem_orphan_chunks->size);
+    free(ssmem_orphan_chunks);
+    ssmem_orphan_chunks = nxt;
+  }
+  while (ssmem_orphan_remnants != nullptr)
+  {
+    ssmem_remnant_t *nxt = ssmem_orphan_remnants->next;
+    free(ssmem_orphan_remnants);
+    ssmem_orphan_remnants = nxt;
+  }
+  ssmem_orphan_remnants_num = 0;
+  while (ssmem_orphan_pending_list != nullptr)
+  {
+    ssmem_free_set_t *nxt = ssmem_orphan_pending_list->set_next;
+    ssmem_free_set_free(ssmem_orphan_pending_list);
+    ssmem_orphan_pending_list = nxt;
+  }
+  ssmem_orphan_pending_num = 0;
+  while (ssmem_orphan_released_list != nullptr)
+  {
+    ssmem_released_t *nxt = ssmem_orphan_released_list->next;
+    free(ssmem_orphan_released_list->mem);
+    free(ssmem_orphan_released_list);
+    ssmem_orphan_released_list = nxt;
+  }
+}
+
+/* 
+ * 
+ */
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+/* 
+ * a quiescent point of thread ts: announce the global epoch if it changed,
+ * otherwise (every SSMEM_EPOCH_CHECK_PERIOD points) check whether the next
+ * thread has announced it, and advance the epoch once every thread has
+ */
+static inline void
+ssmem_epoch_quiescent(ssmem_ts_t *ts)
+{
+  size_t e = ssmem_epoch.load();
+  if (ts->epoch != e)
+  {
+    __atomic_store_n(&ts->epoch, e, __ATOMIC_SEQ_CST);
+    ssmem_epoch_next_check = 0;
+    return;
+  }
+  if (ts->version % SSMEM_EPOCH_CHECK_PERIOD != 0)
+  {
+    return;
+  }
+
+  uint32_t i = ssmem_epoch_next_check;
+  if (i < ssmem_ts_table_len)
+  {
+    ssmem_ts_t *t = ssmem_ts_table[i];
+    size_t te = t == nullptr ? e : __atomic_load_n(&t->epoch, __ATOMIC_ACQUIRE);
+    if (te != e && te != SSMEM_EPOCH_OFFLINE)
+    {
+      return;
+    }
+    ssmem_epoch_next_check = ++i;
+  }
+  if (i >= ssmem_ts_table_len)
+  {
+    ssmem_epoch.compare_exchange_strong(e, e + 1);
+    ssmem_epoch_next_check = 0;
+  }
+}
+#endif
+
+/* 
+ * 
+ */
+void
+ssmem_thread_offline()
+{
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+  if (ssmem_ts_local != nullptr)
+  {
+    __atomic_store_n(&ssmem_ts_local->epoch, SSMEM_EPOCH_OFFLINE, __ATOMIC_SEQ_CST);
+  }
+#endif
+}
+
+/* 
+ * 
+ */
+void
+ssmem_thread_online()
+{
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+  if (ssmem_ts_local != nullptr)
+  {
+    __atomic_store_n(&ssmem_ts_local->epoch, ssmem_epoch.load(), __ATOMIC_SEQ_CST);
+  }
+#endif
 }
 
+static void ssmem_remote_flush();
+
 /* 
  * 
  */
@@ -538,6 +878,13 @@ void
 ssmem_ts_next()
 {
   ssmem_ts_local->version++;
+  if (__builtin_expect(ssmem_numa_route && ssmem_ts_local->version % SSMEM_REMOTE_FLUSH_PERIOD == 0, 0))
+  {
+    ssmem_remote_flush();
+  }
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+  ssmem_epoch_quiescent((ssmem_ts_t *)ssmem_ts_local);
+#endif
 }
 
 /* 
@@ -548,7 +895,8 @@ ssmem_ts_set_collect(size_t *ts_set)
 {
   if (ts_set == nullptr)
   {
-    ts_set = (size_t *)malloc(ssmem_ts_list_len * sizeof(size_t));
+    /* threads that subscribe later keep 0 here */
+    ts_set = (size_t *)calloc(SSMEM_MAX_THREADS, sizeof(size_t));
     assert(ts_set != nullptr);
   }
 
@@ -556,7 +904,7 @@ ssmem_ts_set_collect(size_t *ts_set)
   while (cur != nullptr)
   {
     //std::cout << cur->id << " " << ssmem_ts_list_len << std::endl;
-    ts_set[cur->id] = cur->version;
+    ts_set[cur->id] = __atomic_load_n(&cur->active, __ATOMIC_SEQ_CST) ? cur->version : SSMEM_TS_INACTIVE;
     cur = cur->next;
   }
 
@@ -591,16 +939,232 @@ void ssmem_ts_set_print(size_t *set)
 #endif
 #endif
 
+/* 
+ * records the extent of the objects carved out of a pool chunk, so that
+ * recovery can find its slots (see ssmem_pool_chunk_track())
+ */
+static void
+ssmem_chunk_track(ssmem_class_t *c, size_t size)
+{
+  c->mem_used = ssmem_pool_chunk_track(c->mem, c->mem_curr, size);
+}
+
+/* 
+ * gives class c (of objects of size) the unused end of a chunk of a thread
+ * that exited, if there is one
+ */
+static bool
+ssmem_orphan_remnant_adopt(ssmem_class_t *c, size_t size)
+{
+  int cls = ssmem_size_class(size);
+  std::lock_guard<std::mutex> lock(ssmem_orphan_lock);
+  for (ssmem_remnant_t **prev = &ssmem_orphan_remnants; *prev != nullptr; prev = &(*prev)->next)
+  {
+    ssmem_remnant_t *r = *prev;
+    if ((r->cls >= 0 && r->cls != cls) || r->mem_curr + size > r->mem_size)
+    {
+      continue;
+    }
+    c->mem = r->mem;
+    c->mem_curr = r->mem_curr;
+    c->mem_size = r->mem_size;
+    c->mem_used = r->mem_used;
+    *prev = r->next;
+    ssmem_orphan_remnants_num--;
+    free(r);
+    return true;
+  }
+  return false;
+}
+
+/* 
+ * adds the end of chunk mem, from offset curr, to the remnants; the caller
+ * holds ssmem_orphan_lock
+ */
+void ssmem_orphan_remnant_add(void *mem, size_t curr, size_t size, size_t used, int cls)
+{
+  ssmem_remnant_t *r = (ssmem_remnant_t *)malloc(sizeof(ssmem_remnant_t));
+  assert(r != nullptr);
+  r->mem = mem;
+  r->mem_curr = curr;
+  r->mem_size = size;
+  r->mem_used = used;
+  r->cls = cls;
+  r->next = ssmem_orphan_remnants;
+  ssmem_orphan_remnants = r;
+  ssmem_orphan_remnants_num++;
+}
+
+/* 
+ * gives class c of allocator a a new chunk for its objects
+ */
+static void
+ssmem_class_chunk_new(ssmem_allocator_t *a, ssmem_class_t *c, size_t size, bool flush)
+{
+  if (__builtin_expect(ssmem_orphan_remnants_num.load(std::memory_order_relaxed) > 0, 0) &&
+      ssmem_orphan_remnant_adopt(c, size))
+  {
+    return;
+  }
+  /* every chunk of the class is twice as large as the one before */
+  size_t mem_size = c->mem == nullptr ? SSMEM_MEM_SIZE_MIN : c->mem_size << 1;
+  size_t max_size = SSMEM_MEM_SIZE_DOUBLE == 1 ? SSMEM_MEM_SIZE_MAX : a->mem_size;
+  if (mem_size > max_size)
+  {
+    mem_size = max_size;
+  }
+  while (mem_size < size)
+  {
+    mem_size <<= 1;
+  }
+  /* printf("[ALLOC] out of mem, need to allocate (chunk = %llu MB)\n", */
+  /*   mem_size / (1LL<<20)); */
+  /* the page policy may round the chunk up to a huge page */
+  mem_size = ssmem_chunk_size(mem_size);
+  size_t mapped;
+  c->mem = ssmem_chunk_alloc(mem_size, &mapped);
+  assert(c->mem != nullptr);
+  if (!ssmem_pool_contains(c->mem))
+  {
+    if (numa::num_nodes() > 1)
+    {
+      numa::prefer_node(c->mem, mem_size, a->ts->node);
+    }
+    if (ssmem_numa_route)
+    {
+      numa::record_region_nodes(c->mem, mem_size, a->ts->node);
+    }
+  }
+#if SSMEM_ZERO_MEMORY == 1
+  memset(c->mem, 0, mem_size);
+#endif
+
+  c->mem_curr = 0;
+  c->mem_size = mem_size;
+  c->mem_used = ssmem_pool_contains(c->mem) ? 0 : SIZE_MAX;
+
+  a->tot_size += mem_size;
+
+  a->mem_chunks = ssmem_list_node_new(c->mem, a->mem_chunks, flush, mapped, mem_size);
+  if(flush) {
+    FLUSH(&a->mem_chunks);
+    FENCE();        
+  }
+}
+
+/* 
+ * Reusable memory without an owner, kept as sets per size class: found free
+ * by a recovery pass, or left by threads that exited. An allocator that has no
+ * collected memory left in a class adopts one of these sets before it carves
+ * new objects out of its chunk. Pushes are lock-free; pops of a class are
+ * serialized, so a set cannot be popped and pushed again under a pop (ABA).
+ */
+std::atomic<ssmem_free_set_t *> ssmem_recovered[SSMEM_NUM_CLASSES];
+std::atomic_flag ssmem_recovered_pop_lock[SSMEM_NUM_CLASSES] = {};
+std::atomic<size_t> ssmem_recovered_num(0);
+
+void ssmem_recovered_push_class(int c, ssmem_free_set_t *fs)
+{
+  ssmem_free_set_t *top = ssmem_recovered[c].load();
+  do
+  {
+    fs->set_next = top;
+  } while (!ssmem_recovered[c].compare_exchange_weak(top, fs));
+  ssmem_recovered_num++;
+}
+
+void ssmem_recovered_push(size_t obj_size, ssmem_free_set_t *fs)
+{
+  int c = ssmem_size_class(obj_size);
+  if (obj_size > SSMEM_MAX_CLASS_SIZE || ssmem_class_size(c) != obj_size)
+  {
+    /* not carved out by size class: the memory stays unused */
+    free(fs);
+    return;
+  }
+  ssmem_recovered_push_class(c, fs);
+}
+
+ssmem_free_set_t *
+ssmem_recovered_pop(int c)
+{
+  if (ssmem_recovered_pop_lock[c].test_and_set(std::memory_order_acquire))
+  {
+    /* another thread adopts a set of this class */
+    return nullptr;
+  }
+  ssmem_free_set_t *top = ssmem_recovered[c].load();
+  while (top != nullptr && !ssmem_recovered[c].compare_exchange_weak(top, top->set_next))
+    ;
+  ssmem_recovered_pop_lock[c].clear(std::memory_order_release);
+  if (top != nullptr)
+  {
+    ssmem_recovered_num--;
+  }
+  return top;
+}
+
+/* 
+ * adopts all the sets routed to the inbox of the node of a for class cls
+ */
+static void
+ssmem_numa_inbox_adopt(ssmem_allocator_t *a, ssmem_class_t *c, int cls)
+{
+  std::atomic<ssmem_free_set_t *> &inbox = ssmem_numa_inbox[a->ts->node][cls];
+  if (inbox.load(std::memory_order_relaxed) == nullptr)
+  {
+    return;
+  }
+  /* taking the whole stack has no ABA */
+  ssmem_free_set_t *fs = inbox.exchange(nullptr);
+  if (fs == nullptr)
+  {
+    return;
+  }
+  ssmem_free_set_t *last = fs;
+  c->collected_set_num++;
+  while (last->set_next != nullptr)
+  {
+    last = last->set_next;
+    c->collected_set_num++;
+  }
+  last->set_next = c->collected_set_list;
+  c->collected_set_list = fs;
+}
+
+static void ssmem_orphans_reclaim();
+
 /* 
  * 
  */
-void *
-ssmem_alloc(ssmem_allocator_t *a, size_t size, bool flush = true)
+inline void *
+ssmem_alloc_class(ssmem_allocator_t *a, int cls, bool flush = true)
 {
   void *m = nullptr;
+  ssmem_class_t *c = &a->classes[cls];
+
+  if (__builtin_expect(c->collected_set_list == nullptr && ssmem_numa_route, 0))
+  {
+    ssmem_numa_inbox_adopt(a, c, cls);
+  }
+  if (__builtin_expect(c->collected_set_list == nullptr && ssmem_orphan_pending_num.load(std::memory_order_relaxed) > 0, 0))
+  {
+    ssmem_orphans_reclaim();
+  }
+
+  if (__builtin_expect(c->collected_set_list == nullptr && ssmem_recovered_num.load(std::memory_order_relaxed) > 0, 0))
+  {
+    ssmem_free_set_t *rs = ssmem_recovered_pop(cls);
+    if (rs != nullptr)
+    {
+      rs->set_next = nullptr;
+      c->collected_set_list = rs;
+      c->collected_set_num++;
+    }
+  }
 
   /* 1st try to use from the collected memory */
-  ssmem_free_set_t *cs = a->collected_set_list;
+  ssmem_free_set_t *cs = c->collected_set_list;
   if (cs != nullptr)
   {
     m = (void *)cs->set[--cs->curr];
@@ -608,64 +1172,26 @@ ssmem_alloc(ssmem_allocator_t *a, size_t size, bool flush = true)
 
     if (cs->curr <= 0)
     {
-      a->collected_set_list = cs->set_next;
-      a->collected_set_num--;
+      c->collected_set_list = cs->set_next;
+      c->collected_set_num--;
 
       ssmem_free_set_make_avail(a, cs);
     }
   }
   else
   {
-    if ((a->mem_curr + size) >= a->mem_size)
+    size_t size = ssmem_class_size(cls);
+    if (__builtin_expect((c->mem_curr + size) > c->mem_size, 0))
     {
-#if SSMEM_MEM_SIZE_DOUBLE == 1
-      a->mem_size <<= 1;
-      if (a->mem_size > SSMEM_MEM_SIZE_MAX)
-      {
-        a->mem_size = SSMEM_MEM_SIZE_MAX;
-      }
-#endif
-      /* printf("[ALLOC] out of mem, need to allocate (chunk = %llu MB)\n", */
-      /*   a->mem_size / (1LL<<20)); */
-      if (size > a->mem_size)
-      {
-        /* printf("[ALLOC] asking for large mem. chunk\n"); */
-        while (a->mem_size < size)
-        {
-          if (a->mem_size > SSMEM_MEM_SIZE_MAX)
-          {
-            fprintf(stderr, "[ALLOC] asking for memory chunk larger than max (%llu MB) \n",
-                SSMEM_MEM_SIZE_MAX / (1024 * 1024LL));
-            assert(a->mem_size <= SSMEM_MEM_SIZE_MAX);
-          }
-          a->mem_size <<= 1;
-        }
-        /* printf("[ALLOC] new mem size chunk is %llu MB\n", a->mem_size / (1024 * 1024LL)); */
-      }
-#if SSMEM_TRANSPARENT_HUGE_PAGES == 1
-      int ret = posix_memalign(&a->mem, CACHE_LINE_SIZE, a->mem_size);
-      assert(ret == 0);
-#else
-      a->mem = (void *)aligned_alloc(CACHE_LINE_SIZE, a->mem_size);
-#endif
-      assert(a->mem != nullptr);
-#if SSMEM_ZERO_MEMORY == 1
-      memset(a->mem, 0, a->mem_size);
-#endif
-
-      a->mem_curr = 0;
-
-      a->tot_size += a->mem_size;
-
-      a->mem_chunks = ssmem_list_node_new(a->mem, a->mem_chunks, flush);
-      if(flush) {
-        FLUSH(&a->mem_chunks);
-        FENCE();        
-      }
+      ssmem_class_chunk_new(a, c, size, flush);
     }
 
-    m = (void *)((char *)(a->mem) + a->mem_curr);
-    a->mem_curr += size;
+    m = (void *)((char *)(c->mem) + c->mem_curr);
+    c->mem_curr += size;
+    if (__builtin_expect(c->mem_curr > c->mem_used, 0))
+    {
+      ssmem_chunk_track(c, size);
+    }
   }
 
 #if SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_ALLOC || SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_BOTH
@@ -674,14 +1200,29 @@ ssmem_alloc(ssmem_allocator_t *a, size_t size, bool flush = true)
   return m;
 }
 
-/* return > 0 iff snew is > sold for each entry */
+/* 
+ * 
+ */
+inline void *
+ssmem_alloc(ssmem_allocator_t *a, size_t size, bool flush = true)
+{
+  assert(size <= SSMEM_MAX_CLASS_SIZE);
+  return ssmem_alloc_class(a, ssmem_size_class(size), flush);
+}
+
+/* return > 0 iff snew is > sold for each entry. Ids without a thread at either
+   point held no references in between */
 static int
 ssmem_ts_compare(size_t *s_new, size_t *s_old)
 {
   int is_newer = 1;
-  for (unsigned int i = 0; i < ssmem_ts_list_len; i++)
+  for (unsigned int i = 0; i < ssmem_ts_table_len; i++)
   {
     // std::cout << i << " " << ssmem_ts_list_len << std::endl;
+    if (ssmem_ts_table[i] == nullptr || s_new[i] == SSMEM_TS_INACTIVE || s_old[i] == SSMEM_TS_INACTIVE)
+    {
+      continue;
+    }
     if (s_new[i] <= s_old[i])
     {
       is_newer = 0;
@@ -712,7 +1253,7 @@ static void ssmem_ts_set_print_no_newline(size_t *set);
 /* 
  *
  */
-int ssmem_mem_reclaim(ssmem_allocator_t *a)
+static void ssmem_released_reclaim(ssmem_allocator_t *a)
 {
   if (__builtin_expect(a->released_num > 0, 0))
   {
@@ -733,46 +1274,261 @@ int ssmem_mem_reclaim(ssmem_allocator_t *a)
       } while (rel_nxt != nullptr);
     }
   }
+}
 
-  ssmem_free_set_t *fs_cur = a->free_set_list;
-  if (fs_cur->ts_set == nullptr)
+/* 
+ * records when the full free set fs stopped taking objects
+ */
+static inline void
+ssmem_free_set_seal(ssmem_free_set_t *fs)
+{
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+  fs->epoch = ssmem_epoch.load();
+#else
+  fs->ts_set = ssmem_ts_set_collect(fs->ts_set);
+#endif
+}
+
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+/* 
+ * detaches the free sets of list (of num sets) that no thread can still
+ * access: the list is ordered by the epochs the sets were sealed in, so these
+ * form a suffix of the sets sealed at least two epochs ago
+ */
+static ssmem_free_set_t *
+ssmem_free_sets_detach_safe(ssmem_free_set_t **list, size_t *num)
+{
+  size_t e = ssmem_epoch.load();
+  ssmem_free_set_t *pred = nullptr;
+  ssmem_free_set_t *fs = *list;
+  size_t kept = 0;
+  while (fs != nullptr && fs->epoch + 2 > e)
   {
-    return 0;
+    pred = fs;
+    fs = fs->set_next;
+    kept++;
   }
-  ssmem_free_set_t *fs_nxt = fs_cur->set_next;
-  int gced_num = 0;
-
-  if (fs_nxt == nullptr || fs_nxt->ts_set == nullptr) /* need at least 2 sets to compare */
+  if (fs == nullptr)
   {
-    return 0;
+    return nullptr;
+  }
+  if (pred == nullptr)
+  {
+    *list = nullptr;
+  }
+  else
+  {
+    pred->set_next = nullptr;
   }
+  *num = kept;
+  return fs;
+}
+#else
+/* 
+ * detaches the free sets of list (of num sets) that no thread can still
+ * access: once every thread advanced between the two newest sets, all sets
+ * but the newest
+ */
+static ssmem_free_set_t *
+ssmem_free_sets_detach_safe(ssmem_free_set_t **list, size_t *num)
+{
+  ssmem_free_set_t *fs_cur = *list;
+  if (fs_cur->ts_set == nullptr)
+  {
+    return nullptr;
+  }
+  ssmem_free_set_t *fs_nxt = fs_cur->set_next;
+
+  if (fs_nxt == nullptr || fs_nxt->ts_set == nullptr) /* need at least 2 sets to compare */
+  {
+    return nullptr;
+  }
+
+  if (!ssmem_ts_compare(fs_cur->ts_set, fs_nxt->ts_set))
+  {
+    return nullptr;
+  }
+  /* take the the suffix of the list (all collected free_sets) away from the
+ free_set list of c and set the correct num of free_sets*/
+  fs_cur->set_next = nullptr;
+  *num = 1;
+  return fs_nxt;
+}
+#endif
+
+/* 
+ * accounts objects freed by the thread of ts that are not reusable yet
+ */
+static inline void
+ssmem_garbage_add(ssmem_ts_t *ts, long objs, long bytes)
+{
+  __atomic_store_n(&ts->garbage_objs, ts->garbage_objs + objs, __ATOMIC_RELAXED);
+  __atomic_store_n(&ts->garbage_bytes, ts->garbage_bytes + bytes, __ATOMIC_RELAXED);
+}
+
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_TIMESTAMPS
+__thread size_t *ssmem_now_ts_set = nullptr; /* the current timestamps, see below */
+#endif
+
+/* 
+ * makes the safe remote set fs available on its home node
+ */
+static void
+ssmem_numa_inbox_push(ssmem_free_set_t *fs)
+{
+  std::atomic<ssmem_free_set_t *> &inbox = ssmem_numa_inbox[fs->node][fs->cls];
+  ssmem_free_set_t *top = inbox.load();
+  do
+  {
+    fs->set_next = top;
+  } while (!inbox.compare_exchange_weak(top, fs));
+}
 
-  if (ssmem_ts_compare(fs_cur->ts_set, fs_nxt->ts_set))
+/* 
+ * pushes the remote sets of a that no thread can still access to the inboxes
+ * of their home nodes
+ */
+static void
+ssmem_remote_reclaim(ssmem_allocator_t *a)
+{
+  if (a->remote_pending_list == nullptr)
   {
-    gced_num = a->free_set_num - 1;
-    /* take the the suffix of the list (all collected free_sets) away from the
-   free_set list of a and set the correct num of free_sets*/
-    fs_cur->set_next = nullptr;
-    a->free_set_num = 1;
+    return;
+  }
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+  ssmem_free_set_t *fs = ssmem_free_sets_detach_safe(&a->remote_pending_list, &a->remote_pending_num);
+#else
+  /* the list stops growing when the thread stops freeing remote objects, so
+     the sets are compared with the current timestamps instead of a newer set */
+  ssmem_now_ts_set = ssmem_ts_set_collect(ssmem_now_ts_set);
+  ssmem_free_set_t *pred = nullptr;
+  ssmem_free_set_t *fs = a->remote_pending_list;
+  size_t kept = 0;
+  while (fs != nullptr && !ssmem_ts_compare(ssmem_now_ts_set, fs->ts_set))
+  {
+    pred = fs;
+    fs = fs->set_next;
+    kept++;
+  }
+  if (pred == nullptr)
+  {
+    a->remote_pending_list = nullptr;
+  }
+  else
+  {
+    pred->set_next = nullptr;
+  }
+  a->remote_pending_num = kept;
+#endif
+  while (fs != nullptr)
+  {
+    ssmem_free_set_t *nxt = fs->set_next;
+    ssmem_garbage_add(a->ts, -fs->curr, -fs->curr * (long)ssmem_class_size(fs->cls));
+    ssmem_numa_inbox_push(fs);
+    fs = nxt;
+  }
+}
 
-    /* find the tail for the collected_set list in order to append the new 
-   free_sets that were just collected */
-    ssmem_free_set_t *collected_set_cur = a->collected_set_list;
-    if (collected_set_cur != nullptr)
+/* 
+ * hands the free sets of threads that exited that no thread can still access
+ * to the allocators: remote sets to their home node, the others to the sets
+ * without an owner. The sets were sealed at different times, so each is
+ * checked on its own.
+ */
+static void
+ssmem_orphans_reclaim()
+{
+  if (ssmem_orphan_pending_num.load(std::memory_order_relaxed) == 0 || !ssmem_orphan_lock.try_lock())
+  {
+    return;
+  }
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+  size_t e = ssmem_epoch.load();
+#else
+  ssmem_now_ts_set = ssmem_ts_set_collect(ssmem_now_ts_set);
+#endif
+  ssmem_free_set_t *safe = nullptr;
+  ssmem_free_set_t **prev = &ssmem_orphan_pending_list;
+  while (*prev != nullptr)
+  {
+    ssmem_free_set_t *fs = *prev;
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+    bool is_safe = fs->epoch + 2 <= e;
+#else
+    bool is_safe = ssmem_ts_compare(ssmem_now_ts_set, fs->ts_set);
+#endif
+    if (!is_safe)
     {
-      while (collected_set_cur->set_next != nullptr)
-      {
-        collected_set_cur = collected_set_cur->set_next;
-      }
+      prev = &fs->set_next;
+      continue;
+    }
+    *prev = fs->set_next;
+    fs->set_next = safe;
+    safe = fs;
+    ssmem_orphan_pending_num--;
+  }
+  ssmem_orphan_lock.unlock();
 
-      collected_set_cur->set_next = fs_nxt;
+  while (safe != nullptr)
+  {
+    ssmem_free_set_t *nxt = safe->set_next;
+    ssmem_orphan_garbage_objs -= safe->curr;
+    ssmem_orphan_garbage_bytes -= safe->curr * ssmem_class_size(safe->cls);
+    if (safe->node >= 0)
+    {
+      ssmem_numa_inbox_push(safe);
     }
     else
     {
-      a->collected_set_list = fs_nxt;
+      ssmem_recovered_push_class(safe->cls, safe);
     }
-    a->collected_set_num += gced_num;
+    safe = nxt;
   }
+}
+
+/* 
+ * moves the free sets of class cls that no thread can still access to its
+ * collected sets
+ */
+int ssmem_mem_reclaim(ssmem_allocator_t *a, int cls)
+{
+  ssmem_released_reclaim(a);
+  ssmem_remote_reclaim(a);
+  ssmem_orphans_reclaim();
+
+  ssmem_class_t *c = &a->classes[cls];
+  size_t free_set_num = c->free_set_num;
+  ssmem_free_set_t *fs_nxt = ssmem_free_sets_detach_safe(&c->free_set_list, &c->free_set_num);
+  if (fs_nxt == nullptr)
+  {
+    return 0;
+  }
+  int gced_num = free_set_num - c->free_set_num;
+
+  long objs = 0;
+  for (ssmem_free_set_t *fs = fs_nxt; fs != nullptr; fs = fs->set_next)
+  {
+    objs += fs->curr;
+  }
+  ssmem_garbage_add(a->ts, -objs, -objs * (long)ssmem_class_size(cls));
+
+  /* find the tail for the collected_set list in order to append the new 
+ free_sets that were just collected */
+  ssmem_free_set_t *collected_set_cur = c->collected_set_list;
+  if (collected_set_cur != nullptr)
+  {
+    while (collected_set_cur->set_next != nullptr)
+    {
+      collected_set_cur = collected_set_cur->set_next;
+    }
+
+    collected_set_cur->set_next = fs_nxt;
+  }
+  else
+  {
+    c->collected_set_list = fs_nxt;
+  }
+  c->collected_set_num += gced_num;
 
   /* if (gced_num) */
   /*   { */
@@ -781,30 +1537,255 @@ int ssmem_mem_reclaim(ssmem_allocator_t *a)
   return gced_num;
 }
 
+/* 
+ * adds obj, whose memory is on node home, to the remote set of a for home
+ * and class cls
+ */
+static void
+ssmem_free_remote(ssmem_allocator_t *a, void *obj, int cls, int home)
+{
+  if (a->remote_sets == nullptr)
+  {
+    a->remote_sets = (ssmem_free_set_t **)calloc(numa::MAX_NODES * SSMEM_NUM_CLASSES, sizeof(ssmem_free_set_t *));
+    assert(a->remote_sets != nullptr);
+  }
+  ssmem_free_set_t *&fs = a->remote_sets[home * SSMEM_NUM_CLASSES + cls];
+  if (fs == nullptr)
+  {
+    fs = ssmem_free_set_get_avail(a, a->fs_size, nullptr);
+    fs->node = home;
+    fs->cls = cls;
+  }
+
+  fs->set[fs->curr++] = (uintptr_t)obj;
+  ssmem_garbage_add(a->ts, 1, ssmem_class_size(cls));
+  __atomic_store_n(&a->ts->routed_objs, a->ts->routed_objs + 1, __ATOMIC_RELAXED);
+  if (fs->curr == (long)fs->size)
+  {
+    ssmem_free_set_seal(fs);
+    fs->set_next = a->remote_pending_list;
+    a->remote_pending_list = fs;
+    a->remote_pending_num++;
+    fs = nullptr;
+    ssmem_remote_reclaim(a);
+  }
+}
+
+/* 
+ * seals the partly filled remote sets of the allocators of the calling thread
+ * and pushes the pending ones that are safe to their home nodes
+ */
+static void
+ssmem_remote_flush()
+{
+  for (ssmem_list_t *l = ssmem_allocator_list; l != nullptr; l = l->next)
+  {
+    ssmem_allocator_t *a = (ssmem_allocator_t *)l->obj;
+    if (a->remote_sets == nullptr)
+    {
+      continue;
+    }
+    for (int i = 0; i < numa::MAX_NODES * SSMEM_NUM_CLASSES; i++)
+    {
+      ssmem_free_set_t *fs = a->remote_sets[i];
+      if (fs == nullptr)
+      {
+        continue;
+      }
+      ssmem_free_set_seal(fs);
+      fs->set_next = a->remote_pending_list;
+      a->remote_pending_list = fs;
+      a->remote_pending_num++;
+      a->remote_sets[i] = nullptr;
+    }
+    ssmem_remote_reclaim(a);
+  }
+}
+
 /* 
  *
  */
-void ssmem_free(ssmem_allocator_t *a, void *obj, bool flush = true)
+static inline void
+ssmem_free_local(ssmem_allocator_t *a, void *obj, int cls)
 {
-  ssmem_free_set_t *fs = a->free_set_list;
-  if (fs->curr == (long) fs->size)
+  ssmem_class_t *c = &a->classes[cls];
+  ssmem_free_set_t *fs = c->free_set_list;
+  if (__builtin_expect(fs == nullptr || fs->curr == (long) fs->size, 0))
   {
-    fs->ts_set = ssmem_ts_set_collect(fs->ts_set);
-    ssmem_mem_reclaim(a);
+    if (fs != nullptr)
+    {
+      ssmem_free_set_seal(fs);
+      ssmem_mem_reclaim(a, cls);
+    }
 
     /* printf("[ALLOC] free_set is full, doing GC / size of garbage pointers: %10zu = %zu KB\n", garbagep, garbagep / 1024); */
-    ssmem_free_set_t *fs_new = ssmem_free_set_get_avail(a, a->fs_size, a->free_set_list);
-    a->free_set_list = fs_new;
-    a->free_set_num++;
+    ssmem_free_set_t *fs_new = ssmem_free_set_get_avail(a, a->fs_size, c->free_set_list);
+    c->free_set_list = fs_new;
+    c->free_set_num++;
     fs = fs_new;
   }
 
   fs->set[fs->curr++] = (uintptr_t)obj;
+  ssmem_garbage_add(a->ts, 1, ssmem_class_size(cls));
+}
+
+/* 
+ * frees obj into the free sets of a, or, if it lives on another node than
+ * the chunks of a, into a remote set for its home node
+ */
+inline void ssmem_free_class(ssmem_allocator_t *a, void *obj, int cls, bool flush = true)
+{
+  int home = ssmem_numa_route ? numa::recorded_region_node(obj) : -1;
+  if (__builtin_expect(home >= 0 && home != (int)a->ts->node, 0))
+  {
+    ssmem_free_remote(a, obj, cls, home);
+  }
+  else
+  {
+    ssmem_free_local(a, obj, cls);
+  }
 #if SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_FREE || SSMEM_TS_INCR_ON == SSMEM_TS_INCR_ON_BOTH
   ssmem_ts_next();
 #endif
 }
 
+/* 
+ *
+ */
+inline void ssmem_free(ssmem_allocator_t *a, void *obj, size_t size, bool flush = true)
+{
+  ssmem_free_class(a, obj, ssmem_size_class(size), flush);
+}
+
+/* 
+ * seals fs now (later than when it filled up, which is safe) and adds it to
+ * the free sets of threads that exited; called with ssmem_orphan_lock held
+ */
+static void
+ssmem_orphan_pending_add(ssmem_ts_t *ts, ssmem_free_set_t *fs)
+{
+  if (fs->curr == 0)
+  {
+    ssmem_free_set_free(fs);
+    return;
+  }
+  ssmem_free_set_seal(fs);
+  ssmem_garbage_add(ts, -fs->curr, -fs->curr * (long)ssmem_class_size(fs->cls));
+  ssmem_orphan_garbage_objs += fs->curr;
+  ssmem_orphan_garbage_bytes += fs->curr * ssmem_class_size(fs->cls);
+  fs->set_next = ssmem_orphan_pending_list;
+  ssmem_orphan_pending_list = fs;
+  ssmem_orphan_pending_num++;
+}
+
+/* 
+ * hands the memory of allocator a over to the other threads; after the last
+ * allocator of the thread, the thread unsubscribes and gives its id back
+ */
+void ssmem_alloc_orphan(ssmem_allocator_t *a)
+{
+  std::unique_lock<std::mutex> lock(ssmem_orphan_lock);
+  for (int cls = 0; cls < SSMEM_NUM_CLASSES; cls++)
+  {
+    ssmem_class_t *c = &a->classes[cls];
+    ssmem_free_set_t *fs = c->free_set_list;
+    while (fs != nullptr)
+    {
+      ssmem_free_set_t *nxt = fs->set_next;
+      fs->node = -1;
+      fs->cls = cls;
+      ssmem_orphan_pending_add(a->ts, fs);
+      fs = nxt;
+    }
+    fs = c->collected_set_list;
+    while (fs != nullptr)
+    {
+      ssmem_free_set_t *nxt = fs->set_next;
+      ssmem_recovered_push_class(cls, fs);
+      fs = nxt;
+    }
+    if (c->mem != nullptr && c->mem_curr + ssmem_class_size(cls) <= c->mem_size)
+    {
+      ssmem_orphan_remnant_add(c->mem, c->mem_curr, c->mem_size, c->mem_used, cls);
+    }
+  }
+
+  if (a->remote_sets != nullptr)
+  {
+    for (int i = 0; i < numa::MAX_NODES * SSMEM_NUM_CLASSES; i++)
+    {
+      if (a->remote_sets[i] != nullptr)
+      {
+        ssmem_orphan_pending_add(a->ts, a->remote_sets[i]);
+      }
+    }
+    free(a->remote_sets);
+  }
+  ssmem_free_set_t *fs = a->remote_pending_list;
+  while (fs != nullptr)
+  {
+    ssmem_free_set_t *nxt = fs->set_next;
+    ssmem_orphan_pending_add(a->ts, fs);
+    fs = nxt;
+  }
+
+  fs = a->available_set_list;
+  while (fs != nullptr)
+  {
+    ssmem_free_set_t *nxt = fs->set_next;
+    ssmem_free_set_free(fs);
+    fs = nxt;
+  }
+
+  /* the objects may still be in use, the chunks are freed by ssmem_term() */
+  ssmem_list_t *mc = a->mem_chunks;
+  while (mc != nullptr)
+  {
+    ssmem_list_t *nxt = mc->next;
+    mc->next = ssmem_orphan_chunks;
+    ssmem_orphan_chunks = mc;
+    mc = nxt;
+  }
+  ssmem_released_t *rel = a->released_mem_list;
+  while (rel != nullptr)
+  {
+    ssmem_released_t *nxt = rel->next;
+    rel->next = ssmem_orphan_released_list;
+    ssmem_orphan_released_list = rel;
+    rel = nxt;
+  }
+  lock.unlock();
+
+  ssmem_list_t *prv = nullptr;
+  ssmem_list_t *cur = ssmem_allocator_list;
+  while (cur != nullptr && (uintptr_t)cur->obj != (uintptr_t)a)
+  {
+    prv = cur;
+    cur = cur->next;
+  }
+  assert(cur != nullptr);
+  if (prv == nullptr)
+  {
+    ssmem_allocator_list = cur->next;
+  }
+  else
+  {
+    prv->next = cur->next;
+  }
+  free(cur);
+
+  if (--ssmem_num_allocators == 0)
+  {
+    /* the timestamp stays in the list for the next thread with this id */
+    ssmem_ts_t *ts = a->ts;
+    __atomic_store_n(&ts->epoch, SSMEM_EPOCH_OFFLINE, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ts->version, ts->version + 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ts->active, 0, __ATOMIC_SEQ_CST);
+    ssmem_ts_local = nullptr;
+    ssmem_id_release(ts->id);
+  }
+}
+
 /* 
  *
  */
@@ -818,7 +1799,7 @@ ssmem_release(ssmem_allocator_t *a, void *obj)
   a->released_mem_list = rel;
   if (rn >= SSMEM_GC_RLSE_SET_SIZE)
   {
-    ssmem_mem_reclaim(a);
+    ssmem_released_reclaim(a);
   }
 }
 
@@ -848,18 +1829,26 @@ ssmem_ts_set_print_no_newline(size_t *set)
  */
 void ssmem_free_list_print(ssmem_allocator_t *a)
 {
-  printf("[ALLOC] free_set list (%zu sets): \n", a->free_set_num);
-
-  int n = 0;
-  ssmem_free_set_t *cur = a->free_set_list;
-  while (cur != nullptr)
+  for (int c = 0; c < SSMEM_NUM_CLASSES; c++)
   {
-    printf("(%-3d | %p::", n++, cur);
-    ssmem_ts_set_print_no_newline(cur->ts_set);
-    printf(") -> \n");
-    cur = cur->set_next;
+    if (a->classes[c].free_set_list == nullptr)
+    {
+      continue;
+    }
+    printf("[ALLOC] free_set list of %zu byte objects (%zu sets): \n",
+           ssmem_class_size(c), a->classes[c].free_set_num);
+
+    int n = 0;
+    ssmem_free_set_t *cur = a->classes[c].free_set_list;
+    while (cur != nullptr)
+    {
+      printf("(%-3d | %p::", n++, cur);
+      ssmem_ts_set_print_no_newline(cur->ts_set);
+      printf(") -> \n");
+      cur = cur->set_next;
+    }
+    printf("nullptr\n");
   }
-  printf("nullptr\n");
 }
 
 /* 
@@ -867,18 +1856,26 @@ void ssmem_free_list_print(ssmem_allocator_t *a)
  */
 void ssmem_collected_list_print(ssmem_allocator_t *a)
 {
-  printf("[ALLOC] collected_set list (%zu sets): \n", a->collected_set_num);
-
-  int n = 0;
-  ssmem_free_set_t *cur = a->collected_set_list;
-  while (cur != nullptr)
+  for (int c = 0; c < SSMEM_NUM_CLASSES; c++)
   {
-    printf("(%-3d | %p::", n++, cur);
-    ssmem_ts_set_print_no_newline(cur->ts_set);
-    printf(") -> \n");
-    cur = cur->set_next;
+    if (a->classes[c].collected_set_list == nullptr)
+    {
+      continue;
+    }
+    printf("[ALLOC] collected_set list of %zu byte objects (%zu sets): \n",
+           ssmem_class_size(c), a->classes[c].collected_set_num);
+
+    int n = 0;
+    ssmem_free_set_t *cur = a->classes[c].collected_set_list;
+    while (cur != nullptr)
+    {
+      printf("(%-3d | %p::", n++, cur);
+      ssmem_ts_set_print_no_newline(cur->ts_set);
+      printf(") -> \n");
+      cur = cur->set_next;
+    }
+    printf("nullptr\n");
   }
-  printf("nullptr\n");
 }
 
 /* 
@@ -905,8 +1902,114 @@ void ssmem_available_list_print(ssmem_allocator_t *a)
  */
 void ssmem_all_list_print(ssmem_allocator_t *a, int id)
 {
+  size_t free_set_num = 0, collected_set_num = 0;
+  for (int c = 0; c < SSMEM_NUM_CLASSES; c++)
+  {
+    free_set_num += a->classes[c].free_set_num;
+    collected_set_num += a->classes[c].collected_set_num;
+  }
   printf("[ALLOC] [%-2d] free_set list: %-4zu / collected_set list: %-4zu\n",
-       id, a->free_set_num, a->collected_set_num);
+       id, free_set_num, collected_set_num);
+}
+
+/* 
+ *
+ */
+size_t ssmem_garbage_bytes(int id = -1)
+{
+  size_t bytes = 0;
+  for (uint32_t i = 0; i < ssmem_ts_table_len; i++)
+  {
+    ssmem_ts_t *t = ssmem_ts_table[i];
+    if (t != nullptr && (id < 0 || (uint32_t)id == i))
+    {
+      bytes += __atomic_load_n(&t->garbage_bytes, __ATOMIC_RELAXED);
+    }
+  }
+  if (id < 0)
+  {
+    bytes += ssmem_orphan_garbage_bytes.load();
+  }
+  return bytes;
+}
+
+/* 
+ *
+ */
+size_t ssmem_routed_objs(int id = -1)
+{
+  size_t objs = 0;
+  for (uint32_t i = 0; i < ssmem_ts_table_len; i++)
+  {
+    ssmem_ts_t *t = ssmem_ts_table[i];
+    if (t != nullptr && (id < 0 || (uint32_t)id == i))
+    {
+      objs += __atomic_load_n(&t->routed_objs, __ATOMIC_RELAXED);
+    }
+  }
+  return objs;
+}
+
+/* 
+ *
+ */
+void ssmem_thread_set_node(int node)
+{
+  assert(node >= 0 && node < numa::MAX_NODES);
+  if (ssmem_ts_local != nullptr)
+  {
+    ssmem_ts_local->node = node;
+  }
+}
+
+/* 
+ *
+ */
+void ssmem_garbage_print()
+{
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+  size_t e = ssmem_epoch.load();
+  printf("[ALLOC] garbage per thread (epoch %zu):\n", e);
+#else
+  printf("[ALLOC] garbage per thread:\n");
+#endif
+  for (uint32_t i = 0; i < ssmem_ts_table_len; i++)
+  {
+    ssmem_ts_t *t = ssmem_ts_table[i];
+    if (t == nullptr)
+    {
+      continue;
+    }
+    printf("[ALLOC]   thread %-3u: %10zu objects, %10.2f MB",
+           i, __atomic_load_n(&t->garbage_objs, __ATOMIC_RELAXED),
+           __atomic_load_n(&t->garbage_bytes, __ATOMIC_RELAXED) / (1024.0 * 1024));
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+    size_t te = __atomic_load_n(&t->epoch, __ATOMIC_RELAXED);
+    if (te == SSMEM_EPOCH_OFFLINE)
+    {
+      printf(", offline");
+    }
+    else
+    {
+      printf(", %zu epochs behind", e - te);
+    }
+#endif
+    if (ssmem_numa_route)
+    {
+      printf(", node %zu, %zu objects routed home", t->node,
+             __atomic_load_n(&t->routed_objs, __ATOMIC_RELAXED));
+    }
+    if (!__atomic_load_n(&t->active, __ATOMIC_RELAXED))
+    {
+      printf(", exited");
+    }
+    printf("\n");
+  }
+  if (ssmem_orphan_pending_num.load() > 0)
+  {
+    printf("[ALLOC]   exited    : %10zu objects, %10.2f MB\n", ssmem_orphan_garbage_objs.load(),
+           ssmem_orphan_garbage_bytes.load() / (1024.0 * 1024));
+  }
 }
 
 /* 
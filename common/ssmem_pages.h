@@ -0,0 +1,224 @@
+/*
+ * Page backing of the memory chunks of the ssmem allocators, and the chunk
+ * allocation itself: chunks come from the persistent pool (ssmem_pool.h)
+ * while one is open, and from the heap under the page policy otherwise.
+ */
+#ifndef _SSMEM_PAGES_H_
+#define _SSMEM_PAGES_H_
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ssmem_pool.h"
+#include <persist/numa_utils.hpp>
+
+/*
+ * Page backing of the heap chunks (the pool is a file mapping and keeps its
+ * own pages). The chunks (up to 32MB) are carved into small objects that are
+ * spread over the whole chunk, so with 4KB pages a traversal of a large
+ * structure misses the dTLB on most nodes.
+ *
+ *   default  aligned_alloc(), whatever the malloc and the system THP mode give
+ *   thp      2MB aligned anonymous mapping with madvise(MADV_HUGEPAGE)
+ *   nothp    anonymous mapping with madvise(MADV_NOHUGEPAGE)
+ *   2mb/1gb  explicit hugetlbfs pages (MAP_HUGETLB), which must be reserved
+ *            in /proc/sys/vm/nr_hugepages or the per size sysfs files
+ *
+ * Explicit huge pages round every chunk up to the page size, and the whole
+ * mapping becomes the chunk, so with 1gb each size class of each thread takes
+ * a 1GB page. If no huge page can be mapped the chunk falls back to 4KB pages
+ * and ssmem_page_fallbacks counts it. With prefault, every page of a new
+ * chunk is touched when it is allocated instead of on first use.
+ * The policy applies to chunks allocated after it was set.
+ */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define SSMEM_BASE_PAGE_SIZE  4096UL
+#define SSMEM_HUGE_PAGE_SIZE  (2 * 1024 * 1024UL)
+#define SSMEM_GIANT_PAGE_SIZE (1024 * 1024 * 1024UL)
+
+typedef enum ssmem_page_policy
+{
+  SSMEM_PAGES_DEFAULT,
+  SSMEM_PAGES_THP,
+  SSMEM_PAGES_NO_THP,
+  SSMEM_PAGES_HUGETLB_2MB,
+  SSMEM_PAGES_HUGETLB_1GB
+} ssmem_page_policy_t;
+
+const char *ssmem_page_policy_names[] = {"default", "thp", "nothp", "2mb", "1gb"};
+
+ssmem_page_policy_t ssmem_page_policy = SSMEM_PAGES_DEFAULT;
+bool ssmem_page_prefault = false;
+std::atomic<long> ssmem_page_fallbacks(0);
+
+/* Returns false if name is not one of ssmem_page_policy_names */
+bool ssmem_set_page_policy(const char *name, bool prefault)
+{
+  for (int i = 0; i <= SSMEM_PAGES_HUGETLB_1GB; i++)
+  {
+    if (strcmp(name, ssmem_page_policy_names[i]) == 0)
+    {
+      ssmem_page_policy = (ssmem_page_policy_t)i;
+      ssmem_page_prefault = prefault;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *ssmem_get_page_policy()
+{
+  return ssmem_page_policy_names[ssmem_page_policy];
+}
+
+/* Size of the chunk that backs at least size bytes under the current policy */
+size_t ssmem_chunk_size(size_t size)
+{
+  if (ssmem_pool_is_open())
+  {
+    return size;
+  }
+  switch (ssmem_page_policy)
+  {
+  case SSMEM_PAGES_HUGETLB_1GB:
+    return ssmem_pool_round_up(size, SSMEM_GIANT_PAGE_SIZE);
+  case SSMEM_PAGES_DEFAULT:
+    return size;
+  default:
+    return ssmem_pool_round_up(size, SSMEM_HUGE_PAGE_SIZE);
+  }
+}
+
+/* Anonymous mapping of size bytes at an align boundary */
+static void *
+ssmem_chunk_map_aligned(size_t size, size_t align)
+{
+  char *p = (char *)mmap(nullptr, size + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+  {
+    return nullptr;
+  }
+  char *mem = (char *)ssmem_pool_round_up((uintptr_t)p, align);
+  if (mem > p)
+  {
+    munmap(p, mem - p);
+  }
+  munmap(mem + size, p + align - mem);
+  return mem;
+}
+
+static void *
+ssmem_chunk_map(size_t size)
+{
+  void *mem = nullptr;
+  int huge = 0;
+  switch (ssmem_page_policy)
+  {
+  case SSMEM_PAGES_HUGETLB_2MB:
+    huge = MAP_HUGE_2MB;
+    break;
+  case SSMEM_PAGES_HUGETLB_1GB:
+    huge = MAP_HUGE_1GB;
+    break;
+  default:
+    break;
+  }
+  if (huge != 0)
+  {
+    mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge, -1, 0);
+    if (mem != MAP_FAILED)
+    {
+      return mem;
+    }
+    if (ssmem_page_fallbacks++ == 0)
+    {
+      fprintf(stderr, "[SSMEM] no %s huge pages available, using 4KB pages\n", ssmem_get_page_policy());
+    }
+  }
+  mem = ssmem_chunk_map_aligned(size, SSMEM_HUGE_PAGE_SIZE);
+  if (mem == nullptr)
+  {
+    return nullptr;
+  }
+  if (ssmem_page_policy == SSMEM_PAGES_NO_THP)
+  {
+    madvise(mem, size, MADV_NOHUGEPAGE);
+  }
+  else if (ssmem_page_policy == SSMEM_PAGES_THP && madvise(mem, size, MADV_HUGEPAGE) != 0)
+  {
+    if (ssmem_page_fallbacks++ == 0)
+    {
+      fprintf(stderr, "[SSMEM] transparent huge pages not supported, using 4KB pages\n");
+    }
+  }
+  return mem;
+}
+
+/*
+ * Memory chunks of the ssmem allocators: from the pool while it is open,
+ * from the heap otherwise. size comes from ssmem_chunk_size(). Sets mapped
+ * to the length of the mapping of chunks that must be unmapped and to 0
+ * otherwise.
+ */
+void *
+ssmem_chunk_alloc(size_t size, size_t *mapped)
+{
+  void *mem;
+  *mapped = 0;
+  if (ssmem_pool_is_open())
+  {
+    return ssmem_pool_chunk_alloc(size);
+  }
+  if (ssmem_page_policy == SSMEM_PAGES_DEFAULT)
+  {
+    mem = (void *)aligned_alloc(CACHE_LINE_SIZE, size);
+  }
+  else
+  {
+    mem = ssmem_chunk_map(size);
+    *mapped = (mem != nullptr) ? size : 0;
+  }
+  if (mem != nullptr && ssmem_page_prefault)
+  {
+    for (size_t off = 0; off < size; off += SSMEM_BASE_PAGE_SIZE)
+    {
+      ((volatile char *)mem)[off] = 0;
+    }
+  }
+  return mem;
+}
+
+/*
+ * Frees a chunk of size bytes from ssmem_chunk_alloc(). The nodes recorded for
+ * its regions are forgotten, so that memory mapped there later is not routed
+ * to the node of this chunk.
+ */
+void ssmem_chunk_free(void *mem, size_t size, size_t mapped)
+{
+  if (!ssmem_pool_contains(mem))
+  {
+    numa::clear_region_nodes(mem, size);
+  }
+  if (mapped != 0)
+  {
+    munmap(mem, mapped);
+  }
+  else if (!ssmem_pool_contains(mem))
+  {
+    free(mem);
+  }
+}
+
+#endif /* _SSMEM_PAGES_H_ */
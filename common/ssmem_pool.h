@@ -0,0 +1,482 @@
+/*
+ * File-backed persistent heap for ssmem.
+ *
+ * A pool is a file (on a DAX file system for persistent memory, or on tmpfs
+ * for testing) that is mapped at a fixed base address. While a pool is open,
+ * ssmem takes its memory chunks from the pool instead of aligned_alloc(), so
+ * every node allocated through ssmem lives in the file. The pool starts with
+ * a header that holds the bump offset of the next free byte and a table of
+ * named roots. A data structure registers its root object there
+ * (ssmem_pool_root<SET>("name", ...)); after a restart, reopening the pool at
+ * the same base makes the structure reachable again under the same name.
+ *
+ * Data structures store absolute pointers, so a pool is always mapped at the
+ * base it was created at. Roots are stored as offsets; with
+ * SSMEM_POOL_RELOCATABLE a pool whose base is taken can still be mapped
+ * elsewhere, which is only useful to inspect the root table.
+ *
+ * Every ssmem chunk in the pool starts with a header (ssmem_pool_chunk_t)
+ * and the chunks form a persistent list. A chunk records the size of the
+ * objects ssmem carved out of it and how far it got, so that after a restart
+ * a recovery pass (common/recovery.hpp) can find the slots that no longer
+ * hold a reachable node and hand them back to the allocators. ssmem carves
+ * the objects of one size class out of each chunk. There is one
+ * pool per process.
+ */
+#ifndef _SSMEM_POOL_H_
+#define _SSMEM_POOL_H_
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <new>
+#include <utility>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <persist/pmem_utils.hpp>
+
+#define SSMEM_POOL_MAGIC         0x4c4f4f504d454d53ULL /* "SMEMPOOL" */
+#define SSMEM_POOL_MAX_ROOTS     63
+#define SSMEM_POOL_ROOT_NAME_LEN 48
+#define SSMEM_POOL_DEFAULT_BASE  ((void *)0x200000000000ULL) /* 32TB, clear of ASan */
+
+#define SSMEM_POOL_USED_STEP     (256 * 1024UL) /* granularity of the persistent chunk high-water mark */
+
+/* flags of ssmem_pool_open() */
+#define SSMEM_POOL_POPULATE    1 /* prefault the whole mapping (MAP_POPULATE) */
+#define SSMEM_POOL_RELOCATABLE 2 /* map elsewhere if the recorded base is taken */
+
+typedef struct ssmem_pool_root
+{
+  char name[SSMEM_POOL_ROOT_NAME_LEN];
+  uint64_t offset; /* 0 while the slot is free */
+  uint64_t size;
+} ssmem_pool_root_t;
+
+typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_pool_header
+{
+  uint64_t magic;
+  uint64_t size;
+  uint64_t base;              /* address the pool was created at */
+  std::atomic<uint64_t> next; /* offset of the first unallocated byte */
+  std::atomic<uint64_t> chunks; /* offset of the last ssmem chunk, 0 if none */
+  ALIGNED(CACHE_LINE_SIZE) ssmem_pool_root_t roots[SSMEM_POOL_MAX_ROOTS];
+} ssmem_pool_header_t;
+
+/* precedes the memory of every ssmem chunk in the pool */
+typedef struct ALIGNED(CACHE_LINE_SIZE) ssmem_pool_chunk
+{
+  uint64_t next;     /* offset of the chunk allocated before, 0 for the first */
+  uint64_t size;     /* bytes after the header */
+  uint64_t used;     /* bytes ssmem may have handed out (upper bound) */
+  uint64_t obj_size; /* size of the objects in the chunk, 0 while unknown */
+} ssmem_pool_chunk_t;
+
+typedef struct ssmem_pool
+{
+  ssmem_pool_header_t *header; /* nullptr while no pool is open */
+  char *base;                  /* range of the last pool that was open */
+  size_t size;
+  int fd;
+} ssmem_pool_t;
+
+ssmem_pool_t ssmem_pool_global = {nullptr, nullptr, 0, -1};
+
+inline bool
+ssmem_pool_is_open()
+{
+  return ssmem_pool_global.header != nullptr;
+}
+
+/* true for memory of the open pool, or of the last pool after it was closed */
+inline bool
+ssmem_pool_contains(void *p)
+{
+  return (char *)p >= ssmem_pool_global.base &&
+         (char *)p < ssmem_pool_global.base + ssmem_pool_global.size;
+}
+
+static inline uint64_t
+ssmem_pool_round_up(uint64_t x, uint64_t alignment)
+{
+  return (x + alignment - 1) / alignment * alignment;
+}
+
+static void *
+ssmem_pool_map(int fd, void *base, size_t size, int flags)
+{
+  int mflags = MAP_SHARED;
+  if (flags & SSMEM_POOL_POPULATE)
+  {
+    mflags |= MAP_POPULATE;
+  }
+  void *p = mmap(base, size, PROT_READ | PROT_WRITE, mflags | MAP_FIXED_NOREPLACE, fd, 0);
+  if (p == MAP_FAILED && (flags & SSMEM_POOL_RELOCATABLE))
+  {
+    p = mmap(nullptr, size, PROT_READ | PROT_WRITE, mflags, fd, 0);
+  }
+  /* kernels before 4.17 ignore MAP_FIXED_NOREPLACE and treat base as a hint */
+  if (p != MAP_FAILED && p != base && !(flags & SSMEM_POOL_RELOCATABLE))
+  {
+    munmap(p, size);
+    return MAP_FAILED;
+  }
+  return p;
+}
+
+/*
+ * Opens the pool in file path, creating it with the given size (rounded up to
+ * a multiple of 2MB) and base if the file does not exist, is empty or holds a
+ * pool whose creation did not complete. For an existing pool, size and base
+ * are taken from its header.
+ * Returns 1 if the pool was created, 0 if an existing pool was opened and -1
+ * on error. Must be called before the first ssmem allocation of the process.
+ */
+int ssmem_pool_open(const char *path, size_t size, void *base = SSMEM_POOL_DEFAULT_BASE, int flags = 0)
+{
+  assert(!ssmem_pool_is_open());
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+  {
+    perror("[POOL] open");
+    return -1;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  bool create = st.st_size == 0;
+  if (!create)
+  {
+    /* the magic number is persisted last, a file extended by ftruncate reads
+       as zeros: a zero magic is a creation that crashed and starts over */
+    uint64_t magic;
+    create = pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) && magic == 0;
+  }
+
+  if (create)
+  {
+    size = ssmem_pool_round_up(size, 2 * 1024 * 1024UL);
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)
+    {
+      perror("[POOL] ftruncate");
+      close(fd);
+      return -1;
+    }
+  }
+  else
+  {
+    ssmem_pool_header_t h;
+    if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != SSMEM_POOL_MAGIC)
+    {
+      fprintf(stderr, "[POOL] %s is not an ssmem pool\n", path);
+      close(fd);
+      return -1;
+    }
+    size = h.size;
+    base = (void *)h.base;
+  }
+
+  void *p = ssmem_pool_map(fd, base, size, flags);
+  if (p == MAP_FAILED)
+  {
+    fprintf(stderr, "[POOL] unable to map %s at %p\n", path, base);
+    close(fd);
+    return -1;
+  }
+
+  ssmem_pool_header_t *h = (ssmem_pool_header_t *)p;
+  if (create)
+  {
+    h->size = size;
+    h->base = (uint64_t)p;
+    h->next = ssmem_pool_round_up(sizeof(ssmem_pool_header_t), CACHE_LINE_SIZE);
+    h->chunks = 0;
+    FLUSH_STRUCT(h);
+    FENCE();
+    /* the magic number makes the pool valid */
+    h->magic = SSMEM_POOL_MAGIC;
+    FLUSH(&h->magic);
+    FENCE();
+  }
+
+  ssmem_pool_global.header = h;
+  ssmem_pool_global.base = (char *)p;
+  ssmem_pool_global.size = size;
+  ssmem_pool_global.fd = fd;
+  return create ? 1 : 0;
+}
+
+/*
+ * Unmaps the pool. The process must not access pool memory or allocate from
+ * the allocators that used it afterwards, unless the pool is reopened.
+ */
+void ssmem_pool_close()
+{
+  if (!ssmem_pool_is_open())
+  {
+    return;
+  }
+  munmap(ssmem_pool_global.base, ssmem_pool_global.size);
+  close(ssmem_pool_global.fd);
+  ssmem_pool_global.header = nullptr;
+  ssmem_pool_global.fd = -1;
+}
+
+/*
+ * Allocates size bytes from the pool, durable on return. Pool memory is
+ * never returned to the pool. Returns nullptr if the pool is exhausted.
+ */
+void *
+ssmem_pool_alloc(size_t size, size_t alignment = CACHE_LINE_SIZE)
+{
+  ssmem_pool_header_t *h = ssmem_pool_global.header;
+  uint64_t off = h->next.load();
+  uint64_t start;
+  do
+  {
+    start = ssmem_pool_round_up(off, alignment);
+    if (start + size > h->size)
+    {
+      return nullptr;
+    }
+  } while (!h->next.compare_exchange_weak(off, start + size));
+  FLUSH(&h->next);
+  FENCE();
+  return ssmem_pool_global.base + start;
+}
+
+/* bytes of the pool handed out so far, including the header */
+inline size_t
+ssmem_pool_used()
+{
+  return ssmem_pool_is_open() ? ssmem_pool_global.header->next.load() : 0;
+}
+
+/* Returns the root registered under name, nullptr if there is none */
+void *
+ssmem_pool_get_root(const char *name)
+{
+  ssmem_pool_header_t *h = ssmem_pool_global.header;
+  for (int i = 0; i < SSMEM_POOL_MAX_ROOTS; i++)
+  {
+    if (h->roots[i].offset != 0 && strncmp(h->roots[i].name, name, SSMEM_POOL_ROOT_NAME_LEN) == 0)
+    {
+      return ssmem_pool_global.base + h->roots[i].offset;
+    }
+  }
+  return nullptr;
+}
+
+/*
+ * Registers obj (which must be in the pool) under name, durable on return.
+ * Not thread safe.
+ */
+bool ssmem_pool_set_root(const char *name, void *obj, size_t size = 0)
+{
+  assert(ssmem_pool_is_open() && ssmem_pool_contains(obj));
+  assert(strlen(name) < SSMEM_POOL_ROOT_NAME_LEN);
+  ssmem_pool_header_t *h = ssmem_pool_global.header;
+  ssmem_pool_root_t *free_slot = nullptr;
+  for (int i = 0; i < SSMEM_POOL_MAX_ROOTS; i++)
+  {
+    ssmem_pool_root_t *r = &h->roots[i];
+    if (r->offset != 0 && strncmp(r->name, name, SSMEM_POOL_ROOT_NAME_LEN) == 0)
+    {
+      free_slot = r;
+      break;
+    }
+    if (r->offset == 0 && free_slot == nullptr)
+    {
+      free_slot = r;
+    }
+  }
+  if (free_slot == nullptr)
+  {
+    fprintf(stderr, "[POOL] root table is full\n");
+    return false;
+  }
+  if (free_slot->offset == 0)
+  {
+    strncpy(free_slot->name, name, SSMEM_POOL_ROOT_NAME_LEN);
+    free_slot->size = size;
+    FLUSH_STRUCT(free_slot);
+    FENCE();
+  }
+  /* a single 8 byte store publishes the root */
+  free_slot->offset = (char *)obj - ssmem_pool_global.base;
+  FLUSH(&free_slot->offset);
+  FENCE();
+  return true;
+}
+
+/*
+ * Returns the SET registered under name, or constructs one in the pool with
+ * args and registers it. Root objects are never destroyed.
+ */
+template <typename SET, typename... ARGS>
+SET *ssmem_pool_root(const char *name, ARGS &&...args)
+{
+  SET *set = (SET *)ssmem_pool_get_root(name);
+  if (set != nullptr)
+  {
+    return set;
+  }
+  void *mem = ssmem_pool_alloc(sizeof(SET), alignof(SET) > CACHE_LINE_SIZE ? alignof(SET) : CACHE_LINE_SIZE);
+  if (mem == nullptr)
+  {
+    fprintf(stderr, "[POOL] out of memory\n");
+    abort();
+  }
+  set = new (mem) SET(std::forward<ARGS>(args)...);
+  FLUSH_STRUCT(set);
+  FENCE();
+  ssmem_pool_set_root(name, set, sizeof(SET));
+  return set;
+}
+
+/*
+ * new/delete for the persistent parts of a data structure that are not
+ * allocated with ssmem (e.g. the bucket array of a hash table). They use the
+ * pool while it is open and the regular heap otherwise.
+ */
+template <typename T, typename... ARGS>
+T *ssmem_pool_new(ARGS &&...args)
+{
+  if (!ssmem_pool_is_open())
+  {
+    return new T(std::forward<ARGS>(args)...);
+  }
+  void *mem = ssmem_pool_alloc(sizeof(T), alignof(T) > CACHE_LINE_SIZE ? alignof(T) : CACHE_LINE_SIZE);
+  assert(mem != nullptr);
+  return new (mem) T(std::forward<ARGS>(args)...);
+}
+
+template <typename T>
+T *ssmem_pool_new_array(size_t n)
+{
+  if (!ssmem_pool_is_open())
+  {
+    return new T[n];
+  }
+  void *mem = ssmem_pool_alloc(n * sizeof(T), alignof(T) > CACHE_LINE_SIZE ? alignof(T) : CACHE_LINE_SIZE);
+  assert(mem != nullptr);
+  T *arr = (T *)mem;
+  for (size_t i = 0; i < n; i++)
+  {
+    new (&arr[i]) T();
+  }
+  return arr;
+}
+
+template <typename T>
+void ssmem_pool_delete(T *p)
+{
+  if (ssmem_pool_is_open() && ssmem_pool_contains(p))
+  {
+    p->~T();
+  }
+  else
+  {
+    delete p;
+  }
+}
+
+template <typename T>
+void ssmem_pool_delete_array(T *arr, size_t n)
+{
+  if (ssmem_pool_is_open() && ssmem_pool_contains(arr))
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      arr[i].~T();
+    }
+  }
+  else
+  {
+    delete[] arr;
+  }
+}
+
+inline ssmem_pool_chunk_t *
+ssmem_pool_chunk_of(void *mem)
+{
+  return (ssmem_pool_chunk_t *)mem - 1;
+}
+
+/* first chunk of the chunk list (the most recently allocated one) */
+inline ssmem_pool_chunk_t *
+ssmem_pool_first_chunk()
+{
+  uint64_t off = ssmem_pool_global.header->chunks.load();
+  return off == 0 ? nullptr : (ssmem_pool_chunk_t *)(ssmem_pool_global.base + off);
+}
+
+inline ssmem_pool_chunk_t *
+ssmem_pool_next_chunk(ssmem_pool_chunk_t *c)
+{
+  return c->next == 0 ? nullptr : (ssmem_pool_chunk_t *)(ssmem_pool_global.base + c->next);
+}
+
+inline void *
+ssmem_pool_chunk_mem(ssmem_pool_chunk_t *c)
+{
+  return c + 1;
+}
+
+/*
+ * Records that the chunk at mem hands out objects of obj_size up to offset
+ * end. This must be durable before such an object can become reachable, so
+ * it fences; the high-water mark moves in SSMEM_POOL_USED_STEP increments to
+ * make that rare. Returns the new high-water mark.
+ */
+uint64_t
+ssmem_pool_chunk_track(void *mem, uint64_t end, uint64_t obj_size)
+{
+  ssmem_pool_chunk_t *c = ssmem_pool_chunk_of(mem);
+  assert(c->obj_size == 0 || c->obj_size == obj_size);
+  c->obj_size = obj_size;
+  if (end > c->used)
+  {
+    c->used = std::min<uint64_t>(ssmem_pool_round_up(end, SSMEM_POOL_USED_STEP), c->size);
+  }
+  FLUSH(c);
+  FENCE();
+  return c->used;
+}
+
+/*
+ * Allocates an ssmem chunk of size bytes (after its header) from the pool and
+ * links it into the chunk list. Aborts if the pool is exhausted.
+ */
+void *
+ssmem_pool_chunk_alloc(size_t size)
+{
+  ssmem_pool_chunk_t *c = (ssmem_pool_chunk_t *)ssmem_pool_alloc(sizeof(ssmem_pool_chunk_t) + size);
+  if (c == nullptr)
+  {
+    fprintf(stderr, "[POOL] out of memory (chunk of %zu MB, %zu MB used)\n",
+            size / (1024 * 1024), ssmem_pool_used() / (1024 * 1024));
+    abort();
+  }
+  c->size = size;
+  c->used = 0;
+  c->obj_size = 0;
+  /* a chunk that is lost by a crash before it is linked was never used */
+  ssmem_pool_header_t *h = ssmem_pool_global.header;
+  uint64_t off = (char *)c - ssmem_pool_global.base;
+  uint64_t first = h->chunks.load();
+  do
+  {
+    c->next = first;
+    FLUSH(c);
+    FENCE();
+  } while (!h->chunks.compare_exchange_weak(first, off));
+  FLUSH(&h->chunks);
+  FENCE();
+  return ssmem_pool_chunk_mem(c);
+}
+
+#endif /* _SSMEM_POOL_H_ */
@@ -3,31 +3,47 @@
 #define SSMEM_WRAPPER_HPP_
 
 #include <atomic>
+#include <type_traits>
 
 #include "ssmem.h"
 
 struct ssmem_wrapper {
 private:
-  static std::atomic<int> num_threads;
   ssmem_allocator_t* allocator;
 
 public:
   ssmem_wrapper() {
-    int thread_id = num_threads.fetch_add(1);
+    // a thread may own several allocators, but they share one timestamp id.
+    // Ids of threads that exited are reused.
+    int thread_id = ssmem_get_id();
+    if(thread_id < 0) thread_id = ssmem_id_acquire();
     allocator = (ssmem_allocator_t*)malloc(sizeof(*allocator));
     ssmem_alloc_init(allocator, SSMEM_DEFAULT_MEM_SIZE, thread_id);
   }
 
+  // Objects of the thread may still be in use by others, so its memory is
+  // handed over to the remaining threads rather than freed
   ~ssmem_wrapper() {
-    // ssmem_alloc_term(allocator);
+    ssmem_alloc_orphan(allocator);
+    ::free(allocator);
   }
 
-  void* alloc(int size, bool flush = true) {
+  void* alloc(size_t size, bool flush = true) {
     return ssmem_alloc(allocator, size, flush);
   }
 
-  void free(void* obj, bool flush = true) {
-    ssmem_free(allocator, obj, flush);
+  // The size class is taken from the type of obj at compile time, so objects
+  // must be freed through a pointer to the type they were allocated for.
+  template<typename T>
+  void free(T* obj, bool flush = true) {
+    static_assert(!std::is_void<T>::value, "freeing a void* needs the object size");
+    static_assert(sizeof(T) <= SSMEM_MAX_CLASS_SIZE, "object larger than the largest size class");
+    constexpr int size_class = ssmem_size_class(sizeof(T));
+    ssmem_free_class(allocator, (void*) obj, size_class, flush);
+  }
+
+  void free(void* obj, size_t size, bool flush = true) {
+    ssmem_free(allocator, obj, size, flush);
   }
 };
 
@@ -37,8 +53,6 @@ struct ssmem_destructor {
   }
 };
 
-std::atomic<int> ssmem_wrapper::num_threads{0};
-
 thread_local ssmem_wrapper ssmem;
 ssmem_destructor ssmem_destructor_obj;
 
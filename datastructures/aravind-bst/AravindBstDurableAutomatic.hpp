@@ -8,6 +8,7 @@
 #include <algorithm>
 
 #include <common/ssmem_wrapper.hpp>
+#include <common/recovery.hpp>
 #include <persist/persist_offset.hpp>
 
 #define GC 1
@@ -324,6 +325,83 @@ public:
       return false;
   }
 
+  /* Recovery after a restart, see common/recovery.hpp. A flagged edge leads
+     to a leaf whose deletion took effect, but the leaf and its parent may
+     still be linked. Recovery removes such leaves together with their
+     parents, whose place is taken by the sibling subtree, and clears the
+     tags left by unfinished cleanups. The subtrees below a fixed depth are
+     recovered in parallel, the top of the tree afterwards.
+   */
+  void recover(int threads = recovery::default_threads()) {
+    Node* s = ADDRESS(root->left);
+    recovery::reachable(root);
+    recovery::reachable(ADDRESS(root->right));
+    recovery::reachable(s);
+    recovery::reachable(ADDRESS(s->right));
+
+    int depth = 0;
+    while(threads > 1 && (1 << depth) < 16 * threads) depth++;
+    std::vector<recovery_edge*> frontier;
+    recovery_collect(&s->left, 0, depth, frontier);
+    recovery::parallel_for(threads, frontier.size(), [this, &frontier] (size_t i) {
+      long long nodes = 0, unlinked = 0;
+      recovery_link(frontier[i], recovery_repair(frontier[i]->load(), -1, nodes, unlinked));
+      recovery::add_stats(nodes, unlinked);
+    });
+    long long nodes = 4, unlinked = 0;
+    recovery_link(&s->left, recovery_repair(s->left.load(), depth, nodes, unlinked));
+    FENCE();
+    recovery::add_stats(nodes, unlinked);
+  }
+
+private:
+  using recovery_edge = decltype(Node::left);
+
+  void recovery_link(recovery_edge* e, Node* n) {
+    if(e->load() != n) e->store(n, std::memory_order_relaxed, flush_option::flush);
+  }
+
+  // edges at depth stop below e, where the parallel part of recovery starts
+  void recovery_collect(recovery_edge* e, int depth, int stop, std::vector<recovery_edge*>& frontier) {
+    if(depth == stop) {
+      frontier.push_back(e);
+      return;
+    }
+    Node* n = ADDRESS(e->load());
+    if(ADDRESS(n->left) == nullptr) return;
+    recovery_collect(&n->left, depth+1, stop, frontier);
+    recovery_collect(&n->right, depth+1, stop, frontier);
+  }
+
+  // Repairs the subtree below an edge with value e and returns the new value
+  // of the edge, flagged if the subtree is gone. The edges stop levels below
+  // e have been repaired already (stop < 0: none).
+  Node* recovery_repair(Node* e, int stop, long long& nodes, long long& unlinked) {
+    if(stop == 0) return e;
+    Node* n = ADDRESS(e);
+    if(ADDRESS(n->left) == nullptr) {
+      if(GETFLAG(e)) {
+        unlinked++;
+        return FLAG(n);
+      }
+      recovery::reachable(n);
+      nodes++;
+      return n;
+    }
+    Node* l = recovery_repair(n->left, stop-1, nodes, unlinked);
+    Node* r = recovery_repair(n->right, stop-1, nodes, unlinked);
+    if(GETFLAG(l) || GETFLAG(r)) {
+      unlinked++;
+      return GETFLAG(l) ? r : l;
+    }
+    recovery_link(&n->left, l);
+    recovery_link(&n->right, r);
+    recovery::reachable(n);
+    nodes++;
+    return n;
+  }
+
+public:
   static std::string get_name() {
       return "Bst Auto, " + PERSIST<std::atomic<int>, flush_option::flush>::get_name();
   }
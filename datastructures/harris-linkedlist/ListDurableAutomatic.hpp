@@ -6,6 +6,7 @@
 #include <bits/stdc++.h> 
 
 #include <common/ssmem_wrapper.hpp>
+#include <common/recovery.hpp>
 #include <persist/persist_offset.hpp>
 #include <persist/persist_interface.hpp>
 
@@ -165,8 +166,7 @@ public:
 //=========================================
 
     bool add(int k, T item) {
-        if constexpr (!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value) 
-            OperationLifetime op;
+        OptionalOperationLifetime<!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value> op;
         //bool add(T item, int k, int threadID) {
         while (true) {
             Window window = seek(head, k);
@@ -188,8 +188,7 @@ public:
 //========================================
 
     bool remove(int key) {
-        if constexpr (!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value) 
-            OperationLifetime op;
+        OptionalOperationLifetime<!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value> op;
         bool snip = false;
         while (true) {
             Window window = seek(head, key);
@@ -216,8 +215,7 @@ public:
 //========================================
 
         bool contains(int k) {
-            if constexpr (!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value) 
-                OperationLifetime op;
+            OptionalOperationLifetime<!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value> op;
             int key = k;
             Node* curr = head;
             bool marked = getMark(getNext(curr));
@@ -235,6 +233,36 @@ public:
             }
         }
 
+        /* Recovery after a restart, see common/recovery.hpp. Unlinks the
+           nodes that were marked but not unlinked yet. A list is a single chain,
+           so it is recovered sequentially (the hash table recovers its buckets
+           in parallel).
+         */
+        void recover(int threads = 1) {
+            long long nodes = 1, unlinked = 0;
+            recovery::reachable(head);
+            Node* pred = head;
+            Node* curr = getAdd(getNext(pred));
+            while(curr != nullptr) {
+                Node* succ = getNext(curr);
+                if(getMark(succ)) {
+                    unlinked++;
+                    curr = getAdd(succ);
+                    continue;
+                }
+                if(getNext(pred) != curr)
+                    pred->next.store(curr, std::memory_order_relaxed, flush_option::flush);
+                recovery::reachable(curr);
+                nodes++;
+                pred = curr;
+                curr = getAdd(succ);
+            }
+            if(getNext(pred) != nullptr)
+                pred->next.store(nullptr, std::memory_order_relaxed, flush_option::flush);
+            FENCE();
+            recovery::add_stats(nodes, unlinked);
+        }
+
         static std::string get_name() {
             return "List Auto, " + PERSIST<std::atomic<int>, flush_option::flush>::get_name();
         }
@@ -6,8 +6,10 @@
 #include <bits/stdc++.h> 
 
 #include <common/ssmem_wrapper.hpp>
+#include <common/recovery.hpp>
 #include <persist/persist_offset.hpp>
 #include <persist/persist_interface.hpp>
+#include <persist/detectable.hpp>
 
 namespace ListDurableManualNode {
     template <typename T, template<typename, bool> typename PERSIST> 
@@ -15,8 +17,16 @@ namespace ListDurableManualNode {
         persist<int, flush_option::no_flush> key;
         persist<T, flush_option::no_flush> value;
         PERSIST<std::atomic<Node*>, flush_option::no_flush> next;
+#ifdef DETECTABLE_OPS
+        detectable::tag_t creator;                  // add that inserted the node
+        std::atomic<detectable::tag_t> deleter;     // remove that owns the node's removal
+#endif
 
         Node(int k, T val, Node* n) : key(k), value(val), next(n) {
+#ifdef DETECTABLE_OPS
+            creator = detectable::current_op();
+            deleter = 0;
+#endif
             FLUSH_STRUCT(this);
             assert((((uintptr_t) this) % (ALIGNMENT)) == 0); // check alignment
         }
@@ -27,8 +37,16 @@ namespace ListDurableManualNode {
         persist<int, flush_option::no_flush> key;
         persist<T, flush_option::no_flush> value;
         persist_interface<std::atomic<Node*>, flush_option::no_flush> next;
+#ifdef DETECTABLE_OPS
+        detectable::tag_t creator;                  // add that inserted the node
+        std::atomic<detectable::tag_t> deleter;     // remove that owns the node's removal
+#endif
 
         Node(int k, T val, Node* n) : key(k), value(val), next(n) {
+#ifdef DETECTABLE_OPS
+            creator = detectable::current_op();
+            deleter = 0;
+#endif
             assert((((uintptr_t) this) % (ALIGNMENT)) == 0); // check alignment
         }
     };
@@ -39,8 +57,16 @@ namespace ListDurableManualNode {
         persist<T, flush_option::no_flush> value;
         persist_offset<std::atomic<Node*>, sizeof(Node*), flush_option::no_flush> next;    
         flush_counter_t counter;
+#ifdef DETECTABLE_OPS
+        detectable::tag_t creator;                  // add that inserted the node
+        std::atomic<detectable::tag_t> deleter;     // remove that owns the node's removal
+#endif
 
         Node(int k, T val, Node* n) : key(k), value(val), next(n), counter(0) {
+#ifdef DETECTABLE_OPS
+            creator = detectable::current_op();
+            deleter = 0;
+#endif
             FLUSH_STRUCT(this);
             assert((((uintptr_t) this) % (ALIGNMENT)) == 0); // check alignment
         }
@@ -71,6 +97,28 @@ private:
         return (Node*)node;
     }
 
+#ifdef DETECTABLE_OPS
+    // Completes the operations that inserted and removed the marked nodes
+    // from first up to last. Must run before they are unlinked, because
+    // recovery can only find operations whose nodes are still reachable.
+    void complete_ops(Node* first, Node* last) {
+        for(Node* n = getAdd(first); n != last; n = getAdd(getNext(n))) {
+            detectable::complete(n->creator, true);
+            detectable::complete(n->deleter, true);
+        }
+        FENCE();
+    }
+
+    // Marks n, whose removal has been claimed by setting its deleter.
+    // Any thread that finds a claimed node helps.
+    void mark_claimed(Node* n) {
+        while(true) {
+            Node* succ = getNext(n);
+            if(getMark(succ) || CAS_next_flushed(n, succ, mark(succ))) return;
+        }
+    }
+#endif
+
 public:
     Node* getNext(Node* n) { 
         return n->next.load(std::memory_order_acquire); 
@@ -156,6 +204,9 @@ public:
                 }
             }
                 /* 3: Remove one or more marked nodes */
+#ifdef DETECTABLE_OPS
+            complete_ops(leftNext, right);
+#endif
             if (CAS_next_flushed(left, leftNext, right)) {
                 Node* removedNode = getAdd(leftNext);
                 while(removedNode != right) {
@@ -175,8 +226,14 @@ public:
     //=========================================
 
     bool add(int k, T item) {
-        if constexpr (!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value) 
-            OperationLifetime op;
+        OptionalOperationLifetime<!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value> op;
+#ifdef DETECTABLE_OPS
+        detectable::tag_t tag = detectable::begin(detectable::ADD, k);
+        return detectable::end(tag, add_impl(k, item));
+    }
+
+    bool add_impl(int k, T item) {
+#endif
         //bool add(T item, int k, int threadID) {
         while (true) {
             Window window = seek(head, k);
@@ -199,8 +256,38 @@ public:
     //========================================
 
     bool remove(int key) {
-        if constexpr (!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value) 
-            OperationLifetime op;
+        OptionalOperationLifetime<!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value> op;
+#ifdef DETECTABLE_OPS
+        detectable::tag_t tag = detectable::begin(detectable::REMOVE, key);
+        return detectable::end(tag, remove_impl(key, tag));
+    }
+
+    // The remove that sets curr's deleter owns the removal; it is linearized
+    // when curr is marked. Other removers help with the marking and retry.
+    bool remove_impl(int key, detectable::tag_t tag) {
+        while (true) {
+            Window window = seek(head, key);
+            Node* pred = window.pred;
+            pred->next.flush_if_needed();
+            Node* curr = window.curr;
+            if (!curr || curr->key != key)
+                return false;
+            detectable::tag_t expected = 0;
+            if (!curr->deleter.compare_exchange_strong(expected, tag)) {
+                mark_claimed(curr);
+                continue;
+            }
+            // the mark is flushed with curr's line, which holds the deleter
+            assert(SAME_CACHELINE(&curr->deleter, &curr->next));
+            mark_claimed(curr);
+            Node* succ = getAdd(getNext(curr));
+            complete_ops(curr, succ);
+            if(CAS_next_flushed(pred, curr, succ))
+                ssmem.free(curr);
+            return true;
+        }
+    }
+#else
         bool snip = false;
         while (true) {
             Window window = seek(head, key);
@@ -224,12 +311,12 @@ public:
             }
         }
     }
+#endif
 
     //========================================
 
     bool contains(int k) {
-        if constexpr (!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value) 
-            OperationLifetime op;
+        OptionalOperationLifetime<!std::is_same<PERSIST<T,false>, persist_interface<T,false>>::value> op;
         int key = k;
         Node* prev = NULL;
         Node* curr = head;
@@ -251,6 +338,62 @@ public:
         }
     }
 
+#ifdef DETECTABLE_OPS
+    // Whether the pending operation tag left evidence in the list (see
+    // detectable.hpp). Finishes the marking of claimed nodes. Must be run in
+    // a quiescent state.
+    bool detectable_effect(detectable::tag_t tag, detectable::op_type_t type, int key) {
+        for(Node* n = getAdd(getNext(head)); n != nullptr; n = getAdd(getNext(n))) {
+            if(n->key != key) continue;
+            if(type == detectable::ADD && n->creator == tag) return true;
+            if(type == detectable::REMOVE && n->deleter == tag) {
+                mark_claimed(n);
+                return true;
+            }
+        }
+        return false;
+    }
+#endif
+
+    /* Recovery after a restart, see common/recovery.hpp. Unlinks the
+       nodes that were marked but not unlinked yet. A list is a single chain,
+       so it is recovered sequentially (the hash table recovers its buckets
+       in parallel).
+     */
+    void recover(int threads = 1) {
+        long long nodes = 1, unlinked = 0;
+        recovery::reachable(head);
+        Node* pred = head;
+        Node* curr = getAdd(getNext(pred));
+        while(curr != nullptr) {
+            Node* succ = getNext(curr);
+#ifdef DETECTABLE_OPS
+            // a claimed node is removed, and its operations are completed
+            // before the evidence disappears
+            if(!getMark(succ) && curr->deleter != 0) succ = mark(succ);
+            if(getMark(succ)) {
+                detectable::complete(curr->creator, true);
+                detectable::complete(curr->deleter, true);
+            }
+#endif
+            if(getMark(succ)) {
+                unlinked++;
+                curr = getAdd(succ);
+                continue;
+            }
+            if(getNext(pred) != curr)
+                pred->next.store(curr, std::memory_order_relaxed, flush_option::flush);
+            recovery::reachable(curr);
+            nodes++;
+            pred = curr;
+            curr = getAdd(succ);
+        }
+        if(getNext(pred) != nullptr)
+            pred->next.store(nullptr, std::memory_order_relaxed, flush_option::flush);
+        FENCE();
+        recovery::add_stats(nodes, unlinked);
+    }
+
     static std::string get_name() {
         return "List Manual, " + PERSIST<std::atomic<int>, flush_option::flush>::get_name();
     }
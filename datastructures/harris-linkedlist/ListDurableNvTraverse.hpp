@@ -5,7 +5,11 @@
 #include <atomic>
 #include <bits/stdc++.h> 
 
+#include <common/ssmem_wrapper.hpp>
+#include <common/recovery.hpp>
 #include <persist/persist_offset.hpp>
+#include <persist/persist_interface.hpp>
+#include <persist/persist_range.hpp>
 
 namespace ListDurableNvTraverseNode {
     template <typename T, template<typename, bool> typename PERSIST> 
@@ -15,7 +19,7 @@ namespace ListDurableNvTraverseNode {
         PERSIST<std::atomic<Node*>, flush_option::no_flush> next;
 
         Node(int k, T val, Node* n) : key(k), value(val), next(n) {
-            FLUSH_STRUCT(this);
+            FLUSH_NEW_NODE(this);
             assert((((uintptr_t) this) % (ALIGNMENT)) == 0); // check alignment
         }
     };
@@ -39,7 +43,7 @@ namespace ListDurableNvTraverseNode {
         flush_counter_t counter;
 
         Node(int k, T val, Node* n) : key(k), value(val), next(n), counter(0) {
-            FLUSH_STRUCT(this);
+            FLUSH_NEW_NODE(this);
             assert((((uintptr_t) this) % (ALIGNMENT)) == 0); // check alignment
         }
     };
@@ -100,7 +104,7 @@ private:
 
         ListDurableNvTraverse() {
             head = static_cast<Node*>(ssmem.alloc(sizeof(Node)));
-            new (head) Node(INT_MIN, INT_MIN, NULL);
+            construct_node<Node>(head, INT_MIN, INT_MIN, nullptr);
             assert((((uintptr_t) this) % (ALIGNMENT)) == 0); // check alignment
         }
 
@@ -196,7 +200,7 @@ private:
             if (curr && curr->key == k)
                 return false;
             Node* node = static_cast<Node*>(ssmem.alloc(sizeof(Node)));
-            new (node) Node(k, item, curr);
+            construct_node(node, k, item, curr);
             bool res = CAS_next(pred, curr, node);
             if (res) return true;
             else {
@@ -259,6 +263,36 @@ private:
         }
     }
 
+    /* Recovery after a restart, see common/recovery.hpp. Unlinks the
+       nodes that were marked but not unlinked yet. A list is a single chain,
+       so it is recovered sequentially (the hash table recovers its buckets
+       in parallel).
+     */
+    void recover(int threads = 1) {
+        long long nodes = 1, unlinked = 0;
+        recovery::reachable(head);
+        Node* pred = head;
+        Node* curr = getAdd(getNext(pred));
+        while(curr != nullptr) {
+            Node* succ = getNext(curr);
+            if(getMark(succ)) {
+                unlinked++;
+                curr = getAdd(succ);
+                continue;
+            }
+            if(getNext(pred) != curr)
+                pred->next.store(curr, std::memory_order_relaxed, flush_option::flush);
+            recovery::reachable(curr);
+            nodes++;
+            pred = curr;
+            curr = getAdd(succ);
+        }
+        if(getNext(pred) != nullptr)
+            pred->next.store(nullptr, std::memory_order_relaxed, flush_option::flush);
+        FENCE();
+        recovery::add_stats(nodes, unlinked);
+    }
+
     static std::string get_name() {
         return "List NvTraverse, " + PERSIST<std::atomic<int>, flush_option::flush>::get_name();
     }
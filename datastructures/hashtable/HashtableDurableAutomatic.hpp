@@ -19,18 +19,18 @@ public:
     
     HashtableDurableAutomatic(int s) : 
                        num_buckets(s), 
-                       buckets(new persist<ListDurableAutomatic<T, PERSIST>*>[num_buckets]) {
+                       buckets(ssmem_pool_new_array<persist<ListDurableAutomatic<T, PERSIST>*>>(num_buckets)) {
         for (int i = 0; i< num_buckets; i++) {
-            buckets[i] = new ListDurableAutomatic<T, PERSIST>();
+            buckets[i] = ssmem_pool_new<ListDurableAutomatic<T, PERSIST>>();
         }
         assert((((uintptr_t) this) % (ALIGNMENT)) == 0); // check alignment
     }
     
     ~HashtableDurableAutomatic() {
         for (int i = 0; i< num_buckets; i++) {
-            delete buckets[i];
+            ssmem_pool_delete((ListDurableAutomatic<T, PERSIST>*) buckets[i]);
         }
-        delete[] buckets;
+        ssmem_pool_delete_array<persist<ListDurableAutomatic<T, PERSIST>*>>(buckets, num_buckets);
     }
 
     bool add(int k, T item) {
@@ -56,6 +56,15 @@ public:
         return b;
     }
 
+    /* Recovery after a restart, see common/recovery.hpp. The buckets are
+       recovered in parallel.
+     */
+    void recover(int threads = recovery::default_threads()) {
+        recovery::parallel_for(threads, num_buckets, [this] (size_t i) {
+            buckets[i]->recover();
+        });
+    }
+
     static std::string get_name() {
         return "Hashtable Auto, " + PERSIST<std::atomic<int>, flush_option::flush>::get_name();
     }
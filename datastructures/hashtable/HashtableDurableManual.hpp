@@ -19,9 +19,9 @@ public:
     
     HashtableDurableManual(int s) : 
                        num_buckets(s), 
-                       buckets(new persist<ListDurableManual<T, PERSIST>*>[num_buckets]) {
+                       buckets(ssmem_pool_new_array<persist<ListDurableManual<T, PERSIST>*>>(num_buckets)) {
         for (int i = 0; i< num_buckets; i++) {
-            buckets[i] = new ListDurableManual<T, PERSIST>();
+            buckets[i] = ssmem_pool_new<ListDurableManual<T, PERSIST>>();
         }
         FENCE();
         assert((((uintptr_t) this) % (ALIGNMENT)) == 0); // check alignment
@@ -29,9 +29,9 @@ public:
     
     ~HashtableDurableManual() {
         for (int i = 0; i< num_buckets; i++) {
-            delete buckets[i];
+            ssmem_pool_delete((ListDurableManual<T, PERSIST>*) buckets[i]);
         }
-        delete[] buckets;
+        ssmem_pool_delete_array<persist<ListDurableManual<T, PERSIST>*>>(buckets, num_buckets);
     }
 
     bool add(int k, T item) {
@@ -57,6 +57,21 @@ public:
         return b;
     }
 
+#ifdef DETECTABLE_OPS
+    bool detectable_effect(detectable::tag_t tag, detectable::op_type_t type, int key) {
+        return buckets[key%num_buckets]->detectable_effect(tag, type, key);
+    }
+#endif
+
+    /* Recovery after a restart, see common/recovery.hpp. The buckets are
+       recovered in parallel.
+     */
+    void recover(int threads = recovery::default_threads()) {
+        recovery::parallel_for(threads, num_buckets, [this] (size_t i) {
+            buckets[i]->recover();
+        });
+    }
+
     static std::string get_name() {
         return "Hashtable Manual, " + PERSIST<std::atomic<int>, flush_option::flush>::get_name();
     }
@@ -19,18 +19,18 @@ public:
     
     HashtableDurableNvTraverse(int s) : 
                        num_buckets(s), 
-                       buckets(new persist<ListDurableNvTraverse<T, PERSIST>*>[num_buckets]) {
+                       buckets(ssmem_pool_new_array<persist<ListDurableNvTraverse<T, PERSIST>*>>(num_buckets)) {
         for (int i = 0; i< num_buckets; i++) {
-            buckets[i] = new ListDurableNvTraverse<T, PERSIST>();
+            buckets[i] = ssmem_pool_new<ListDurableNvTraverse<T, PERSIST>>();
         }
         assert((((uintptr_t) this) % (ALIGNMENT)) == 0); // check alignment
     }
     
     ~HashtableDurableNvTraverse() {
         for (int i = 0; i< num_buckets; i++) {
-            delete buckets[i];
+            ssmem_pool_delete((ListDurableNvTraverse<T, PERSIST>*) buckets[i]);
         }
-        delete[] buckets;
+        ssmem_pool_delete_array<persist<ListDurableNvTraverse<T, PERSIST>*>>(buckets, num_buckets);
     }
 
     bool add(int k, T item) {
@@ -56,6 +56,15 @@ public:
         return b;
     }
     
+    /* Recovery after a restart, see common/recovery.hpp. The buckets are
+       recovered in parallel.
+     */
+    void recover(int threads = recovery::default_threads()) {
+        recovery::parallel_for(threads, num_buckets, [this] (size_t i) {
+            buckets[i]->recover();
+        });
+    }
+
     static std::string get_name() {
         return "Hashtable NvTraverse, " + PERSIST<std::atomic<int>, flush_option::flush>::get_name();
     }
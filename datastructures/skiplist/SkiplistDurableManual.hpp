@@ -6,6 +6,7 @@
 #include <bits/stdc++.h>
 
 #include <common/ssmem_wrapper.hpp>
+#include <common/recovery.hpp>
 #include <persist/persist_offset.hpp>
 
 template <typename T, template<typename, bool> typename PERSIST>
@@ -207,6 +208,117 @@ public:
         return true;
     }
 
+    /* Recovery after a restart, see common/recovery.hpp.
+
+       Level 0 is the durable part of the skiplist. Recovery keeps the nodes of
+       level 0 that are not marked and rebuilds every index level from their
+       towers, which completes towers that were only partly linked and drops
+       the index links of removed nodes.
+
+       Level 0 is cut into segments at nodes found through an index level, and
+       the segments are recovered in parallel. Index links may be stale after a
+       crash, so every segment is first checked to end where the next one
+       starts; if one does not, level 0 is recovered as a single segment.
+     */
+    void recover(int threads = recovery::default_threads()) {
+        std::vector<recovery_segment> segments;
+        std::vector<Node*> starts = recovery_splitters(threads);
+        for(size_t j = 0; j < starts.size(); j++)
+            segments.push_back({starts[j], j+1 < starts.size() ? starts[j+1] : nullptr});
+
+        std::atomic<bool> valid(true);
+        if(segments.size() > 1) {
+            recovery::parallel_for(threads, segments.size(), [this, &segments, &valid] (size_t j) {
+                if(!recovery_check_segment(segments[j])) valid = false;
+            });
+        }
+        if(!valid) {
+            segments.resize(1);
+            segments[0].end = nullptr;
+        }
+
+        recovery::parallel_for(threads, segments.size(), [this, &segments] (size_t j) {
+            recovery_segment& s = segments[j];
+            long long nodes = 0, unlinked = 0, relinked = 0;
+            for(int i = 0; i < MAX_LEVEL; i++) s.first[i] = s.last[i] = nullptr;
+            Node* n = s.start;
+            while(n != s.end) {
+                recovery::reachable(n);
+                nodes++;
+                Node* next = getAdd(getNext(n, 0));
+                while(next != s.end && next != nullptr && getMark(getNext(next, 0))) {
+                    unlinked++;
+                    next = getAdd(getNext(next, 0));
+                }
+                for(int i = 0; i < n->toplevel; i++) {
+                    if(s.last[i] == nullptr) s.first[i] = n;
+                    else if(recovery_link(s.last[i], i, n) && i > 0) relinked++;
+                    s.last[i] = n;
+                }
+                n = next;
+            }
+            recovery::add_stats(nodes, unlinked, relinked);
+        });
+
+        // stitch the segments together, the tail ends every level
+        long long relinked = 0;
+        for(int i = 0; i < MAX_LEVEL; i++) {
+            Node* prev = nullptr;
+            for(recovery_segment& s : segments) {
+                if(s.first[i] == nullptr) continue;
+                if(prev != nullptr && recovery_link(prev, i, s.first[i]) && i > 0) relinked++;
+                prev = s.last[i];
+            }
+            recovery_link(prev, i, nullptr);
+        }
+        FENCE();
+        recovery::add_stats(0, 0, relinked);
+    }
+
+private:
+    struct recovery_segment {
+        Node* start;  // first node, not marked
+        Node* end;    // start of the next segment, nullptr for the last one
+        Node* first[MAX_LEVEL];
+        Node* last[MAX_LEVEL];
+    };
+
+    bool recovery_link(Node* n, int i, Node* succ) {
+        if(getNext(n, i) == succ) return false;
+        n->next[i].store(succ, std::memory_order_relaxed, flush_option::flush);
+        return true;
+    }
+
+    // Nodes of the lowest index level with at least 16 nodes per thread
+    std::vector<Node*> recovery_splitters(int threads) {
+        std::vector<Node*> starts{this->head};
+        size_t target = 16 * threads;
+        for(int i = MAX_LEVEL - 1; i > 0 && threads > 1; i--) {
+            starts.resize(1);
+            int prev_key = INT_MIN;
+            for(Node* n = getAdd(getNext(this->head, i)); n != nullptr && n->key != INT_MAX; n = getAdd(getNext(n, i))) {
+                if(n->key <= prev_key || starts.size() >= 4 * target) break;
+                prev_key = n->key;
+                if(!getMark(getNext(n, 0))) starts.push_back(n);
+            }
+            if(starts.size() >= target) break;
+        }
+        return starts;
+    }
+
+    // true if level 0 leads from the start of s to its end in key order
+    bool recovery_check_segment(recovery_segment& s) {
+        Node* n = s.start;
+        while(true) {
+            Node* next = getAdd(getNext(n, 0));
+            if(next == s.end) return s.end != nullptr || n->key == INT_MAX;
+            if(next == nullptr || next->key <= n->key) return false;
+            if(s.end != nullptr && next->key >= s.end->key) return false;
+            n = next;
+        }
+    }
+
+public:
     static std::string get_name() {
         return "Skiplist Manual, " + PERSIST<std::atomic<int>, flush_option::flush>::get_name();
     }
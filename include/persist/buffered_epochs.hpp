@@ -0,0 +1,304 @@
+
+#ifndef BUFFERED_EPOCHS_HPP_
+#define BUFFERED_EPOCHS_HPP_
+
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <immintrin.h>
+#include "pmem_utils.hpp"
+
+// Buffered durable linearizability with periodic persistence epochs.
+//
+// While epochs are running (start()), the flush backend is replaced: FLUSH()
+// inside an operation only records the cache line in a per-thread dirty
+// buffer of the current epoch, and FENCE() issues nothing. A background
+// thread periodically closes the epoch: new operations wait, operations of the
+// closing epoch run to completion, and the next epoch opens. The boundary is
+// therefore a quiescent cut, every operation is entirely before or after it.
+// The flusher then writes back the dirty lines of the closed epoch in bulk,
+// fences and persists the number of the epoch in durable_epoch.
+//
+// After a crash every update of the epochs up to durable_epoch is in
+// persistent memory, later updates may be lost (the recovery point lags by
+// about one period plus the time to flush an epoch).
+//
+// This is NOT crash consistent. Lines written in later epochs can reach
+// persistent memory at any time through cache evictions, and there is no undo
+// log or per-word epoch to roll them back, so after a crash the image can mix
+// the durable cut with parts of later epochs (e.g. a node linked whose
+// contents were not written back). Use it to measure what buffering would
+// gain, not to recover data.
+//
+// Operations are delimited by OperationLifetime, which calls begin_operation()
+// and end_operation() through operation_hooks while epochs run. Flushes
+// outside of an operation (e.g. while a data structure is constructed) are
+// issued directly. Requires the runtime flush backend (no PWB_IS_* define).
+namespace buffered_epochs {
+
+  const int MAX_THREADS = 512;
+  // Lines per thread and epoch; once full, further lines are flushed directly
+  const int DIRTY_BUFFER_SIZE = 16384;
+  const int FILTER_SIZE = 1024;
+
+  struct alignas(64) thread_slot {
+    // epoch of the running operation, 0 when idle
+    std::atomic<uint64_t> announced{0};
+    int index;
+    // one buffer per epoch parity, the flusher drains the closed epoch's
+    // buffer while the next epoch fills the other one
+    int count[2] = {0, 0};
+    uint64_t dirty[2][DIRTY_BUFFER_SIZE];
+  };
+
+  std::atomic<bool> active(false);
+  // even while an epoch is open, odd while it is being closed
+  std::atomic<uint64_t> epoch(2);
+  alignas(64) std::atomic<uint64_t> durable_epoch(0);
+
+  // slots of running threads, nullptr where a thread gave its slot back
+  std::atomic<thread_slot*> slots[MAX_THREADS];
+  std::atomic<int> num_slots(0);
+  // held while an epoch is closed and while a thread gives back its slot
+  std::mutex slots_lock;
+
+  // flusher statistics
+  std::atomic<uint64_t> epochs_completed(0);
+  std::atomic<uint64_t> lines_flushed(0);
+  std::atomic<uint64_t> overflow_flushes(0);
+  std::atomic<uint64_t> total_lag_ns(0);
+  std::atomic<uint64_t> max_lag_ns(0);
+  std::chrono::steady_clock::time_point last_boundary;
+
+  // The slot of a thread is freed when the thread exits (release_slot())
+  struct slot_holder {
+    thread_slot* slot = nullptr;
+    int depth = 0;
+    ~slot_holder();
+  };
+  thread_local slot_holder self;
+
+  // recently buffered lines, so that hot lines are recorded once per epoch
+  struct line_filter {
+    uint64_t epoch = 0;
+    uint64_t lines[FILTER_SIZE];
+  };
+  thread_local line_filter filter;
+  // set when this thread flushed directly and has not fenced yet
+  thread_local bool direct_flushes = false;
+
+  inline thread_slot* my_slot() {
+    if(self.slot) return self.slot;
+    thread_slot* s = new thread_slot;  // the dirty buffers are not zeroed
+    int n = num_slots.load();
+    for(int i = 0; i < n; i++) {
+      thread_slot* expected = nullptr;
+      s->index = i;
+      if(slots[i].compare_exchange_strong(expected, s))
+        return self.slot = s;
+    }
+    int i = num_slots++;
+    if(i >= MAX_THREADS) {
+      std::cerr << "buffered_epochs: too many threads" << std::endl;
+      std::exit(1);
+    }
+    s->index = i;
+    slots[i].store(s);
+    return self.slot = s;
+  }
+
+  inline int parity(uint64_t e) { return (e >> 1) & 1; }
+
+  // Called when an operation starts, waits while an epoch is being closed
+  inline void begin_operation() {
+    if(self.depth++ > 0) return;
+    thread_slot* s = my_slot();
+    while(true) {
+      uint64_t e = epoch.load();
+      if(e & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      s->announced.store(e);
+      if(epoch.load() == e) return;
+      s->announced.store(0);
+    }
+  }
+
+  inline void end_operation() {
+    if(--self.depth > 0) return;
+    self.slot->announced.store(0);
+  }
+
+  const operation_hooks_t hooks = {begin_operation, end_operation};
+
+  #ifdef PWB_IS_RUNTIME
+    void (*real_pwb)(void*) = nullptr;
+    void (*real_pfence)() = nullptr;
+
+    void buffered_pwb(void* p) {
+      thread_slot* s = self.slot;
+      uint64_t e = s ? s->announced.load(std::memory_order_relaxed) : 0;
+      if(e == 0) {  // not inside an operation
+        real_pwb(p);
+        direct_flushes = true;
+        return;
+      }
+      uint64_t line = ((uint64_t) p) & CACHELINE_MASK;
+      if(filter.epoch != e) {
+        for(int i = 0; i < FILTER_SIZE; i++) filter.lines[i] = 0;
+        filter.epoch = e;
+      }
+      uint64_t& slot = filter.lines[(line >> 6) % FILTER_SIZE];
+      if(slot == line) return;
+      slot = line;
+      int& count = s->count[parity(e)];
+      if(count == DIRTY_BUFFER_SIZE) {
+        // fenced by the FENCE_IF_FLUSHED() that ends the operation
+        real_pwb(p);
+        direct_flushes = true;
+        overflow_flushes.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      s->dirty[parity(e)][count++] = line;
+    }
+
+    void buffered_pfence() {
+      if(direct_flushes) {
+        direct_flushes = false;
+        real_pfence();
+      }
+    }
+
+    // Closes the open epoch and makes it durable. Called by the flusher
+    // thread, or directly while no flusher is running (e.g. in tests).
+    inline void advance() {
+      assert(active);
+      std::lock_guard<std::mutex> guard(slots_lock);
+      uint64_t e = epoch.load();
+      epoch.store(e+1);
+      auto boundary = std::chrono::steady_clock::now();
+      int n = num_slots.load();
+      for(int i = 0; i < n; i++) {
+        thread_slot* s = slots[i].load();
+        if(!s) continue;
+        while(s->announced.load() == e) std::this_thread::yield();
+      }
+      epoch.store(e+2);
+
+      uint64_t lines = 0;
+      int p = parity(e);
+      for(int i = 0; i < n; i++) {
+        thread_slot* s = slots[i].load();
+        if(!s) continue;
+        for(int j = 0; j < s->count[p]; j++)
+          real_pwb((void*) s->dirty[p][j]);
+        lines += s->count[p];
+        s->count[p] = 0;
+      }
+      real_pfence();
+      durable_epoch.store(e);
+      real_pwb(&durable_epoch);
+      real_pfence();
+
+      // updates made after the previous boundary were at risk until now
+      uint64_t lag = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - last_boundary).count();
+      last_boundary = boundary;
+      lines_flushed += lines;
+      total_lag_ns += lag;
+      if(lag > max_lag_ns) max_lag_ns = lag;
+      epochs_completed++;
+    }
+  #endif
+
+  // Writes back the lines the exiting thread buffered in epochs that are not
+  // durable yet, then frees its slot. Waits for an epoch being closed.
+  inline void release_slot(thread_slot* s) {
+    std::lock_guard<std::mutex> guard(slots_lock);
+    #ifdef PWB_IS_RUNTIME
+      if(s->count[0] + s->count[1] > 0) {
+        for(int p = 0; p < 2; p++)
+          for(int j = 0; j < s->count[p]; j++)
+            real_pwb((void*) s->dirty[p][j]);
+        real_pfence();
+      }
+    #endif
+    slots[s->index].store(nullptr);
+    delete s;
+  }
+
+  inline slot_holder::~slot_holder() {
+    if(slot) release_slot(slot);
+  }
+
+  std::thread flusher;
+  std::atomic<bool> stop_requested(false);
+
+  inline void reset_stats() {
+    epochs_completed = lines_flushed = overflow_flushes = total_lag_ns = max_lag_ns = 0;
+  }
+
+  // Installs the buffered flush backend and starts a flusher thread that
+  // closes an epoch every period_us microseconds (never, if 0).
+  // Returns false if the flush instruction is fixed at compile time.
+  // Must be called before worker threads start.
+  inline bool start(uint64_t period_us) {
+    #ifdef PWB_IS_RUNTIME
+      if(active) return true;
+      if(pwb_fn == pwb_resolve) init_flush_instruction();
+      real_pwb = pwb_fn;
+      real_pfence = pfence_fn;
+      pwb_fn = buffered_pwb;
+      pfence_fn = buffered_pfence;
+      operation_hooks = &hooks;
+      active = true;
+      stop_requested = false;
+      last_boundary = std::chrono::steady_clock::now();
+      if(period_us > 0) {
+        flusher = std::thread([period_us] () {
+          while(!stop_requested) {
+            std::this_thread::sleep_for(std::chrono::microseconds(period_us));
+            advance();
+          }
+        });
+      }
+      return true;
+    #else
+      std::cerr << "Flush instruction fixed at compile time, buffered epochs need the runtime backend" << std::endl;
+      return false;
+    #endif
+  }
+
+  // Stops the flusher, makes the last epoch durable and restores the flush
+  // backend. Must be called after worker threads stopped.
+  inline void stop() {
+    #ifdef PWB_IS_RUNTIME
+      if(!active) return;
+      stop_requested = true;
+      if(flusher.joinable()) flusher.join();
+      advance();
+      operation_hooks = nullptr;
+      active = false;
+      pwb_fn = real_pwb;
+      pfence_fn = real_pfence;
+    #endif
+  }
+
+  inline void print_stats(long long num_ops) {
+    uint64_t epochs = epochs_completed;
+    std::cout << "\tEpochs completed = " << epochs << std::endl;
+    if(epochs == 0) return;
+    std::cout << "\tBackground flushes per epoch = " << (double) lines_flushed / epochs << std::endl;
+    if(num_ops > 0)
+      std::cout << "\tBackground flushes per operation = " << (double) lines_flushed / num_ops << std::endl;
+    if(overflow_flushes)
+      std::cout << "\tDirty buffer overflow flushes = " << overflow_flushes << std::endl;
+    std::cout << "\tRecovery point lag: avg = " << total_lag_ns / epochs / 1000.0 << "us, max = "
+              << max_lag_ns / 1000.0 << "us" << std::endl;
+  }
+}
+
+#endif /* BUFFERED_EPOCHS_HPP_ */
@@ -0,0 +1,196 @@
+#ifndef DETECTABLE_HPP_
+#define DETECTABLE_HPP_
+
+#include <atomic>
+#include <assert.h>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include "persist.hpp"
+#include <common/ssmem_pool.h>
+
+// Detectable execution for durable sets (opt-in with -DDETECTABLE_OPS).
+//
+// Durable linearizability alone does not tell a client whether an update that
+// was in flight at a crash took effect. With detectable execution every thread
+// owns a persistent operation record. An update first announces itself there
+// (op id, type, key, PENDING) and later stores its result. Nodes remember the
+// operation that inserted them (creator) and the one that removed them
+// (deleter, decided by a CAS before the node is marked). Together this is
+// enough to answer "did op N of thread t take effect, and what did it return"
+// after a restart:
+//  - a record that holds a result answers directly
+//  - a PENDING add took effect iff a node with that creator is in the set
+//  - a PENDING remove took effect iff a node with that deleter is in the set
+// To keep the last two rules valid, a node is never unlinked before the
+// records of its creator and deleter have been completed (complete_ops() in
+// the list), so evidence only disappears after the answer is in the record.
+// A PENDING operation without evidence had no effect and can be re-executed.
+//
+// Only the most recent operation of each thread can be queried. Reads are not
+// recorded, they can always be re-executed. The records of threads that
+// exited are reused by new threads, at most MAX_THREADS threads run at once.
+//
+// The records live in the ssmem pool under the root "detectable", so a
+// process that reopens the pool finds them as they were at the crash. Without
+// an open pool they are on the heap and only useful within the process.
+//
+// Typical use:
+//   uint64_t id = detectable::next_op_id();   // remember id (e.g. in a log)
+//   set.add(k, v);
+//   ... after restart:
+//   detectable::op_status s = detectable::recover_op(set, tid, id);
+
+namespace detectable {
+
+  const int MAX_THREADS = 512;
+
+  enum op_type_t : int { NONE, ADD, REMOVE };
+
+  enum op_status { UNKNOWN,          // not the latest operation of the thread
+                   NO_EFFECT,        // was in flight and had no effect
+                   RETURNED_FALSE,
+                   RETURNED_TRUE };
+
+  // An operation is identified by a tag: thread id in the top 16 bits and
+  // the per-thread op id in the low 48 bits. 0 means no operation.
+  typedef uint64_t tag_t;
+  const int OP_ID_BITS = 48;
+  const uint64_t OP_ID_MASK = (1ull << OP_ID_BITS) - 1;
+
+  inline tag_t make_tag(int tid, uint64_t op_id) { return (((uint64_t) tid) << OP_ID_BITS) | op_id; }
+  inline int tag_thread(tag_t tag) { return tag >> OP_ID_BITS; }
+  inline uint64_t tag_op_id(tag_t tag) { return tag & OP_ID_MASK; }
+
+  // state is (op id << 2) | status, so an operation is completed with a single
+  // CAS that also checks that the record still belongs to it
+  enum record_status_t : uint64_t { PENDING = 1, DONE_FALSE = 2, DONE_TRUE = 3 };
+
+  struct alignas(64) op_record {
+    std::atomic<uint64_t> state;
+    op_type_t type;
+    int key;
+  };
+
+  struct op_record_table {
+    op_record records[MAX_THREADS];
+  };
+
+  std::atomic<op_record_table*> table(nullptr);
+  std::mutex table_lock;
+  // claims of the records by the threads of this process, all free at start
+  std::atomic<uint64_t> records_used[MAX_THREADS / 64];
+
+  // Finds the records in the pool, or creates them zeroed in the pool (or on
+  // the heap if no pool is open) on first use
+  inline op_record& record(int t) {
+    op_record_table* tab = table.load(std::memory_order_acquire);
+    if(tab == nullptr) {
+      std::lock_guard<std::mutex> lock(table_lock);
+      tab = table.load();
+      if(tab == nullptr) {
+        tab = ssmem_pool_is_open() ? ssmem_pool_root<op_record_table>("detectable") : new op_record_table();
+        table.store(tab, std::memory_order_release);
+      }
+    }
+    return tab->records[t];
+  }
+
+  thread_local uint64_t last_op_id = 0;
+  // operation the calling thread is executing, 0 outside of updates
+  thread_local tag_t current = 0;
+
+  // Claims the free record with the lowest index. Op ids continue where the
+  // previous owner of the record stopped, so the tags of the new owner never
+  // match the creator or deleter of a node left by the old one.
+  inline int acquire_record() {
+    for(int w = 0; w < MAX_THREADS / 64; w++) {
+      uint64_t used = records_used[w].load();
+      while(~used != 0) {
+        int b = __builtin_ctzll(~used);
+        if(records_used[w].compare_exchange_weak(used, used | (1ull << b))) {
+          int t = w * 64 + b;
+          last_op_id = record(t).state.load() >> 2;
+          return t;
+        }
+      }
+    }
+    fprintf(stderr, "[DETECTABLE] more than %d threads\n", MAX_THREADS);
+    abort();
+  }
+
+  inline void release_record(int t) {
+    records_used[t / 64].fetch_and(~(1ull << (t % 64)));
+  }
+
+  // The record of a thread goes back to the others when the thread exits
+  struct thread_record {
+    int tid = -1;
+    ~thread_record() { if(tid >= 0) release_record(tid); }
+  };
+  thread_local thread_record self;
+
+  inline int thread_id() {
+    if(self.tid < 0) self.tid = acquire_record();
+    return self.tid;
+  }
+
+  // Id that the next update of the calling thread will get
+  inline uint64_t next_op_id() { return last_op_id+1; }
+
+  inline tag_t current_op() { return current; }
+
+  // Announces an update, durable on return
+  inline tag_t begin(op_type_t type, int key) {
+    op_record& rec = record(thread_id());
+    uint64_t op_id = ++last_op_id;
+    rec.type = type;
+    rec.key = key;
+    rec.state.store((op_id << 2) | PENDING, std::memory_order_release);
+    FLUSH(&rec);
+    FENCE();
+    current = make_tag(self.tid, op_id);
+    return current;
+  }
+
+  // Stores the result of the operation tag if its record still holds it.
+  // Any thread may call this, e.g. before unlinking a node. Flushes but does
+  // not fence.
+  inline void complete(tag_t tag, bool result) {
+    if(tag == 0) return;
+    op_record& rec = record(tag_thread(tag));
+    uint64_t pending = (tag_op_id(tag) << 2) | PENDING;
+    if(rec.state.load() != pending) return;
+    if(rec.state.compare_exchange_strong(pending, (tag_op_id(tag) << 2) | (result ? DONE_TRUE : DONE_FALSE)))
+      FLUSH(&rec);
+  }
+
+  // Called by the owner when the update returns
+  inline bool end(tag_t tag, bool result) {
+    complete(tag, result);
+    current = 0;
+    return result;
+  }
+
+  // Answers whether op_id of thread t took effect. Must run in a quiescent
+  // state (e.g. after restart, before new operations start). SET must
+  // provide bool detectable_effect(tag_t tag, op_type_t type, int key).
+  template<typename SET>
+  op_status recover_op(SET& set, int t, uint64_t op_id) {
+    op_record& rec = record(t);
+    uint64_t state = rec.state.load();
+    if((state >> 2) != op_id) return UNKNOWN;
+    switch(state & 3) {
+      case DONE_TRUE: return RETURNED_TRUE;
+      case DONE_FALSE: return RETURNED_FALSE;
+      default: break;
+    }
+    tag_t tag = make_tag(t, op_id);
+    if(!set.detectable_effect(tag, rec.type, rec.key)) return NO_EFFECT;
+    complete(tag, true);
+    FENCE();
+    return RETURNED_TRUE;
+  }
+}
+
+#endif /* DETECTABLE_HPP_ */
@@ -3,6 +3,7 @@
 #define LINK_AND_PERSIST_HPP_
 
 #include <atomic>
+#include <type_traits>
 #include "persist.hpp"
 
 // TODO: double check this implementation is correct
@@ -18,6 +19,17 @@ using TO_UINT_T =
     >::type
   >::type;
 
+// Adding to a pointer moves it by whole objects, so for objects aligned past
+// the free bit the result never has that bit set
+template <typename T, int free_bit>
+struct keeps_free_bit : std::false_type {};
+
+template <typename T, int free_bit>
+struct keeps_free_bit<T*, free_bit> : std::integral_constant<bool, (alignof(T) > (1ull << free_bit))> {};
+
+template <int free_bit>
+struct keeps_free_bit<void*, free_bit> : std::false_type {};
+
 // For non-atomic types, use the same implementation as persist<T>
 // ignores free_bit
 template<typename T, int free_bit, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
@@ -53,7 +65,7 @@ struct link_and_persist<std::atomic<T>, free_bit, DEFAULT_FLUSH_OPTION> {
     link_and_persist& operator=(const link_and_persist&) = delete;
     link_and_persist& operator=(const link_and_persist&) volatile = delete;
   
-    link_and_persist(T initial, bool flush = DEFAULT_FLUSH_OPTION) noexcept { store_non_atomic(initial, flush); };
+    link_and_persist(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
 
     operator T() noexcept { return load(); }
 
@@ -70,7 +82,8 @@ struct link_and_persist<std::atomic<T>, free_bit, DEFAULT_FLUSH_OPTION> {
       return reinterpret_cast<T>(clear_flush_bit(val.load(std::memory_order_relaxed))); 
     }
 
-    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION) {
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
       val.store(set_flush_bit(reinterpret_cast<UINT_T>(newVal)), std::memory_order_relaxed);
       if (flush == flush_option::flush)
         FLUSH(&val);      
@@ -81,11 +94,13 @@ struct link_and_persist<std::atomic<T>, free_bit, DEFAULT_FLUSH_OPTION> {
     // The original algorithm was only proposed to be used with CAS.
     // Flush is called regardless of flush_option because the value being overwritten might not have been flushed.
     void store(T newVal, std::memory_order order = std::memory_order_seq_cst, 
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       UINT_T newV = reinterpret_cast<UINT_T>(newVal);
       val.store(newV, std::memory_order_seq_cst);
       // if (flush == flush_option::flush) {
-      FLUSH(&val);
+      FLUSH_NOW(&val);
       val.compare_exchange_strong(newV, set_flush_bit(newV));
       // }
     }
@@ -94,7 +109,8 @@ struct link_and_persist<std::atomic<T>, free_bit, DEFAULT_FLUSH_OPTION> {
     // Izrealivitz could assume this because of his notion of 
     // race freedom.
     T load(std::memory_order order = std::memory_order_seq_cst, 
-           bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
       UINT_T current = val.load(order);
       if (flush == flush_option::flush) {
         if(!check_flush_bit(current)) {
@@ -108,11 +124,13 @@ struct link_and_persist<std::atomic<T>, free_bit, DEFAULT_FLUSH_OPTION> {
 
     T exchange(T newVal, 
                std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       UINT_T newV = reinterpret_cast<UINT_T>(newVal);
       UINT_T current = val.exchange(newV, std::memory_order_seq_cst);
       if (flush == flush_option::flush) {
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         val.compare_exchange_strong(newV, set_flush_bit(newV));
       }
       return reinterpret_cast<T>(clear_flush_bit(current));
@@ -120,38 +138,87 @@ struct link_and_persist<std::atomic<T>, free_bit, DEFAULT_FLUSH_OPTION> {
 
     bool compare_exchange_strong(T& oldVal, T newVal,
                 std::memory_order order = std::memory_order_seq_cst, 
-                bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         UINT_T current = val.load(order);
         // TODO: This while loop can maybe be avoided
         while(clear_flush_bit(current) == reinterpret_cast<UINT_T>(oldVal)) {
           if(val.compare_exchange_strong(current, reinterpret_cast<UINT_T>(newVal), order)) {
-            FLUSH(&val);
+            FLUSH_NOW(&val);
             UINT_T newV = reinterpret_cast<UINT_T>(newVal);
             val.compare_exchange_strong(newV, set_flush_bit(newV));
-            return true;
+            return count_cas(true);
           }
         }
         oldVal = reinterpret_cast<T>(clear_flush_bit(current));
         if(!check_flush_bit(current)) {
-          FLUSH(&val);
+          FLUSH_NOW(&val);
           val.compare_exchange_strong(current, set_flush_bit(current));
         }
-        return false; 
+        return count_cas(false); 
       } else {
         UINT_T current = val.load(order);
         // TODO: This while loop can maybe be avoided
         while(clear_flush_bit(current) == reinterpret_cast<UINT_T>(oldVal)) {
           if(val.compare_exchange_strong(current, reinterpret_cast<UINT_T>(newVal), order)) {
-            return true;
+            return count_cas(true);
           }
         }
         oldVal = reinterpret_cast<T>(clear_flush_bit(current));
-        return false; 
+        return count_cas(false); 
       }
     }
 
-    void flush_if_needed() noexcept {
+    // The flush bit lives inside val, so the RMW primitives are implemented
+    // with a CAS loop that follows the same protocol as compare_exchange_strong.
+    template<typename RMW>
+    T cas_loop_rmw(RMW rmw, std::memory_order order, bool flush) noexcept {
+      drain_pending_flushes();
+      UINT_T current = val.load(order);
+      while(true) {
+        T oldVal = reinterpret_cast<T>(clear_flush_bit(current));
+        UINT_T newV = reinterpret_cast<UINT_T>(rmw(oldVal));
+        if(val.compare_exchange_weak(current, newV, order)) {
+          if (flush == flush_option::flush) {
+            FLUSH_NOW(&val);
+            val.compare_exchange_strong(newV, set_flush_bit(newV));
+          }
+          return oldVal;
+        }
+      }
+    }
+
+    // Only for pointers whose result cannot reach the flush bit
+    // (keeps_free_bit). There is no fetch_or or fetch_and: their result
+    // depends on the operand, which may have the flush bit set.
+    template<typename ARG, typename U = T,
+             typename = typename std::enable_if<keeps_free_bit<U, free_bit>::value>::type>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return cas_loop_rmw([&] (T v) { return v + arg; }, order, flush);
+    }
+
+    template<typename ARG, typename U = T,
+             typename = typename std::enable_if<keeps_free_bit<U, free_bit>::value>::type>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return cas_loop_rmw([&] (T v) { return v - arg; }, order, flush);
+    }
+
+    // A strong CAS is a valid weak CAS
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst, 
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return compare_exchange_strong(oldVal, newVal, order, flush);
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
       UINT_T current = val.load(std::memory_order_relaxed);
       // I think the previous load can use relaxed memory order because
       // flushes are not ordered until the next fence anyways.
@@ -0,0 +1,185 @@
+
+#ifndef NUMA_UTILS_HPP_
+#define NUMA_UTILS_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Minimal NUMA helpers. These use the raw system calls so that the library
+// does not depend on libnuma. On kernels or containers without NUMA support
+// everything behaves as a single node.
+
+namespace numa {
+
+  const int MAX_NODES = 64;
+
+  // MPOL_* values from <numaif.h>
+  const int MPOL_PREFERRED = 1;
+  const int MPOL_F_NODE = 1 << 0;
+  const int MPOL_F_ADDR = 1 << 1;
+
+  // Parses a sysfs list such as "0-3,8-11" and calls f on every entry
+  template<typename F>
+  inline bool for_each_in_list(const std::string& path, F f) {
+    FILE* file = fopen(path.c_str(), "r");
+    if(file == nullptr) return false;
+    char buf[4096];
+    bool ok = (fgets(buf, sizeof(buf), file) != nullptr);
+    fclose(file);
+    if(!ok) return false;
+    char* p = buf;
+    while(*p >= '0' && *p <= '9') {
+      int lo = strtol(p, &p, 10), hi = lo;
+      if(*p == '-') hi = strtol(p+1, &p, 10);
+      for(int i = lo; i <= hi; i++) f(i);
+      if(*p == ',') p++;
+    }
+    return true;
+  }
+
+  inline int compute_num_nodes() {
+    int max_node = 0;
+    for_each_in_list("/sys/devices/system/node/online", [&](int n) { max_node = std::max(max_node, n); });
+    return std::min(max_node+1, MAX_NODES);
+  }
+
+  inline int num_nodes() {
+    static int nodes = compute_num_nodes();
+    return nodes;
+  }
+
+  // Node of the physical page backing addr, or -1 if unknown
+  inline int node_of_address(const void* addr) {
+    int node = -1;
+    if(syscall(SYS_get_mempolicy, &node, nullptr, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+      return -1;
+    return (node >= 0 && node < num_nodes()) ? node : -1;
+  }
+
+  // Node of the CPU the calling thread is running on
+  inline int current_node() {
+    unsigned cpu = 0, node = 0;
+    if(syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+    return (int) node < num_nodes() ? node : 0;
+  }
+
+  // Anonymous mapping whose pages are preferably placed on node.
+  // The memory is zeroed.
+  inline void* alloc_on_node(size_t size, int node) {
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED) return nullptr;
+    unsigned long mask = 1ul << node;
+    // best effort, the memory is still usable if this fails
+    syscall(SYS_mbind, p, size, MPOL_PREFERRED, &mask, sizeof(mask)*8, 0);
+    return p;
+  }
+
+  // Places the pages of [addr, addr+size) that are not touched yet preferably
+  // on node. Best effort, like alloc_on_node().
+  inline void prefer_node(void* addr, size_t size, int node) {
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t begin = ((uint64_t) addr + page - 1) / page * page;
+    uint64_t end = ((uint64_t) addr + size) / page * page;
+    if(end <= begin) return;
+    unsigned long mask = 1ul << node;
+    syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED, &mask, sizeof(mask)*8, 0);
+  }
+
+  // Restricts the calling thread to the CPUs of node
+  inline bool pin_thread_to_node(int node) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    bool found = false;
+    for_each_in_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist",
+                     [&](int cpu) { CPU_SET(cpu, &set); found = true; });
+    if(!found) return false;
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+  }
+
+  // Stable map from 2MB regions of the address space to NUMA nodes.
+  // The first lookup of a region asks the kernel where its page lives and
+  // publishes the answer with a CAS; afterwards the answer never changes, even
+  // if the page migrates, so every thread agrees on the node of an address.
+  const int LOG_REGION_SIZE = 21;
+  const int LOG_ADDRESS_SPACE = 47;
+  const uint64_t NUM_REGIONS = 1ull << (LOG_ADDRESS_SPACE - LOG_REGION_SIZE);
+
+  // node+1 for known regions, 0 for unknown. The table (64MB of address
+  // space) is mapped on first use without reserving swap, so it only costs
+  // memory for the regions that are looked up, and nothing at all in programs
+  // that never look up a region. One table per program (inline variable).
+  inline std::atomic<std::atomic<uint8_t>*> region_table(nullptr);
+
+  inline std::atomic<uint8_t>* region_nodes() {
+    std::atomic<uint8_t>* table = region_table.load(std::memory_order_acquire);
+    if(table != nullptr) return table;
+    void* p = mmap(nullptr, NUM_REGIONS, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(p == MAP_FAILED) {
+      perror("[NUMA] region table");
+      abort();
+    }
+    if(region_table.compare_exchange_strong(table, (std::atomic<uint8_t>*) p)) return (std::atomic<uint8_t>*) p;
+    munmap(p, NUM_REGIONS);
+    return table;
+  }
+
+  inline uint64_t region_of(const void* addr) {
+    return (((uint64_t) addr) >> LOG_REGION_SIZE) & (NUM_REGIONS-1);
+  }
+
+  inline int region_node(const void* addr) {
+    if(num_nodes() == 1) return 0;
+    std::atomic<uint8_t>& entry = region_nodes()[region_of(addr)];
+    uint8_t n = entry.load(std::memory_order_relaxed);
+    if(n != 0) return n-1;
+    int node = node_of_address(addr);
+    if(node < 0) node = current_node();
+    uint8_t expected = 0;
+    if(entry.compare_exchange_strong(expected, node+1)) return node;
+    return expected-1;
+  }
+
+  // Records node for the regions that lie entirely in [addr, addr+size) and
+  // are not known yet. For memory placed on a node before it is used, such as
+  // the chunks of an allocator, so that the map does not have to ask the kernel.
+  inline void record_region_nodes(const void* addr, size_t size, int node) {
+    uint64_t first = ((uint64_t) addr + (1ull << LOG_REGION_SIZE) - 1) >> LOG_REGION_SIZE;
+    uint64_t last = ((uint64_t) addr + size) >> LOG_REGION_SIZE;
+    std::atomic<uint8_t>* table = region_nodes();
+    for(uint64_t r = first; r < last; r++) {
+      uint8_t expected = 0;
+      table[r & (NUM_REGIONS-1)].compare_exchange_strong(expected, node+1);
+    }
+  }
+
+  // Forgets the regions that lie entirely in [addr, addr+size), for memory
+  // recorded with record_region_nodes() that is given back to the system:
+  // the range may come back on another node.
+  inline void clear_region_nodes(const void* addr, size_t size) {
+    std::atomic<uint8_t>* table = region_table.load(std::memory_order_acquire);
+    if(table == nullptr) return;
+    uint64_t first = ((uint64_t) addr + (1ull << LOG_REGION_SIZE) - 1) >> LOG_REGION_SIZE;
+    uint64_t last = ((uint64_t) addr + size) >> LOG_REGION_SIZE;
+    for(uint64_t r = first; r < last; r++)
+      table[r & (NUM_REGIONS-1)].store(0, std::memory_order_relaxed);
+  }
+
+  // Node recorded for the region of addr, -1 if the region is not known.
+  // Unlike region_node() this never asks the kernel.
+  inline int recorded_region_node(const void* addr) {
+    std::atomic<uint8_t>* table = region_table.load(std::memory_order_acquire);
+    if(table == nullptr) return -1;
+    return table[region_of(addr)].load(std::memory_order_relaxed) - 1;
+  }
+}
+
+#endif /* NUMA_UTILS_HPP_ */
@@ -7,9 +7,52 @@
 #include "pmem_utils.hpp"
 
 class OperationLifetime {
+  #ifdef PMEM_PROFILE
+    // the closing fence is charged to the line that opened the operation
+    const char* site_file;
+    int site_line;
+  #endif
+  // hooks installed when the operation started (operation_hooks)
+  const operation_hooks_t* hooks;
+
   public:
-    OperationLifetime() noexcept {};
-    ~OperationLifetime() noexcept { FENCE(); };
+  #ifdef PMEM_PROFILE
+    OperationLifetime(PMEM_SITE) noexcept : site_file(site_file), site_line(site_line),
+        hooks(operation_hooks) {
+      if(hooks) hooks->begin();
+    };
+    ~OperationLifetime() noexcept {
+      PMEM_SITE_SCOPE;
+      FENCE_IF_FLUSHED();
+      pmem_profile_end_operation();
+      if(hooks) hooks->end();
+    };
+  #else
+    OperationLifetime() noexcept : hooks(operation_hooks) {
+      if(hooks) hooks->begin();
+    };
+    ~OperationLifetime() noexcept {
+      FENCE_IF_FLUSHED();
+      if(hooks) hooks->end();
+    };
+  #endif
+};
+
+// OperationLifetime for data structures that skip it for some policies
+// (persist_interface). Declare it in the scope of the operation.
+template<bool ENABLED>
+struct OptionalOperationLifetime : public OperationLifetime {
+  #ifdef PMEM_PROFILE
+    OptionalOperationLifetime(PMEM_SITE) noexcept : OperationLifetime(site_file, site_line) {};
+  #endif
+};
+
+template<>
+struct OptionalOperationLifetime<false> {
+  #ifdef PMEM_PROFILE
+    OptionalOperationLifetime(PMEM_SITE) noexcept {};
+  #endif
+  ~OptionalOperationLifetime() noexcept {};
 };
 
 namespace flush_option { 
@@ -29,7 +72,7 @@ struct persist {
     persist& operator=(const persist&) = delete;
     persist& operator=(const persist&) volatile = delete;
   
-    persist(const T& initial, bool flush = DEFAULT_FLUSH_OPTION) noexcept { store(initial, flush); };
+    persist(const T& initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store(initial, flush); };
 
     operator T() const noexcept { return val; }
 
@@ -40,7 +83,8 @@ struct persist {
 
     T load(bool flush = DEFAULT_FLUSH_OPTION) const noexcept { return val; }
 
-    void store(const T& newVal, bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+    void store(const T& newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
       val = newVal;
       if (flush == flush_option::flush) 
         FLUSH(&val);
@@ -59,7 +103,7 @@ struct persist<T*, DEFAULT_FLUSH_OPTION> {
     persist& operator=(const persist&) = delete;
     persist& operator=(const persist&) volatile = delete;
   
-    persist(T* initial, bool flush = DEFAULT_FLUSH_OPTION) noexcept { store(initial, flush); };
+    persist(T* initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store(initial, flush); };
 
     operator T*() const noexcept { return val; }
     T* operator->() const { return val; }
@@ -71,7 +115,8 @@ struct persist<T*, DEFAULT_FLUSH_OPTION> {
 
     T* load(bool flush = DEFAULT_FLUSH_OPTION) const noexcept { return val; }
 
-    void store(T* newVal, bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+    void store(T* newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
       val = newVal;
       if (flush == flush_option::flush) 
         FLUSH(&val);
@@ -91,7 +136,7 @@ struct persist<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
     persist& operator=(const persist&) = delete;
     persist& operator=(const persist&) volatile = delete;
   
-    persist(T initial, bool flush = DEFAULT_FLUSH_OPTION) noexcept : flush_counter(0) { store_non_atomic(initial, flush); };
+    persist(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept : flush_counter(0) { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
 
     operator T() const noexcept { return load(); }
 
@@ -108,14 +153,16 @@ struct persist<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
       return val.load(std::memory_order_relaxed); 
     }
 
-    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION) {
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
       val.store(newVal, std::memory_order_relaxed);
       if (flush == flush_option::flush)
         FLUSH(&val);      
     }
 
     T load(std::memory_order order = std::memory_order_seq_cst, 
-           bool flush = DEFAULT_FLUSH_OPTION) const noexcept {
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
       T t = val.load(order);
       if (flush == flush_option::flush)
         if(flush_counter) FLUSH(&val);
@@ -124,22 +171,26 @@ struct persist<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     // TODO: see if the memory order on fetch_add can be weakened
     void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         flush_counter.fetch_add(1);
         val.store(newVal, order);
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counter.fetch_sub(1);      
       }
       else val.store(newVal, order);
     }
 
     T exchange(T newVal, std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         flush_counter.fetch_add(1);
         T t = val.exchange(newVal, order);
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counter.fetch_sub(1);
         return t;
       }
@@ -148,20 +199,73 @@ struct persist<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     bool compare_exchange_strong(T& oldVal, T newVal,
                 std::memory_order order = std::memory_order_seq_cst,
-                bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         flush_counter.fetch_add(1);
         bool b = val.compare_exchange_strong(oldVal, newVal, order, 
                                        __cmpexch_failure_order(order));
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counter.fetch_sub(1);
-        return b;
+        return count_cas(b);
       }
-      else return val.compare_exchange_strong(oldVal, newVal, order, 
-                                       __cmpexch_failure_order(order));
+      else return count_cas(val.compare_exchange_strong(oldVal, newVal, order, 
+                                       __cmpexch_failure_order(order)));
+    }
+
+    // Runs rmw() on val inside the flush marking window.
+    template<typename RMW>
+    auto marked_rmw(RMW rmw, bool flush) noexcept {
+      drain_pending_flushes();
+      if (flush == flush_option::flush) {
+        flush_counter.fetch_add(1);
+        auto t = rmw();
+        FLUSH_NOW(&val);
+        flush_counter.fetch_sub(1);
+        return t;
+      }
+      else return rmw();
+    }
+
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_add(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_sub(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_or(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_and(arg, order); }, flush);
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_weak(oldVal, newVal, order, 
+                                       __cmpexch_failure_order(order)); }, flush));
     }
 
-    void flush_if_needed() noexcept {
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
       if(flush_counter) FLUSH(&val);
     }
 
@@ -0,0 +1,259 @@
+
+#ifndef PERSIST_ADAPTIVE_HPP_
+#define PERSIST_ADAPTIVE_HPP_
+
+#include <atomic>
+#include "persist.hpp"
+#include "utils.hpp"
+#include <sstream>
+
+#ifdef PMEM_STATS
+  #define ADAPTIVE_STAT(s) adaptive_stats[s]++
+#else
+  #define ADAPTIVE_STAT(s)
+#endif
+
+// One in ADAPTIVE_SAMPLE_PERIOD operations of each thread updates the
+// activity score of the object it touched.
+const uint32_t ADAPTIVE_SAMPLE_PERIOD = 64;
+// Net number of sampled hits (or misses) needed to start a migration
+const int8_t ADAPTIVE_THRESHOLD = 8;
+
+thread_local uint32_t adaptive_sample_tick = 0;
+
+// For non-atomic types, use the same implementation as persist<T>
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+struct persist_adaptive : public persist<T, DEFAULT_FLUSH_OPTION> {};
+
+// Chooses per object between an adjacent flush counter (as in
+// persist_counter) and a counter in a shared hashed table (as in
+// persist_hash_cacheline). Objects start adjacent. Sampled operations score
+// activity: a write that finds its counter already raised or a load that has
+// to flush is a hit, anything else a miss. Hot objects move to the hashed
+// table so that counter updates stop bouncing the value's cache line, and move
+// back once they cool down.
+//
+// Migrations go through an intermediate state in which writers use the
+// destination counter and readers check both. The move completes once the
+// source counter is observed at zero: writers re-check the mode after raising
+// a counter and back off if it changed, so any writer still holding the source
+// counter entered before the migration started. If the source never drains
+// (the hashed counter is shared) the object simply stays in the intermediate
+// state, which is correct but makes loads check both counters.
+//
+// The value, adjacent counter, mode and score share the padding of an 8 byte
+// value, so the footprint is the same as persist_counter.
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION>
+struct persist_adaptive<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION> {
+  public:
+    enum mode_t : uint8_t { ADJACENT, HASHED, TO_HASHED, TO_ADJACENT };
+
+  private:
+    std::atomic<T> val;
+    mutable std::atomic<uint8_t> flush_counter;
+    mutable std::atomic<uint8_t> mode;
+    mutable std::atomic<int8_t> score;
+
+    static const uint64_t NUM_FLUSH_COUNTERS = (1ull<<LOG_NUM_FLUSH_COUNTERS);
+    static const uint64_t FLUSH_COUNTER_MASK = NUM_FLUSH_COUNTERS-1ull;
+    static std::atomic<uint8_t> flush_counters[NUM_FLUSH_COUNTERS];
+
+    std::atomic<uint8_t>& hashed_counter() const {
+      return flush_counters[utils::hash64(((uint64_t) &val) & utils::CACHE_LINE_MASK) & FLUSH_COUNTER_MASK];
+    }
+
+    // Counter used by writers in mode m
+    std::atomic<uint8_t>& writer_counter(uint8_t m) const {
+      return (m == ADJACENT || m == TO_ADJACENT) ? flush_counter : hashed_counter();
+    }
+
+    bool is_flush_needed(uint8_t m) const {
+      if(m == ADJACENT) return flush_counter;
+      if(m == HASHED) return hashed_counter();
+      return flush_counter || hashed_counter();
+    }
+
+    static bool sample() {
+      return (++adaptive_sample_tick % ADAPTIVE_SAMPLE_PERIOD) == 0;
+    }
+
+    void adapt(uint8_t m, bool hit) const {
+      if(m == TO_HASHED || m == TO_ADJACENT) {
+        std::atomic<uint8_t>& source = (m == TO_HASHED) ? flush_counter : hashed_counter();
+        if(source == 0 && mode.compare_exchange_strong(m, m == TO_HASHED ? HASHED : ADJACENT)) {
+          ADAPTIVE_STAT(m == TO_HASHED ? ADAPTIVE_TO_HASHED : ADAPTIVE_TO_ADJACENT);
+        }
+        return;
+      }
+      int8_t s = score.load(std::memory_order_relaxed);
+      s = hit ? std::min<int8_t>(s+1, ADAPTIVE_THRESHOLD) : std::max<int8_t>(s-1, -ADAPTIVE_THRESHOLD);
+      score.store(s, std::memory_order_relaxed);
+      if(m == ADJACENT && s == ADAPTIVE_THRESHOLD) start_migration(m, TO_HASHED);
+      else if(m == HASHED && s == -ADAPTIVE_THRESHOLD) start_migration(m, TO_ADJACENT);
+    }
+
+    void start_migration(uint8_t m, uint8_t to) const {
+      if(mode.compare_exchange_strong(m, to)) {
+        score.store(0, std::memory_order_relaxed);
+        adapt(to, false);
+      }
+    }
+
+  public:
+    persist_adaptive() noexcept : val(), flush_counter(0), mode(ADJACENT), score(0) {};
+    ~persist_adaptive() noexcept = default;
+    persist_adaptive(const persist_adaptive&) = delete;
+    persist_adaptive& operator=(const persist_adaptive&) = delete;
+    persist_adaptive& operator=(const persist_adaptive&) volatile = delete;
+
+    persist_adaptive(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept :
+        flush_counter(0), mode(ADJACENT), score(0) { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
+
+    operator T() const noexcept { return load(); }
+
+    T operator=(T newVal) noexcept {
+      store(newVal);
+      return newVal;
+    }
+
+    bool is_lock_free() const noexcept {
+      return val.is_lock_free();
+    }
+
+    void load_non_atomic(bool flush = DEFAULT_FLUSH_OPTION) {
+      return val.load(std::memory_order_relaxed);
+    }
+
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
+      val.store(newVal, std::memory_order_relaxed);
+      if (flush == flush_option::flush)
+        FLUSH(&val);
+    }
+
+    T load(std::memory_order order = std::memory_order_seq_cst,
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
+      T t = val.load(order);
+      if (flush == flush_option::flush) {
+        uint8_t m = mode.load();
+        bool needed = is_flush_needed(m);
+        if(needed) {
+          FLUSH(&val);
+          ADAPTIVE_STAT(m == ADJACENT ? ADAPTIVE_ADJACENT_LOAD_FLUSHES : ADAPTIVE_HASHED_LOAD_FLUSHES);
+        }
+        if(sample()) adapt(m, needed);
+      }
+      return t;
+    }
+
+    // Runs rmw() on val inside the flush marking window.
+    template<typename RMW>
+    auto marked_rmw(RMW rmw, bool flush) noexcept {
+      drain_pending_flushes();
+      if (flush == flush_option::flush) {
+        uint8_t m;
+        uint8_t prev;
+        while(true) {
+          m = mode.load();
+          prev = writer_counter(m).fetch_add(1);
+          if(mode.load() == m) break;
+          writer_counter(m).fetch_sub(1);
+        }
+        auto t = rmw();
+        FLUSH_NOW(&val);
+        writer_counter(m).fetch_sub(1);
+        ADAPTIVE_STAT((m == ADJACENT || m == TO_ADJACENT) ? ADAPTIVE_ADJACENT_WRITES : ADAPTIVE_HASHED_WRITES);
+        if(sample()) adapt(m, prev > 0);
+        return t;
+      }
+      else return rmw();
+    }
+
+    void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      marked_rmw([&] { val.store(newVal, order); return true; }, flush);
+    }
+
+    T exchange(T newVal, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.exchange(newVal, order); }, flush);
+    }
+
+    bool compare_exchange_strong(T& oldVal, T newVal,
+              std::memory_order order = std::memory_order_seq_cst,
+              bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_strong(oldVal, newVal, order,
+                                       __cmpexch_failure_order(order)); }, flush));
+    }
+
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_add(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_sub(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_or(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_and(arg, order); }, flush);
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_weak(oldVal, newVal, order,
+                                       __cmpexch_failure_order(order)); }, flush));
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
+      if(is_flush_needed(mode.load())) FLUSH(&val);
+    }
+
+    bool is_flush_needed() noexcept {
+      return is_flush_needed(mode.load());
+    }
+
+    // Current counter placement (a mode_t)
+    uint8_t get_mode() const noexcept {
+      return mode.load();
+    }
+
+    static std::string get_name() {
+      std::stringstream ss;
+      ss << "persist_adaptive_" << LOG_NUM_FLUSH_COUNTERS;
+      return ss.str();
+    }
+};
+
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION>
+std::atomic<uint8_t> persist_adaptive<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION>::flush_counters[persist_adaptive<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION>::NUM_FLUSH_COUNTERS];
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_adaptive_16 = persist_adaptive<T, 16, DEFAULT_FLUSH_OPTION>;
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_adaptive_20 = persist_adaptive<T, 20, DEFAULT_FLUSH_OPTION>;
+
+#endif /* PERSIST_ADAPTIVE_HPP_ */
@@ -0,0 +1,162 @@
+
+#ifndef PERSIST_BUFFERED_HPP_
+#define PERSIST_BUFFERED_HPP_
+
+/* persist_buffered<atomic<T>> trades the durability of the most recent
+   updates for throughput (buffered durable linearizability). Writes mark
+   their cache line dirty instead of flushing it and loads never flush: with
+   buffered_epochs running, FLUSH() only records the line in the current
+   epoch and a background thread writes back every epoch in bulk once no
+   operation of it is still running. Not crash consistent: lines of epochs
+   after the last durable boundary can be evicted to memory and are not
+   rolled back (see buffered_epochs.hpp). Start the epochs with
+   buffered_epochs::start() before the worker threads and stop them with
+   buffered_epochs::stop(); without them the writes are flushed directly. */
+
+#include <atomic>
+#include "persist.hpp"
+#include "buffered_epochs.hpp"
+
+// For non-atomic types, use the same implementation as persist<T>
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+struct persist_buffered : public persist<T, DEFAULT_FLUSH_OPTION> {};
+
+template<typename T, bool DEFAULT_FLUSH_OPTION>
+struct persist_buffered<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
+  private:
+    std::atomic<T> val;
+
+    void mark_dirty(bool flush PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      if (flush == flush_option::flush)
+        FLUSH(&val);
+    }
+
+  public:
+    persist_buffered() noexcept = default;
+    ~persist_buffered() noexcept = default;
+    persist_buffered(const persist_buffered&) = delete;
+    persist_buffered& operator=(const persist_buffered&) = delete;
+    persist_buffered& operator=(const persist_buffered&) volatile = delete;
+  
+    persist_buffered(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
+
+    operator T() const noexcept { return load(); }
+
+    T operator=(T newVal) noexcept { 
+      store(newVal); 
+      return newVal; 
+    }
+
+    bool is_lock_free() const noexcept {
+      return val.is_lock_free();
+    }
+
+    T load_non_atomic(bool flush = DEFAULT_FLUSH_OPTION) { 
+      return val.load(std::memory_order_relaxed); 
+    }
+
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
+      val.store(newVal, std::memory_order_relaxed);
+      mark_dirty(flush);
+    }
+
+    void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      val.store(newVal, order);
+      mark_dirty(flush);
+    }
+
+    // Updates of the same epoch persist together, so a load never has to
+    // write back what it read
+    T load(std::memory_order order = std::memory_order_seq_cst, 
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
+      return val.load(order);
+    }
+
+    T exchange(T newVal, 
+               std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      T t = val.exchange(newVal, order);
+      mark_dirty(flush);
+      return t;
+    }
+
+    bool compare_exchange_strong(T& oldVal, T newVal,
+                 std::memory_order order = std::memory_order_seq_cst,
+                 bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      bool success = val.compare_exchange_strong(oldVal, newVal, order, __cmpexch_failure_order(order));
+      if(success) mark_dirty(flush);
+      return count_cas(success);
+    }
+
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      T t = val.fetch_add(arg, order);
+      mark_dirty(flush);
+      return t;
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      T t = val.fetch_sub(arg, order);
+      mark_dirty(flush);
+      return t;
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      T t = val.fetch_or(arg, order);
+      mark_dirty(flush);
+      return t;
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      T t = val.fetch_and(arg, order);
+      mark_dirty(flush);
+      return t;
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                 std::memory_order order = std::memory_order_seq_cst,
+                 bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      bool success = val.compare_exchange_weak(oldVal, newVal, order, __cmpexch_failure_order(order));
+      if(success) mark_dirty(flush);
+      return count_cas(success);
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept { PMEM_SITE_SCOPE;}
+
+    bool is_flush_needed() noexcept {
+      return false;
+    }
+
+    static std::string get_name() {
+      return "persist_buffered";
+    }
+};
+
+#endif /* PERSIST_BUFFERED_HPP_ */
@@ -4,25 +4,30 @@
 
 #include <atomic>
 #include "persist.hpp"
+#include <sstream>
 
 // For non-atomic types, use the same implementation as persist<T>
-template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
-struct persist_counter : public persist<T, DEFAULT_FLUSH_OPTION> {};
-
-template<typename T, bool DEFAULT_FLUSH_OPTION>
-struct persist_counter<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
+template<typename T, typename COUNTER_T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+struct persist_counter_width : public persist<T, DEFAULT_FLUSH_OPTION> {};
+
+// COUNTER_T is the flush counter type. An 8-bit counter wraps to zero once 256
+// writers are in their marking window at the same time, which would let a 
+// reader skip a needed flush. The counter sits in the padding after val, so a 
+// 16 or 32-bit counter costs no space for 4 and 8 byte values.
+template<typename T, typename COUNTER_T, bool DEFAULT_FLUSH_OPTION>
+struct persist_counter_width<std::atomic<T>, COUNTER_T, DEFAULT_FLUSH_OPTION> {
   private:
     std::atomic<T> val;
-    std::atomic<uint8_t> flush_counter;
+    std::atomic<COUNTER_T> flush_counter;
 
   public:
-    persist_counter() noexcept : val(), flush_counter(0) {};
-    ~persist_counter() noexcept = default;
-    persist_counter(const persist_counter&) = delete;
-    persist_counter& operator=(const persist_counter&) = delete;
-    persist_counter& operator=(const persist_counter&) volatile = delete;
+    persist_counter_width() noexcept : val(), flush_counter(0) {};
+    ~persist_counter_width() noexcept = default;
+    persist_counter_width(const persist_counter_width&) = delete;
+    persist_counter_width& operator=(const persist_counter_width&) = delete;
+    persist_counter_width& operator=(const persist_counter_width&) volatile = delete;
   
-    persist_counter(T initial, bool flush = DEFAULT_FLUSH_OPTION) noexcept : flush_counter(0) { store_non_atomic(initial, flush); };
+    persist_counter_width(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept : flush_counter(0) { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
 
     operator T() const noexcept { return load(); }
 
@@ -39,14 +44,16 @@ struct persist_counter<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
       return val.load(std::memory_order_relaxed); 
     }
 
-    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION) {
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
       val.store(newVal, std::memory_order_relaxed);
       if (flush == flush_option::flush)
         FLUSH(&val);      
     }
 
     T load(std::memory_order order = std::memory_order_seq_cst, 
-           bool flush = DEFAULT_FLUSH_OPTION) const noexcept {
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
       T t = val.load(order);
       if (flush == flush_option::flush)
         if(flush_counter) FLUSH(&val);
@@ -55,22 +62,26 @@ struct persist_counter<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     // TODO: see if the memory order on fetch_add can be weakened
     void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         flush_counter.fetch_add(1);
         val.store(newVal, order);
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counter.fetch_sub(1);      
       }
       else val.store(newVal, order);
     }
 
     T exchange(T newVal, std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         flush_counter.fetch_add(1);
         T t = val.exchange(newVal, order);
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counter.fetch_sub(1);
         return t;
       }
@@ -79,20 +90,73 @@ struct persist_counter<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     bool compare_exchange_strong(T& oldVal, T newVal,
                 std::memory_order order = std::memory_order_seq_cst,
-                bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         flush_counter.fetch_add(1);
         bool b = val.compare_exchange_strong(oldVal, newVal, order, 
                                        __cmpexch_failure_order(order));
-        FLUSH(&val);      // TODO: This flush can some times be avoided on failure.
+        FLUSH_NOW(&val);      // TODO: This flush can some times be avoided on failure.
         flush_counter.fetch_sub(1);
-        return b;
+        return count_cas(b);
       }
-      else return val.compare_exchange_strong(oldVal, newVal, order, 
-                                       __cmpexch_failure_order(order));
+      else return count_cas(val.compare_exchange_strong(oldVal, newVal, order, 
+                                       __cmpexch_failure_order(order)));
     }
 
-    void flush_if_needed() noexcept {
+    // Runs rmw() on val inside the flush marking window.
+    template<typename RMW>
+    auto marked_rmw(RMW rmw, bool flush) noexcept {
+      drain_pending_flushes();
+      if (flush == flush_option::flush) {
+        flush_counter.fetch_add(1);
+        auto t = rmw();
+        FLUSH_NOW(&val);
+        flush_counter.fetch_sub(1);
+        return t;
+      }
+      else return rmw();
+    }
+
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_add(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_sub(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_or(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_and(arg, order); }, flush);
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_weak(oldVal, newVal, order, 
+                                       __cmpexch_failure_order(order)); }, flush));
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
       if(flush_counter) FLUSH(&val);
     }
 
@@ -101,8 +165,20 @@ struct persist_counter<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
     }
 
     static std::string get_name() {
-      return "persist_counter";
+      if(sizeof(COUNTER_T) == 1) return "persist_counter";
+      std::stringstream ss;
+      ss << "persist_counter_w" << 8*sizeof(COUNTER_T);
+      return ss.str();
     }
 };
 
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_counter = persist_counter_width<T, uint8_t, DEFAULT_FLUSH_OPTION>;
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_counter_w16 = persist_counter_width<T, uint16_t, DEFAULT_FLUSH_OPTION>;
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_counter_w32 = persist_counter_width<T, uint32_t, DEFAULT_FLUSH_OPTION>;
+
 #endif /* PERSIST_COUNTER_HPP_ */
\ No newline at end of file
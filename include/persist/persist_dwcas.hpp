@@ -0,0 +1,209 @@
+
+#ifndef PERSIST_DWCAS_HPP_
+#define PERSIST_DWCAS_HPP_
+
+#include <atomic>
+#include <cpuid.h>
+#include <cstring>
+#include <type_traits>
+#include "persist.hpp"
+
+// Double-width (16 byte) compare-and-swap using lock cmpxchg16b.
+// On failure, expected is updated with the current value.
+static inline bool cas16(unsigned __int128* addr, unsigned __int128& expected,
+                         unsigned __int128 desired) noexcept {
+  uint64_t exp_lo = (uint64_t) expected, exp_hi = (uint64_t) (expected >> 64);
+  bool b;
+  asm volatile("lock cmpxchg16b %1"
+               : "=@ccz"(b), "+m"(*addr), "+a"(exp_lo), "+d"(exp_hi)
+               : "b"((uint64_t) desired), "c"((uint64_t) (desired >> 64))
+               : "memory");
+  expected = ((unsigned __int128) exp_hi << 64) | exp_lo;
+  return b;
+}
+
+// Intel and AMD guarantee that aligned 16 byte SSE/AVX loads are atomic on
+// processors that support AVX (CPUID.1:ECX bit 28).
+static inline bool atomic_load16_is_supported() noexcept {
+  static const bool supported = [] {
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+    return (ecx & (1u << 28)) != 0;
+  }();
+  return supported;
+}
+
+// Atomic 16 byte load of a 16 byte aligned address. It is a plain movdqa, so
+// readers share the cache line. Only on processors without AVX it falls
+// back to cmpxchg16b, which always writes its target (without changing the
+// value) and takes the line exclusive.
+static inline unsigned __int128 load16(unsigned __int128* addr) noexcept {
+  if(__builtin_expect(atomic_load16_is_supported(), 1)) {
+    unsigned __int128 t;
+    asm volatile("movdqa %1, %%xmm0\n\t"
+                 "movdqa %%xmm0, %0"
+                 : "=m"(t) : "m"(*addr) : "xmm0", "memory");
+    return t;
+  }
+  unsigned __int128 t = 0;
+  cas16(addr, t, t);
+  return t;
+}
+
+// Pointer plus version counter for ABA-safe updates.
+template<typename T>
+struct alignas(16) tagged_ptr {
+  T* ptr;
+  uint64_t tag;
+
+  tagged_ptr() noexcept : ptr(nullptr), tag(0) {}
+  tagged_ptr(T* p, uint64_t t) noexcept : ptr(p), tag(t) {}
+
+  tagged_ptr next(T* p) const noexcept { return tagged_ptr(p, tag+1); }
+
+  bool operator==(const tagged_ptr& other) const noexcept {
+    return ptr == other.ptr && tag == other.tag;
+  }
+  bool operator!=(const tagged_ptr& other) const noexcept { return !(*this == other); }
+};
+
+// For non-atomic types, use the same implementation as persist<T>
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+struct persist_dw : public persist<T, DEFAULT_FLUSH_OPTION> {};
+
+// Flush marking for 16 byte values such as tagged_ptr. The value and its
+// flush counter share a 32 byte aligned block, so they are always in the same
+// cache line and a single flush covers both. The block has room for a 32-bit
+// counter, so it cannot wrap. Memory orders are accepted for
+// compatibility with the other variants, but every update is a locked
+// instruction and therefore sequentially consistent.
+template<typename T, bool DEFAULT_FLUSH_OPTION>
+struct alignas(32) persist_dw<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
+  static_assert(sizeof(T) == 16, "persist_dw requires a 16 byte type");
+  static_assert(std::is_trivially_copyable<T>::value, "persist_dw requires a trivially copyable type");
+
+  private:
+    unsigned __int128 val;
+    std::atomic<uint32_t> flush_counter;
+
+    static unsigned __int128 to_raw(const T& t) noexcept {
+      unsigned __int128 r;
+      std::memcpy(&r, &t, sizeof(T));
+      return r;
+    }
+
+    static T from_raw(unsigned __int128 r) noexcept {
+      T t;
+      std::memcpy(static_cast<void*>(&t), &r, sizeof(T));
+      return t;
+    }
+
+    unsigned __int128* raw() const noexcept {
+      return const_cast<unsigned __int128*>(&val);
+    }
+
+  public:
+    persist_dw() noexcept : val(0), flush_counter(0) {};
+    ~persist_dw() noexcept = default;
+    persist_dw(const persist_dw&) = delete;
+    persist_dw& operator=(const persist_dw&) = delete;
+    persist_dw& operator=(const persist_dw&) volatile = delete;
+
+    persist_dw(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept : flush_counter(0) { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
+
+    operator T() const noexcept { return load(); }
+
+    T operator=(T newVal) noexcept {
+      store(newVal);
+      return newVal;
+    }
+
+    bool is_lock_free() const noexcept {
+      return true;
+    }
+
+    T load_non_atomic(bool flush = DEFAULT_FLUSH_OPTION) const {
+      return from_raw(val);
+    }
+
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
+      val = to_raw(newVal);
+      if (flush == flush_option::flush)
+        FLUSH(&val);
+    }
+
+    T load(std::memory_order order = std::memory_order_seq_cst,
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
+      T t = from_raw(load16(raw()));
+      if (flush == flush_option::flush)
+        if(flush_counter) FLUSH(&val);
+      return t;
+    }
+
+    void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      exchange(newVal, order, flush);
+    }
+
+    T exchange(T newVal, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] {
+        unsigned __int128 old = val;
+        while(!cas16(raw(), old, to_raw(newVal)));
+        return from_raw(old);
+      }, flush);
+    }
+
+    bool compare_exchange_strong(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] {
+        unsigned __int128 old = to_raw(oldVal);
+        bool b = cas16(raw(), old, to_raw(newVal));
+        if(!b) oldVal = from_raw(old);
+        return b;
+      }, flush));
+    }
+
+    // cmpxchg16b does not fail spuriously
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return compare_exchange_strong(oldVal, newVal, order, flush);
+    }
+
+    // Runs rmw() on val inside the flush marking window.
+    template<typename RMW>
+    auto marked_rmw(RMW rmw, bool flush) noexcept {
+      drain_pending_flushes();
+      if (flush == flush_option::flush) {
+        flush_counter.fetch_add(1);
+        auto t = rmw();
+        FLUSH_NOW(&val);
+        flush_counter.fetch_sub(1);
+        return t;
+      }
+      else return rmw();
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
+      if(flush_counter) FLUSH(&val);
+    }
+
+    bool is_flush_needed() noexcept {
+      return flush_counter;
+    }
+
+    static std::string get_name() {
+      return "persist_dw";
+    }
+};
+
+#endif /* PERSIST_DWCAS_HPP_ */
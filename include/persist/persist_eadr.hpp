@@ -0,0 +1,128 @@
+
+#ifndef PERSIST_EADR_HPP_
+#define PERSIST_EADR_HPP_
+
+/* persist_eadr<atomic<T>> is for platforms whose persistence domain includes
+   the CPU caches (eADR). A store is durable as soon as it is visible, so there
+   is no flush marking: every operation is a plain atomic, and the seq_cst
+   default memory order provides the ordering. Unlike persist_interface, data
+   structures treat it as a regular persistence policy; pair it with the eADR
+   flush backend (PWB_INSTRUCTION=eadr or -DPWB_IS_EADR) so that their explicit
+   FLUSH() calls are elided too. */
+
+#include <atomic>
+#include "persist.hpp"
+
+// For non-atomic types, use the same implementation as persist<T>
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+struct persist_eadr : public persist<T, DEFAULT_FLUSH_OPTION> {};
+
+template<typename T, bool DEFAULT_FLUSH_OPTION>
+struct persist_eadr<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
+  private:
+    std::atomic<T> val;
+
+  public:
+    persist_eadr() noexcept = default;
+    ~persist_eadr() noexcept = default;
+    persist_eadr(const persist_eadr&) = delete;
+    persist_eadr& operator=(const persist_eadr&) = delete;
+    persist_eadr& operator=(const persist_eadr&) volatile = delete;
+  
+    persist_eadr(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
+
+    operator T() const noexcept { return load(); }
+
+    T operator=(T newVal) noexcept { 
+      store(newVal); 
+      return newVal; 
+    }
+
+    bool is_lock_free() const noexcept {
+      return val.is_lock_free();
+    }
+
+    T load_non_atomic(bool flush = DEFAULT_FLUSH_OPTION) { 
+      return val.load(std::memory_order_relaxed); 
+    }
+
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
+      val.store(newVal, std::memory_order_relaxed);    
+    }
+
+    void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      val.store(newVal, order);
+    }
+
+    T load(std::memory_order order = std::memory_order_seq_cst, 
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
+      return val.load(order);
+    }
+
+    T exchange(T newVal, 
+               std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return val.exchange(newVal, order);
+    }
+
+    bool compare_exchange_strong(T& oldVal, T newVal,
+                 std::memory_order order = std::memory_order_seq_cst,
+                 bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(val.compare_exchange_strong(oldVal, newVal, 
+          order, __cmpexch_failure_order(order)));
+    }
+
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return val.fetch_add(arg, order);
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return val.fetch_sub(arg, order);
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return val.fetch_or(arg, order);
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return val.fetch_and(arg, order);
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                 std::memory_order order = std::memory_order_seq_cst,
+                 bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(val.compare_exchange_weak(oldVal, newVal, 
+          order, __cmpexch_failure_order(order)));
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept { PMEM_SITE_SCOPE;}
+
+    bool is_flush_needed() noexcept {
+      return false;
+    }
+
+    static std::string get_name() {
+      return "persist_eadr";
+    }
+};
+
+#endif /* PERSIST_EADR_HPP_ */
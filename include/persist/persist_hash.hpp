@@ -5,32 +5,34 @@
 #include<atomic>
 #include "persist.hpp"
 #include "utils.hpp"
-
-// Flush marking can support fetch and add and other common atomic primitives.
+#include <string>
 
 // For non-atomic types, use the same implementation as persist<T>
-template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
-struct persist_hash : public persist<T, DEFAULT_FLUSH_OPTION> {};
-
-template<typename T, bool DEFAULT_FLUSH_OPTION>
-struct persist_hash<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
+template<typename T, typename COUNTER_T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+struct persist_hash_width : public persist<T, DEFAULT_FLUSH_OPTION> {};
+
+// COUNTER_T is the flush counter type. Every word hashed to a slot shares its
+// counter, so with many threads an 8-bit counter can wrap to zero; wider
+// counters multiply the table size by sizeof(COUNTER_T).
+template<typename T, typename COUNTER_T, bool DEFAULT_FLUSH_OPTION>
+struct persist_hash_width<std::atomic<T>, COUNTER_T, DEFAULT_FLUSH_OPTION> {
   private:
     std::atomic<T> val;
 
-    static std::atomic<uint8_t> flush_counters[utils::NUM_FLUSH_COUNTERS];
+    static std::atomic<COUNTER_T> flush_counters[utils::NUM_FLUSH_COUNTERS];
 
     static int get_index(const std::atomic<T>* ptr) {
       return utils::hash64((uint64_t) ptr) & utils::FLUSH_COUNTER_MASK;
     }
 
   public:
-    persist_hash() noexcept = default;
-    ~persist_hash() noexcept = default;
-    persist_hash(const persist_hash&) = delete;
-    persist_hash& operator=(const persist_hash&) = delete;
-    persist_hash& operator=(const persist_hash&) volatile = delete;
+    persist_hash_width() noexcept = default;
+    ~persist_hash_width() noexcept = default;
+    persist_hash_width(const persist_hash_width&) = delete;
+    persist_hash_width& operator=(const persist_hash_width&) = delete;
+    persist_hash_width& operator=(const persist_hash_width&) volatile = delete;
   
-    persist_hash(T initial, bool flush = DEFAULT_FLUSH_OPTION) noexcept { store_non_atomic(initial, flush); };
+    persist_hash_width(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
 
     operator T() const noexcept { return load(); }
 
@@ -45,27 +47,31 @@ struct persist_hash<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     void load_non_atomic(bool flush = DEFAULT_FLUSH_OPTION) { return val.load(std::memory_order_relaxed); }
 
-    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION) {
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
       val.store(newVal, std::memory_order_relaxed);
       if (flush == flush_option::flush)
         FLUSH(&val);      
     }
 
     void store(T newVal, std::memory_order order = std::memory_order_seq_cst, 
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         int flush_counter_index = get_index(&val);
         flush_counters[flush_counter_index].fetch_add(1);
         val.store(newVal, order);
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counters[flush_counter_index].fetch_sub(1);
       }
       else val.store(newVal, order);
     }
 
     T load(std::memory_order order = std::memory_order_seq_cst, 
-           bool flush = DEFAULT_FLUSH_OPTION) 
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) 
                 const noexcept {
+      PMEM_SITE_SCOPE;
       T t = val.load(order);
       if (flush == flush_option::flush)
         if(flush_counters[get_index(&val)]) FLUSH(&val);
@@ -74,12 +80,14 @@ struct persist_hash<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     T exchange(T newVal, 
                std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         int flush_counter_index = get_index(&val);
         flush_counters[flush_counter_index].fetch_add(1);
         T t = val.exchange(newVal, order);
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counters[flush_counter_index].fetch_sub(1);
         return t;
       }
@@ -88,21 +96,75 @@ struct persist_hash<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     bool compare_exchange_strong(T& oldVal, T newVal,
                   std::memory_order order = std::memory_order_seq_cst,
-                  bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+                  bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         int flush_counter_index = get_index(&val);
         flush_counters[flush_counter_index].fetch_add(1);
         bool b = val.compare_exchange_strong(oldVal, newVal, order, 
                                      __cmpexch_failure_order(order));
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counters[flush_counter_index].fetch_sub(1);
-        return b;
+        return count_cas(b);
       }
-      else return val.compare_exchange_strong(oldVal, newVal, order, 
-                                     __cmpexch_failure_order(order));
+      else return count_cas(val.compare_exchange_strong(oldVal, newVal, order, 
+                                     __cmpexch_failure_order(order)));
+    }
+
+    // Runs rmw() on val inside the flush marking window.
+    template<typename RMW>
+    auto marked_rmw(RMW rmw, bool flush) noexcept {
+      drain_pending_flushes();
+      if (flush == flush_option::flush) {
+        int flush_counter_index = get_index(&val);
+        flush_counters[flush_counter_index].fetch_add(1);
+        auto t = rmw();
+        FLUSH_NOW(&val);
+        flush_counters[flush_counter_index].fetch_sub(1);
+        return t;
+      }
+      else return rmw();
     }
 
-    void flush_if_needed() noexcept {
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_add(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_sub(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_or(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_and(arg, order); }, flush);
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_weak(oldVal, newVal, order, 
+                                       __cmpexch_failure_order(order)); }, flush));
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
       if(flush_counters[get_index(&val)]) FLUSH(&val);
     }
 
@@ -111,11 +173,21 @@ struct persist_hash<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
     }
 
     static std::string get_name() {
-      return "persist_hash";
+      if(sizeof(COUNTER_T) == 1) return "persist_hash";
+      return "persist_hash_w" + std::to_string(8*sizeof(COUNTER_T));
     }
 };
 
-template<typename T, bool DEFAULT_FLUSH_OPTION> 
-std::atomic<uint8_t> persist_hash<std::atomic<T>, DEFAULT_FLUSH_OPTION>::flush_counters[utils::NUM_FLUSH_COUNTERS];
+template<typename T, typename COUNTER_T, bool DEFAULT_FLUSH_OPTION>
+std::atomic<COUNTER_T> persist_hash_width<std::atomic<T>, COUNTER_T, DEFAULT_FLUSH_OPTION>::flush_counters[utils::NUM_FLUSH_COUNTERS];
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_hash = persist_hash_width<T, uint8_t, DEFAULT_FLUSH_OPTION>;
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_hash_w16 = persist_hash_width<T, uint16_t, DEFAULT_FLUSH_OPTION>;
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_hash_w32 = persist_hash_width<T, uint32_t, DEFAULT_FLUSH_OPTION>;
 
 #endif /* PERSIST_HASH_HPP_ */
\ No newline at end of file
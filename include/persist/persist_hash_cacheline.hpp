@@ -7,23 +7,25 @@
 #include "utils.hpp"
 #include <sstream>
 
-// Flush marking can support fetch and add and other common atomic primitives.
-
 #define LOG_CACHE_LINE_SIZE 6
 const uint64_t CACHE_LINE_MASK = (1ull<<LOG_CACHE_LINE_SIZE)-1ull;
 
 // For non-atomic types, use the same implementation as persist<T>
-template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION = flush_option::flush,
+         typename COUNTER_T = uint8_t>
 struct persist_hash_cacheline : public persist<T, DEFAULT_FLUSH_OPTION> {};
 
-template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION>
-struct persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION> {
+// COUNTER_T is the flush counter type. Every word hashed to a slot shares its
+// counter, so with many threads an 8-bit counter can wrap to zero; wider
+// counters multiply the table size by sizeof(COUNTER_T).
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION, typename COUNTER_T>
+struct persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION, COUNTER_T> {
   private:
     std::atomic<T> val;
 
     static const uint64_t NUM_FLUSH_COUNTERS = (1ull<<LOG_NUM_FLUSH_COUNTERS);
     static const uint64_t FLUSH_COUNTER_MASK = NUM_FLUSH_COUNTERS-1ull;
-    static std::atomic<uint8_t> flush_counters[NUM_FLUSH_COUNTERS];
+    static std::atomic<COUNTER_T> flush_counters[NUM_FLUSH_COUNTERS];
 
     static int get_index(const std::atomic<T>* ptr) {
       return utils::hash64(((uint64_t) ptr) & utils::CACHE_LINE_MASK) & FLUSH_COUNTER_MASK;
@@ -36,7 +38,7 @@ struct persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FL
     persist_hash_cacheline& operator=(const persist_hash_cacheline&) = delete;
     persist_hash_cacheline& operator=(const persist_hash_cacheline&) volatile = delete;
   
-    persist_hash_cacheline(T initial, bool flush = DEFAULT_FLUSH_OPTION) noexcept { store_non_atomic(initial, flush); };
+    persist_hash_cacheline(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
 
     operator T() const noexcept { return load(); }
 
@@ -53,26 +55,30 @@ struct persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FL
       return val.load(std::memory_order_relaxed); 
     }
 
-    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION) {
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
       val.store(newVal, std::memory_order_relaxed);
       if (flush == flush_option::flush)
         FLUSH(&val);      
     }
 
     void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         int flush_counter_index = get_index(&val);
         flush_counters[flush_counter_index].fetch_add(1);
         val.store(newVal, order);
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counters[flush_counter_index].fetch_sub(1);
       }
       else val.store(newVal, order);
     }
 
     T load(std::memory_order order = std::memory_order_seq_cst, 
-           bool flush = DEFAULT_FLUSH_OPTION) const noexcept {
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
       T t = val.load(order);
       if (flush == flush_option::flush)
         if(flush_counters[get_index(&val)]) FLUSH(&val);
@@ -80,12 +86,14 @@ struct persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FL
     }
 
     T exchange(T newVal, std::memory_order order = std::memory_order_seq_cst, 
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         int flush_counter_index = get_index(&val);
         flush_counters[flush_counter_index].fetch_add(1);
         T t = val.exchange(newVal, order);
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counters[flush_counter_index].fetch_sub(1);
         return t;
       }
@@ -94,21 +102,75 @@ struct persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FL
 
     bool compare_exchange_strong(T& oldVal, T newVal,
               std::memory_order order = std::memory_order_seq_cst, 
-              bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+              bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         int flush_counter_index = get_index(&val);
         flush_counters[flush_counter_index].fetch_add(1);
         bool b = val.compare_exchange_strong(oldVal, newVal, order, 
                                      __cmpexch_failure_order(order));
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         flush_counters[flush_counter_index].fetch_sub(1);
-        return b;
+        return count_cas(b);
       }
-      else return val.compare_exchange_strong(oldVal, newVal, order, 
-                                   __cmpexch_failure_order(order));
+      else return count_cas(val.compare_exchange_strong(oldVal, newVal, order, 
+                                   __cmpexch_failure_order(order)));
+    }
+
+    // Runs rmw() on val inside the flush marking window.
+    template<typename RMW>
+    auto marked_rmw(RMW rmw, bool flush) noexcept {
+      drain_pending_flushes();
+      if (flush == flush_option::flush) {
+        int flush_counter_index = get_index(&val);
+        flush_counters[flush_counter_index].fetch_add(1);
+        auto t = rmw();
+        FLUSH_NOW(&val);
+        flush_counters[flush_counter_index].fetch_sub(1);
+        return t;
+      }
+      else return rmw();
+    }
+
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_add(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_sub(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_or(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_and(arg, order); }, flush);
     }
 
-    void flush_if_needed() noexcept {
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_weak(oldVal, newVal, order, 
+                                       __cmpexch_failure_order(order)); }, flush));
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
       if(flush_counters[get_index(&val)]) FLUSH(&val);
     }
 
@@ -119,12 +181,13 @@ struct persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FL
     static std::string get_name() {
       std::stringstream ss;
       ss << "persist_hash_" << LOG_NUM_FLUSH_COUNTERS;
+      if(sizeof(COUNTER_T) > 1) ss << "_w" << 8*sizeof(COUNTER_T);
       return ss.str();
     }
 };
 
-template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION>
-std::atomic<uint8_t> persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION>::flush_counters[persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION>::NUM_FLUSH_COUNTERS];
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION, typename COUNTER_T>
+std::atomic<COUNTER_T> persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION, COUNTER_T>::flush_counters[persist_hash_cacheline<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION, COUNTER_T>::NUM_FLUSH_COUNTERS];
 
 // template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
 // using persist_hash_cacheline_10 = persist_hash_cacheline<T, 10, DEFAULT_FLUSH_OPTION>;
@@ -165,4 +228,10 @@ using persist_hash_cacheline_23 = persist_hash_cacheline<T, 23, DEFAULT_FLUSH_OP
 template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
 using persist_hash_cacheline_26 = persist_hash_cacheline<T, 26, DEFAULT_FLUSH_OPTION>;
 
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_hash_cacheline_20_w16 = persist_hash_cacheline<T, 20, DEFAULT_FLUSH_OPTION, uint16_t>;
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_hash_cacheline_20_w32 = persist_hash_cacheline<T, 20, DEFAULT_FLUSH_OPTION, uint32_t>;
+
 #endif /* PERSIST_HASH_CACHELINE_HPP_ */
@@ -0,0 +1,183 @@
+
+#ifndef PERSIST_HASH_NUMA_HPP_
+#define PERSIST_HASH_NUMA_HPP_
+
+#include <atomic>
+#include "persist.hpp"
+#include "utils.hpp"
+#include "numa_utils.hpp"
+#include <sstream>
+
+// For non-atomic types, use the same implementation as persist<T>
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+struct persist_hash_numa : public persist<T, DEFAULT_FLUSH_OPTION> {};
+
+// Like persist_hash_cacheline, but with one flush counter table per NUMA node.
+// A word uses the table of the node its memory lives on (see
+// numa::region_node), so threads updating local data also update local
+// counters. Tables are allocated on their node the first time they are used.
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION>
+struct persist_hash_numa<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION> {
+  private:
+    std::atomic<T> val;
+
+    static const uint64_t NUM_FLUSH_COUNTERS = (1ull<<LOG_NUM_FLUSH_COUNTERS);
+    static const uint64_t FLUSH_COUNTER_MASK = NUM_FLUSH_COUNTERS-1ull;
+    static std::atomic<std::atomic<uint8_t>*> flush_counter_tables[numa::MAX_NODES];
+
+    static std::atomic<uint8_t>* get_table(int node) {
+      std::atomic<uint8_t>* table = flush_counter_tables[node].load(std::memory_order_acquire);
+      if(table != nullptr) return table;
+      size_t size = NUM_FLUSH_COUNTERS*sizeof(std::atomic<uint8_t>);
+      std::atomic<uint8_t>* new_table = (std::atomic<uint8_t>*) numa::alloc_on_node(size, node);
+      if(new_table == nullptr) {
+        std::cerr << "failed to allocate flush counter table" << std::endl;
+        exit(1);
+      }
+      if(flush_counter_tables[node].compare_exchange_strong(table, new_table)) return new_table;
+      munmap(new_table, size);
+      return table;
+    }
+
+    static std::atomic<uint8_t>& get_flush_counter(const std::atomic<T>* ptr) {
+      int index = utils::hash64(((uint64_t) ptr) & utils::CACHE_LINE_MASK) & FLUSH_COUNTER_MASK;
+      return get_table(numa::region_node(ptr))[index];
+    }
+
+  public:
+    persist_hash_numa() noexcept = default;
+    ~persist_hash_numa() noexcept = default;
+    persist_hash_numa(const persist_hash_numa&) = delete;
+    persist_hash_numa& operator=(const persist_hash_numa&) = delete;
+    persist_hash_numa& operator=(const persist_hash_numa&) volatile = delete;
+
+    persist_hash_numa(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
+
+    operator T() const noexcept { return load(); }
+
+    T operator=(T newVal) noexcept {
+      store(newVal);
+      return newVal;
+    }
+
+    bool is_lock_free() const noexcept {
+      return val.is_lock_free();
+    }
+
+    void load_non_atomic(bool flush = DEFAULT_FLUSH_OPTION) {
+      return val.load(std::memory_order_relaxed);
+    }
+
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
+      val.store(newVal, std::memory_order_relaxed);
+      if (flush == flush_option::flush)
+        FLUSH(&val);
+    }
+
+    T load(std::memory_order order = std::memory_order_seq_cst,
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
+      T t = val.load(order);
+      if (flush == flush_option::flush)
+        if(get_flush_counter(&val)) FLUSH(&val);
+      return t;
+    }
+
+    // Runs rmw() on val inside the flush marking window.
+    template<typename RMW>
+    auto marked_rmw(RMW rmw, bool flush) noexcept {
+      drain_pending_flushes();
+      if (flush == flush_option::flush) {
+        std::atomic<uint8_t>& flush_counter = get_flush_counter(&val);
+        flush_counter.fetch_add(1);
+        auto t = rmw();
+        FLUSH_NOW(&val);
+        flush_counter.fetch_sub(1);
+        return t;
+      }
+      else return rmw();
+    }
+
+    void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      marked_rmw([&] { val.store(newVal, order); return true; }, flush);
+    }
+
+    T exchange(T newVal, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.exchange(newVal, order); }, flush);
+    }
+
+    bool compare_exchange_strong(T& oldVal, T newVal,
+              std::memory_order order = std::memory_order_seq_cst,
+              bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_strong(oldVal, newVal, order,
+                                       __cmpexch_failure_order(order)); }, flush));
+    }
+
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_add(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_sub(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_or(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_and(arg, order); }, flush);
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_weak(oldVal, newVal, order,
+                                       __cmpexch_failure_order(order)); }, flush));
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
+      if(get_flush_counter(&val)) FLUSH(&val);
+    }
+
+    bool is_flush_needed() noexcept {
+      return get_flush_counter(&val);
+    }
+
+    static std::string get_name() {
+      std::stringstream ss;
+      ss << "persist_hash_numa_" << LOG_NUM_FLUSH_COUNTERS;
+      return ss.str();
+    }
+};
+
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, bool DEFAULT_FLUSH_OPTION>
+std::atomic<std::atomic<uint8_t>*> persist_hash_numa<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, DEFAULT_FLUSH_OPTION>::flush_counter_tables[numa::MAX_NODES];
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_hash_numa_16 = persist_hash_numa<T, 16, DEFAULT_FLUSH_OPTION>;
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_hash_numa_20 = persist_hash_numa<T, 20, DEFAULT_FLUSH_OPTION>;
+
+#endif /* PERSIST_HASH_NUMA_HPP_ */
@@ -24,7 +24,7 @@ struct persist_interface<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
     persist_interface& operator=(const persist_interface&) = delete;
     persist_interface& operator=(const persist_interface&) volatile = delete;
   
-    persist_interface(T initial, bool flush = DEFAULT_FLUSH_OPTION) noexcept { store_non_atomic(initial, flush); };
+    persist_interface(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
 
     operator T() const noexcept { return load(); }
 
@@ -41,14 +41,16 @@ struct persist_interface<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
       return val.load(std::memory_order_relaxed); 
     }
 
-    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION) {
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
       val.store(newVal, std::memory_order_relaxed);    
     }
 
     // Instead of having an if statenemtn, I can maybe change the
     // memory order to add a fence.
     void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
       // FENCE(); // I believe setting the following memory order 
                   // high enough has the same effect as a fence(). 
                   // TODO: Possible don't need seq_cst.
@@ -56,7 +58,8 @@ struct persist_interface<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
     }
 
     T load(std::memory_order order = std::memory_order_seq_cst, 
-           bool flush = DEFAULT_FLUSH_OPTION) const noexcept {
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
       T t = val.load(order); // TODO: if memory order is relaxed,
                              // can the following flush be ordered 
                              // before it?
@@ -65,7 +68,8 @@ struct persist_interface<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     T exchange(T newVal, 
                std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
       // seq_cst includes a fence
       T t = val.exchange(newVal, order);
       return t;
@@ -73,14 +77,51 @@ struct persist_interface<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     bool compare_exchange_strong(T& oldVal, T newVal,
                  std::memory_order order = std::memory_order_seq_cst,
-                 bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+                 bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
       // seq_cst includes a fence
       bool b = val.compare_exchange_strong(oldVal, newVal, 
           order, __cmpexch_failure_order(order));
-      return b;
+      return count_cas(b);
     }
 
-    void flush_if_needed() noexcept {}
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return val.fetch_add(arg, order);
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return val.fetch_sub(arg, order);
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return val.fetch_or(arg, order);
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return val.fetch_and(arg, order);
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                 std::memory_order order = std::memory_order_seq_cst,
+                 bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(val.compare_exchange_weak(oldVal, newVal, 
+          order, __cmpexch_failure_order(order)));
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept { PMEM_SITE_SCOPE;}
 
     bool is_flush_needed() noexcept {
       return false;
@@ -9,17 +9,19 @@
 using flush_counter_t = std::atomic<uint8_t>;
 
 // For non-atomic types, use the same implementation as persist<T>
-template<typename T, int flush_counter_offset, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+template<typename T, int flush_counter_offset, bool DEFAULT_FLUSH_OPTION = flush_option::flush,
+         typename COUNTER_T = uint8_t>
 struct persist_offset : public persist<T, DEFAULT_FLUSH_OPTION> {};
 
-template<typename T, int flush_counter_offset, bool DEFAULT_FLUSH_OPTION>
+// The counter at flush_counter_offset must be a std::atomic<COUNTER_T>
+template<typename T, int flush_counter_offset, bool DEFAULT_FLUSH_OPTION, typename COUNTER_T>
 struct persist_offset<std::atomic<T>, flush_counter_offset,
-                                      DEFAULT_FLUSH_OPTION> {
+                                      DEFAULT_FLUSH_OPTION, COUNTER_T> {
   private:
     std::atomic<T> val;
 
-    flush_counter_t* get_flush_counter() const {
-      return (flush_counter_t*) (((uint64_t) this) + flush_counter_offset);
+    std::atomic<COUNTER_T>* get_flush_counter() const {
+      return (std::atomic<COUNTER_T>*) (((uint64_t) this) + flush_counter_offset);
     }
 
   public:
@@ -29,7 +31,7 @@ struct persist_offset<std::atomic<T>, flush_counter_offset,
     persist_offset& operator=(const persist_offset&) = delete;
     persist_offset& operator=(const persist_offset&) volatile = delete;
   
-    persist_offset(T initial, bool flush = DEFAULT_FLUSH_OPTION) noexcept { store_non_atomic(initial, flush); };
+    persist_offset(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
 
     operator T() const noexcept { return load(); }
 
@@ -46,25 +48,29 @@ struct persist_offset<std::atomic<T>, flush_counter_offset,
       return val.load(std::memory_order_relaxed); 
     }
 
-    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION) {
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
       val.store(newVal, std::memory_order_relaxed);
       if (flush == flush_option::flush)
         FLUSH(&val);      
     }
 
     void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         get_flush_counter()->fetch_add(1);
         val.store(newVal, order);
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         get_flush_counter()->fetch_sub(1);
       }
       else val.store(newVal, order);
     }
 
     T load(std::memory_order order = std::memory_order_seq_cst,
-           bool flush = DEFAULT_FLUSH_OPTION) const noexcept {
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
       T t = val.load(order);
       if (flush == flush_option::flush)
         if(get_flush_counter()->load()) FLUSH(&val);
@@ -73,11 +79,13 @@ struct persist_offset<std::atomic<T>, flush_counter_offset,
 
     T exchange(T newVal, 
                std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         get_flush_counter()->fetch_add(1);
         T t = val.exchange(newVal, order);
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         get_flush_counter()->fetch_sub(1);
         return t;
       }
@@ -86,20 +94,73 @@ struct persist_offset<std::atomic<T>, flush_counter_offset,
 
     bool compare_exchange_strong(T& oldVal, T newVal,
                 std::memory_order order = std::memory_order_seq_cst,
-                bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       if (flush == flush_option::flush) {
         get_flush_counter()->fetch_add(1);
         bool b = val.compare_exchange_strong(oldVal, newVal, order, 
                                      __cmpexch_failure_order(order));
-        FLUSH(&val);      
+        FLUSH_NOW(&val);      
         get_flush_counter()->fetch_sub(1);
-        return b;
+        return count_cas(b);
       }
-      else return val.compare_exchange_strong(oldVal, newVal, order, 
-                                     __cmpexch_failure_order(order));
+      else return count_cas(val.compare_exchange_strong(oldVal, newVal, order, 
+                                     __cmpexch_failure_order(order)));
+    }
+
+    // Runs rmw() on val inside the flush marking window.
+    template<typename RMW>
+    auto marked_rmw(RMW rmw, bool flush) noexcept {
+      drain_pending_flushes();
+      if (flush == flush_option::flush) {
+        get_flush_counter()->fetch_add(1);
+        auto t = rmw();
+        FLUSH_NOW(&val);
+        get_flush_counter()->fetch_sub(1);
+        return t;
+      }
+      else return rmw();
+    }
+
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_add(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_sub(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_or(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_and(arg, order); }, flush);
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_weak(oldVal, newVal, order, 
+                                       __cmpexch_failure_order(order)); }, flush));
     }
 
-    void flush_if_needed() noexcept {
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
       if(get_flush_counter()->load()) FLUSH(&val);
     }
 
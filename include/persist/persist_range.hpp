@@ -0,0 +1,180 @@
+
+#ifndef PERSIST_RANGE_HPP_
+#define PERSIST_RANGE_HPP_
+
+#include <assert.h>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <immintrin.h>
+#include "persist.hpp"
+
+// Non-temporal initialization of fresh persistent memory.
+// Streaming stores (movnt) bypass the cache: the destination lines are not
+// read for ownership and, once the following sfence retires, they are in the
+// persistence domain, so freshly initialized memory needs no flush before it
+// is published. This only pays off for memory that is written in full and not
+// read back soon, such as a new node, which is why the helpers below build the
+// contents in a cached scratch buffer first and stream them out in one pass.
+
+// Streams size bytes from src to dst. dst must be 16 byte aligned; a tail
+// that is not a multiple of 16 bytes is written normally and flushed.
+// Streamed stores are weakly ordered, call nt_fence() before publishing.
+inline void nt_store(void* dst, const void* src, size_t size) {
+  assert((((uintptr_t) dst) & 15) == 0);
+  char* d = (char*) dst;
+  const char* s = (const char*) src;
+  char* end = d + (size & ~((size_t) 15));
+  #ifdef __AVX__
+    if((((uintptr_t) d) & 31) == 0)
+      for(; d + 32 <= end; d += 32, s += 32)
+        _mm256_stream_si256((__m256i*) d, _mm256_loadu_si256((const __m256i*) s));
+  #endif
+  for(; d < end; d += 16, s += 16)
+    _mm_stream_si128((__m128i*) d, _mm_loadu_si128((const __m128i*) s));
+  if(size & 15) {
+    memcpy(d, s, size & 15);
+    FLUSH(d);
+  }
+  #if defined(PMEM_STATS) || defined(PMEM_EMULATION)
+    for(uint64_t p = ((uint64_t) dst) & CACHELINE_MASK; p < ((uint64_t) dst) + size; p += 64ULL) {
+      #ifdef PMEM_STATS
+        streamed_line_count++;
+      #endif
+      #ifdef PMEM_EMULATION
+        pmem_emulation_flush();  // a streamed line costs one line of write-back
+      #endif
+    }
+  #endif
+}
+
+// Streams size zero bytes to dst, same requirements as nt_store()
+inline void nt_zero(void* dst, size_t size) {
+  alignas(64) static const char zeros[64] = {};
+  char* d = (char*) dst;
+  for(; size > 64; d += 64, size -= 64) nt_store(d, zeros, 64);
+  nt_store(d, zeros, size);
+}
+
+// Orders streamed stores before all later stores and waits for them to reach
+// the persistence domain. Unlike FENCE() this is needed with every flush
+// instruction, including CLFLUSH and eADR, because it is what orders the
+// streamed stores in the first place.
+inline void nt_fence(PMEM_SITE) {
+  PMEM_SITE_SCOPE;
+  asm volatile ("sfence" ::: "memory");
+  #ifdef PMEM_STATS
+    fence_count++;
+  #endif
+  #ifdef PMEM_PROFILE
+    pmem_profile_fence();
+  #endif
+  #ifdef PMEM_EMULATION
+    pmem_emulation_fence();
+  #endif
+}
+
+// A range of fresh persistent memory, e.g. a newly allocated block.
+class persist_range {
+  private:
+    void* ptr;
+    size_t len;
+
+  public:
+    persist_range(void* p, size_t size) noexcept : ptr(p), len(size) {}
+
+    void* data() const noexcept { return ptr; }
+    size_t size() const noexcept { return len; }
+
+    // Initializes the whole range from src, durable on return
+    void stream_from(const void* src) noexcept {
+      nt_store(ptr, src, len);
+      nt_fence();
+    }
+
+    // Zeroes the whole range, durable on return
+    void zero() noexcept {
+      nt_zero(ptr, len);
+      nt_fence();
+    }
+
+    // For ranges that were written with normal stores
+    void flush() const noexcept {
+      FLUSH_STRUCT((char*) ptr, len);
+    }
+};
+
+// Fixed size persistent array whose bulk initialization uses streaming stores.
+// Element accesses are plain loads and stores; call flush() after updating
+// elements in place.
+template<typename T, size_t N>
+struct alignas(64) persist_array {
+  static_assert(64 % sizeof(T) == 0 || sizeof(T) % 16 == 0,
+                "elements must tile cache lines in 16 byte chunks");
+  private:
+    T elems[N];
+
+  public:
+    static constexpr size_t size() noexcept { return N; }
+
+    T& operator[](size_t i) noexcept { return elems[i]; }
+    const T& operator[](size_t i) const noexcept { return elems[i]; }
+    T* data() noexcept { return elems; }
+
+    // Copies N elements from src, durable on return
+    void stream_from(const T* src) noexcept {
+      persist_range(elems, sizeof(elems)).stream_from(src);
+    }
+
+    // Sets every element to v, durable on return
+    void fill(const T& v) noexcept {
+      // one line worth of elements at a time, so the scratch buffer stays small
+      const size_t PER_LINE = sizeof(T) < 64 ? 64/sizeof(T) : 1;
+      alignas(64) T line[PER_LINE];
+      for(size_t i = 0; i < PER_LINE; i++) line[i] = v;
+      for(size_t i = 0; i < N; i += PER_LINE)
+        nt_store(&elems[i], line, std::min(PER_LINE, N-i)*sizeof(T));
+      nt_fence();
+    }
+
+    void flush() const noexcept {
+      FLUSH_STRUCT(this);
+    }
+};
+
+// Constructs a NODE at dst without bringing dst into the cache: the node is
+// built in a scratch buffer and streamed out. NODE must be safe to relocate
+// with memcpy, which holds for the nodes of this library (persist wrappers
+// do not store their own address).
+template<typename NODE, typename... ARGS>
+inline NODE* construct_streamed(NODE* dst, ARGS&&... args) {
+  alignas(NODE) unsigned char scratch[sizeof(NODE)];
+  new (scratch) NODE(std::forward<ARGS>(args)...);
+  nt_store(dst, scratch, sizeof(NODE));
+  nt_fence();
+  return dst;
+}
+
+// Opt-in for durable data structures. Nodes are created with construct_node()
+// and their constructors persist the node with FLUSH_NEW_NODE(this). With
+// -DNT_NODE_INIT nodes are streamed and the constructor flush is dropped,
+// otherwise this is a plain placement new followed by FLUSH_STRUCT.
+template<typename NODE, typename... ARGS>
+inline NODE* construct_node(NODE* dst, ARGS&&... args) {
+  #ifdef NT_NODE_INIT
+    return construct_streamed(dst, std::forward<ARGS>(args)...);
+  #else
+    return new (dst) NODE(std::forward<ARGS>(args)...);
+  #endif
+}
+
+template <class ET>
+inline void FLUSH_NEW_NODE(ET *ptr)
+{
+  #ifndef NT_NODE_INIT
+    FLUSH_STRUCT(ptr);
+  #endif
+}
+
+#endif /* PERSIST_RANGE_HPP_ */
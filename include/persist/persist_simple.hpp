@@ -21,7 +21,7 @@ struct persist_simple<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
     persist_simple& operator=(const persist_simple&) = delete;
     persist_simple& operator=(const persist_simple&) volatile = delete;
   
-    persist_simple(T initial, bool flush = DEFAULT_FLUSH_OPTION) noexcept { store_non_atomic(initial, flush); };
+    persist_simple(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
 
     operator T() const noexcept { return load(); }
 
@@ -38,7 +38,8 @@ struct persist_simple<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
       return val.load(std::memory_order_relaxed); 
     }
 
-    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION) {
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
       val.store(newVal, std::memory_order_relaxed);
       if (flush == flush_option::flush)
         FLUSH(&val);      
@@ -47,7 +48,9 @@ struct persist_simple<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
     // Instead of having an if statenemtn, I can maybe change the
     // memory order to add a fence.
     void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       // FENCE(); // I believe setting the following memory order 
                   // high enough has the same effect as a fence(). 
                   // TODO: Possible don't need seq_cst.
@@ -57,7 +60,8 @@ struct persist_simple<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
     }
 
     T load(std::memory_order order = std::memory_order_seq_cst, 
-           bool flush = DEFAULT_FLUSH_OPTION) const noexcept {
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
       T t = val.load(order); // TODO: if memory order is relaxed,
                              // can the following flush be ordered 
                              // before it?
@@ -68,7 +72,9 @@ struct persist_simple<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     T exchange(T newVal, 
                std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       // seq_cst includes a fence
       T t = val.exchange(newVal, std::memory_order_seq_cst);
       if (flush == flush_option::flush)
@@ -78,16 +84,75 @@ struct persist_simple<std::atomic<T>, DEFAULT_FLUSH_OPTION> {
 
     bool compare_exchange_strong(T& oldVal, T newVal,
                std::memory_order order = std::memory_order_seq_cst,
-               bool flush = DEFAULT_FLUSH_OPTION) noexcept {
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
       // seq_cst includes a fence
       bool b = val.compare_exchange_strong(oldVal, newVal, 
           std::memory_order_seq_cst, __cmpexch_failure_order(order));
       if (flush == flush_option::flush)
         FLUSH(&val);
-      return b;
+      return count_cas(b);
     }
 
-    void flush_if_needed() noexcept {
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      T t = val.fetch_add(arg, std::memory_order_seq_cst);
+      if (flush == flush_option::flush)
+        FLUSH(&val);
+      return t;
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      T t = val.fetch_sub(arg, std::memory_order_seq_cst);
+      if (flush == flush_option::flush)
+        FLUSH(&val);
+      return t;
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      T t = val.fetch_or(arg, std::memory_order_seq_cst);
+      if (flush == flush_option::flush)
+        FLUSH(&val);
+      return t;
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      T t = val.fetch_and(arg, std::memory_order_seq_cst);
+      if (flush == flush_option::flush)
+        FLUSH(&val);
+      return t;
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+               std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      drain_pending_flushes();
+      bool b = val.compare_exchange_weak(oldVal, newVal, 
+          std::memory_order_seq_cst, __cmpexch_failure_order(order));
+      if (flush == flush_option::flush)
+        FLUSH(&val);
+      return count_cas(b);
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
       FLUSH(&val);
     }    
 
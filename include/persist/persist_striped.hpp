@@ -0,0 +1,229 @@
+
+#ifndef PERSIST_STRIPED_HPP_
+#define PERSIST_STRIPED_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <sched.h>
+#include "persist.hpp"
+#include "utils.hpp"
+#include <sstream>
+
+// Stripe used by this thread, picked from the CPU it first ran a write on.
+// Threads on different cores mostly update different stripe tables, so a hot
+// word (e.g. the list head) no longer has every writer incrementing the same
+// counter.
+thread_local int flush_counter_stripe = -1;
+
+// For non-atomic types, use the same implementation as persist<T>
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, int NUM_STRIPES, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+struct persist_striped : public persist<T, DEFAULT_FLUSH_OPTION> {};
+
+// Like persist_hash_cacheline, but each hashed flush counter is split into
+// NUM_STRIPES stripe counters (one table per stripe, so stripes of a slot are
+// on different cache lines). A writer only increments the counter of its own
+// stripe, so writers on different cores never write the same line.
+// Readers only check the 32-bit summary of the slot, which counts its nonzero
+// stripes: a writer raises it before taking its stripe from 0 to 1 and lowers
+// it after taking the stripe from 1 back to 0. While a word is hot its stripes
+// stay nonzero and the summary line is only read, and a load costs one line as
+// in persist_hash_cacheline. A writer that finds its stripe saturated (more
+// than 255 writers of one stripe in the window) raises the summary itself
+// instead, so the 8-bit stripes never wrap.
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, int NUM_STRIPES, bool DEFAULT_FLUSH_OPTION>
+struct persist_striped<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, NUM_STRIPES, DEFAULT_FLUSH_OPTION> {
+  private:
+    std::atomic<T> val;
+
+    static const uint64_t NUM_FLUSH_COUNTERS = (1ull<<LOG_NUM_FLUSH_COUNTERS);
+    static const uint64_t FLUSH_COUNTER_MASK = NUM_FLUSH_COUNTERS-1ull;
+    static std::atomic<uint32_t> summaries[NUM_FLUSH_COUNTERS];
+    alignas(64) static std::atomic<uint8_t> stripe_counters[NUM_STRIPES][NUM_FLUSH_COUNTERS];
+
+    static int get_index(const std::atomic<T>* ptr) {
+      return utils::hash64(((uint64_t) ptr) & utils::CACHE_LINE_MASK) & FLUSH_COUNTER_MASK;
+    }
+
+    static int get_stripe() {
+      if(flush_counter_stripe < 0) {
+        int cpu = sched_getcpu();
+        flush_counter_stripe = (cpu < 0 ? 0 : cpu);
+      }
+      return flush_counter_stripe % NUM_STRIPES;
+    }
+
+    // Returns true if the stripe was saturated and the summary was raised
+    // instead
+    static bool mark(int stripe, int index) {
+      std::atomic<uint8_t>& c = stripe_counters[stripe][index];
+      uint8_t cur = c.load(std::memory_order_relaxed);
+      while(true) {
+        if(cur == UINT8_MAX) {
+          summaries[index].fetch_add(1);
+          return true;
+        }
+        if(cur == 0) {
+          // The summary is raised before the stripe becomes nonzero, so the
+          // writers that see it nonzero can rely on it
+          summaries[index].fetch_add(1);
+          if(c.compare_exchange_weak(cur, 1)) return false;
+          summaries[index].fetch_sub(1);
+        }
+        else if(c.compare_exchange_weak(cur, cur+1)) return false;
+      }
+    }
+
+    static void unmark(int stripe, int index, bool saturated) {
+      if(saturated) {
+        summaries[index].fetch_sub(1);
+        return;
+      }
+      if(stripe_counters[stripe][index].fetch_sub(1) == 1)
+        summaries[index].fetch_sub(1);
+    }
+
+    static bool is_marked(int index) {
+      return summaries[index].load() != 0;
+    }
+
+  public:
+    persist_striped() noexcept = default;
+    ~persist_striped() noexcept = default;
+    persist_striped(const persist_striped&) = delete;
+    persist_striped& operator=(const persist_striped&) = delete;
+    persist_striped& operator=(const persist_striped&) volatile = delete;
+
+    persist_striped(T initial, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept { PMEM_SITE_SCOPE; store_non_atomic(initial, flush); };
+
+    operator T() const noexcept { return load(); }
+
+    T operator=(T newVal) noexcept {
+      store(newVal);
+      return newVal;
+    }
+
+    bool is_lock_free() const noexcept {
+      return val.is_lock_free();
+    }
+
+    void load_non_atomic(bool flush = DEFAULT_FLUSH_OPTION) {
+      return val.load(std::memory_order_relaxed);
+    }
+
+    void store_non_atomic(T newVal, bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) {
+      PMEM_SITE_SCOPE;
+      val.store(newVal, std::memory_order_relaxed);
+      if (flush == flush_option::flush)
+        FLUSH(&val);
+    }
+
+    T load(std::memory_order order = std::memory_order_seq_cst,
+           bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) const noexcept {
+      PMEM_SITE_SCOPE;
+      T t = val.load(order);
+      if (flush == flush_option::flush)
+        if(is_marked(get_index(&val))) FLUSH(&val);
+      return t;
+    }
+
+    // Runs rmw() on val inside the flush marking window.
+    template<typename RMW>
+    auto marked_rmw(RMW rmw, bool flush) noexcept {
+      drain_pending_flushes();
+      if (flush == flush_option::flush) {
+        int flush_counter_index = get_index(&val);
+        int stripe = get_stripe();
+        bool saturated = mark(stripe, flush_counter_index);
+        auto t = rmw();
+        FLUSH_NOW(&val);
+        unmark(stripe, flush_counter_index, saturated);
+        return t;
+      }
+      else return rmw();
+    }
+
+    void store(T newVal, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      marked_rmw([&] { val.store(newVal, order); return true; }, flush);
+    }
+
+    T exchange(T newVal, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.exchange(newVal, order); }, flush);
+    }
+
+    bool compare_exchange_strong(T& oldVal, T newVal,
+              std::memory_order order = std::memory_order_seq_cst,
+              bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_strong(oldVal, newVal, order,
+                                       __cmpexch_failure_order(order)); }, flush));
+    }
+
+    template<typename ARG>
+    T fetch_add(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_add(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_sub(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_sub(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_or(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+               bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_or(arg, order); }, flush);
+    }
+
+    template<typename ARG>
+    T fetch_and(ARG arg, std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return marked_rmw([&] { return val.fetch_and(arg, order); }, flush);
+    }
+
+    bool compare_exchange_weak(T& oldVal, T newVal,
+                std::memory_order order = std::memory_order_seq_cst,
+                bool flush = DEFAULT_FLUSH_OPTION PMEM_SITE_ARG) noexcept {
+      PMEM_SITE_SCOPE;
+      return count_cas(marked_rmw([&] { return val.compare_exchange_weak(oldVal, newVal, order,
+                                       __cmpexch_failure_order(order)); }, flush));
+    }
+
+    void flush_if_needed(PMEM_SITE) noexcept {
+      PMEM_SITE_SCOPE;
+      if(is_marked(get_index(&val))) FLUSH(&val);
+    }
+
+    bool is_flush_needed() noexcept {
+      return is_marked(get_index(&val));
+    }
+
+    static std::string get_name() {
+      std::stringstream ss;
+      ss << "persist_striped_" << LOG_NUM_FLUSH_COUNTERS << "x" << NUM_STRIPES;
+      return ss.str();
+    }
+};
+
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, int NUM_STRIPES, bool DEFAULT_FLUSH_OPTION>
+std::atomic<uint32_t> persist_striped<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, NUM_STRIPES, DEFAULT_FLUSH_OPTION>::summaries[persist_striped<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, NUM_STRIPES, DEFAULT_FLUSH_OPTION>::NUM_FLUSH_COUNTERS];
+
+template<typename T, int LOG_NUM_FLUSH_COUNTERS, int NUM_STRIPES, bool DEFAULT_FLUSH_OPTION>
+alignas(64) std::atomic<uint8_t> persist_striped<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, NUM_STRIPES, DEFAULT_FLUSH_OPTION>::stripe_counters[NUM_STRIPES][persist_striped<std::atomic<T>, LOG_NUM_FLUSH_COUNTERS, NUM_STRIPES, DEFAULT_FLUSH_OPTION>::NUM_FLUSH_COUNTERS];
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_striped_16 = persist_striped<T, 16, 8, DEFAULT_FLUSH_OPTION>;
+
+template<typename T, bool DEFAULT_FLUSH_OPTION = flush_option::flush>
+using persist_striped_20 = persist_striped<T, 20, 8, DEFAULT_FLUSH_OPTION>;
+
+#endif /* PERSIST_STRIPED_HPP_ */
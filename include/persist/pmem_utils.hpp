@@ -10,6 +10,16 @@
 
 #include <iostream>
 #include <atomic>
+#include <cstdlib>
+#include <string>
+#include <cpuid.h>
+#include <mutex>
+#ifdef PMEM_EMULATION
+  #include <algorithm>
+  #include <chrono>
+  #include <thread>
+  #include <x86intrin.h>
+#endif
 // #include <csignal>
 
 // #define PWB_IS_CLFLUSH
@@ -20,64 +30,629 @@ const uint64_t CACHELINE_MASK = ~(64ULL-1ULL);
 
 // thread_local bool disable_flushes = false;
 
+// Call site profiling (-DPMEM_PROFILE, implies PMEM_STATS).
+// FLUSH, FENCE and the other entry points below take the file and line of
+// their caller as defaulted arguments (PMEM_SITE). The methods of the persist
+// wrappers take them too and open a pmem_site_scope, so a flush issued inside
+// a wrapper is charged to the line that called the wrapper: the outermost
+// site wins. Each site counts flushes, fences and repeat flushes, i.e.
+// flushes of a cache line that was already flushed in the same
+// OperationLifetime. The sites are printed by print_pmem_stats(), sorted by
+// flush count.
+#ifdef PMEM_PROFILE
+  #ifndef PMEM_STATS
+    #define PMEM_STATS
+  #endif
+  #include <algorithm>
+  #include <iomanip>
+  #include <map>
+  #include <unordered_map>
+  #include <vector>
+
+  #define PMEM_SITE const char* site_file = __builtin_FILE(), int site_line = __builtin_LINE()
+  #define PMEM_SITE_ARG , PMEM_SITE
+  #define PMEM_SITE_SCOPE pmem_site_scope site_scope(site_file, site_line)
+
+  typedef std::pair<const char*, int> pmem_site_t;
+
+  thread_local pmem_site_t current_pmem_site(nullptr, 0);
+
+  struct pmem_site_scope {
+    bool outermost;
+    pmem_site_scope(const char* file, int line) noexcept : outermost(current_pmem_site.first == nullptr) {
+      if(outermost) current_pmem_site = pmem_site_t(file, line);
+    }
+    ~pmem_site_scope() noexcept {
+      if(outermost) current_pmem_site = pmem_site_t(nullptr, 0);
+    }
+  };
+
+  struct pmem_site_stats {
+    int64_t flushes = 0;
+    int64_t repeat_flushes = 0;
+    int64_t fences = 0;
+
+    void operator+=(const pmem_site_stats& other) {
+      flushes += other.flushes;
+      repeat_flushes += other.repeat_flushes;
+      fences += other.fences;
+    }
+  };
+
+  struct pmem_site_hash {
+    size_t operator()(const pmem_site_t& site) const {
+      return std::hash<const void*>()(site.first) * 31 + site.second;
+    }
+  };
+
+  thread_local std::unordered_map<pmem_site_t, pmem_site_stats, pmem_site_hash> pmem_site_profile;
+  // file names are compared by value here, the same header can be seen
+  // through different string literals
+  std::map<std::pair<std::string, int>, pmem_site_stats> global_pmem_site_profile;
+  std::mutex global_pmem_site_profile_lock;
+
+  // Cache lines flushed so far in the current operation. Flushes outside of an
+  // OperationLifetime are tracked in windows of PMEM_PROFILE_MAX_LINES lines.
+  const int PMEM_PROFILE_MAX_LINES = 256;
+  thread_local uint64_t pmem_operation_lines[PMEM_PROFILE_MAX_LINES];
+  thread_local int pmem_operation_line_count = 0;
+
+  inline void pmem_profile_flush(const void* p) {
+    pmem_site_stats& stats = pmem_site_profile[current_pmem_site];
+    stats.flushes++;
+    uint64_t line = ((uint64_t) p) & CACHELINE_MASK;
+    for(int i = 0; i < pmem_operation_line_count; i++)
+      if(pmem_operation_lines[i] == line) {
+        stats.repeat_flushes++;
+        return;
+      }
+    if(pmem_operation_line_count == PMEM_PROFILE_MAX_LINES) pmem_operation_line_count = 0;
+    pmem_operation_lines[pmem_operation_line_count++] = line;
+  }
+
+  inline void pmem_profile_fence() {
+    pmem_site_profile[current_pmem_site].fences++;
+  }
+
+  inline void pmem_profile_end_operation() {
+    pmem_operation_line_count = 0;
+  }
+
+  void reset_pmem_profile() {
+    pmem_site_profile.clear();
+    pmem_operation_line_count = 0;
+    std::lock_guard<std::mutex> lock(global_pmem_site_profile_lock);
+    global_pmem_site_profile.clear();
+  }
+
+  void aggregate_pmem_profile() {
+    std::lock_guard<std::mutex> lock(global_pmem_site_profile_lock);
+    for(auto& site : pmem_site_profile)
+      global_pmem_site_profile[{site.first.first ? site.first.first : "(unknown)", site.first.second}] += site.second;
+    pmem_site_profile.clear();
+  }
+
+  void print_pmem_profile(uint64_t num_operations) {
+    std::vector<std::pair<std::pair<std::string, int>, pmem_site_stats>> sites(
+        global_pmem_site_profile.begin(), global_pmem_site_profile.end());
+    std::sort(sites.begin(), sites.end(), [](const auto& a, const auto& b) {
+      if(a.second.flushes != b.second.flushes) return a.second.flushes > b.second.flushes;
+      return a.second.fences > b.second.fences;
+    });
+    std::cout << "Flush profile (per operation): flushes, repeat flushes, fences, call site" << std::endl;
+    for(auto& site : sites) {
+      std::cout << std::fixed << std::setprecision(4)
+                << "  " << std::setw(10) << 1.0*site.second.flushes/num_operations
+                << " " << std::setw(10) << 1.0*site.second.repeat_flushes/num_operations
+                << " " << std::setw(10) << 1.0*site.second.fences/num_operations
+                << "  " << site.first.first << ":" << site.first.second << std::endl;
+    }
+    std::cout.unsetf(std::ios_base::floatfield);
+    std::cout << std::setprecision(6);
+  }
+#else
+  #define PMEM_SITE
+  #define PMEM_SITE_ARG
+  #define PMEM_SITE_SCOPE
+  inline void pmem_profile_end_operation() {}
+#endif
+
 #ifdef PMEM_STATS
   std::atomic<int64_t> global_flush_count(0);
+  std::atomic<int64_t> global_issued_flush_count(0);
   std::atomic<int64_t> global_fence_count(0);
   std::atomic<int64_t> global_cas_count(0);
+  std::atomic<int64_t> global_failed_cas_count(0);
+  std::atomic<int64_t> global_streamed_line_count(0);
   
+  // flush_count counts requested flushes, issued_flush_count counts flush
+  // instructions actually executed. They only differ with FLUSH_COALESCING.
   thread_local int64_t flush_count = 0;
+  thread_local int64_t issued_flush_count = 0;
   thread_local int64_t fence_count = 0;
+  // CASes issued through the persist wrappers, and how many of them failed
   thread_local int64_t cas_count = 0;
+  thread_local int64_t failed_cas_count = 0;
+  // cache lines written with streaming stores (see persist_range.hpp)
+  thread_local int64_t streamed_line_count = 0;
+
+  // Per-policy counters for persist_adaptive. Only printed when non-zero.
+  enum adaptive_stat_t { ADAPTIVE_ADJACENT_WRITES, ADAPTIVE_HASHED_WRITES,
+                         ADAPTIVE_ADJACENT_LOAD_FLUSHES, ADAPTIVE_HASHED_LOAD_FLUSHES,
+                         ADAPTIVE_TO_HASHED, ADAPTIVE_TO_ADJACENT, ADAPTIVE_NUM_STATS };
+  const char* adaptive_stat_names[ADAPTIVE_NUM_STATS] = {
+    "Adaptive adjacent-counter writes", "Adaptive hashed-counter writes",
+    "Adaptive adjacent-counter load flushes", "Adaptive hashed-counter load flushes",
+    "Adaptive migrations to hashed", "Adaptive migrations to adjacent" };
+  std::atomic<int64_t> global_adaptive_stats[ADAPTIVE_NUM_STATS];
+  thread_local int64_t adaptive_stats[ADAPTIVE_NUM_STATS];
+
+  // Per operation type statistics. The benchmark takes a snapshot of this
+  // thread's counters before each operation and charges the difference to
+  // the bucket of the operation type and outcome afterwards. Buckets are
+  // thread local and only summed up by aggregate_pmem_stats().
+  enum pmem_op_t { PMEM_OP_ADD, PMEM_OP_REMOVE, PMEM_OP_CONTAINS, PMEM_NUM_OPS };
+  const char* pmem_op_names[PMEM_NUM_OPS] = { "add", "remove", "contains" };
+
+  struct pmem_counters {
+    int64_t ops;
+    int64_t flushes;
+    int64_t fences;
+    int64_t cases;
+    int64_t failed_cases;
+  };
+
+  thread_local pmem_counters pmem_op_stats[PMEM_NUM_OPS][2];  // [op][success]
+  pmem_counters global_pmem_op_stats[PMEM_NUM_OPS][2];
+  std::mutex global_pmem_op_stats_lock;
+
+  inline pmem_counters read_pmem_counters() {
+    return {0, flush_count, fence_count, cas_count, failed_cas_count};
+  }
+
+  inline void record_pmem_op(pmem_op_t op, bool success, const pmem_counters& before) {
+    pmem_counters& bucket = pmem_op_stats[op][success];
+    bucket.ops++;
+    bucket.flushes += flush_count - before.flushes;
+    bucket.fences += fence_count - before.fences;
+    bucket.cases += cas_count - before.cases;
+    bucket.failed_cases += failed_cas_count - before.failed_cases;
+  }
 
   void reset_pmem_stats() {
-    flush_count = fence_count = cas_count = 0;
-    global_flush_count = global_fence_count = global_cas_count = 0;
+    flush_count = issued_flush_count = fence_count = cas_count = failed_cas_count = streamed_line_count = 0;
+    global_flush_count = global_issued_flush_count = global_fence_count = global_cas_count = 0;
+    global_failed_cas_count = global_streamed_line_count = 0;
+    for(int i = 0; i < ADAPTIVE_NUM_STATS; i++) adaptive_stats[i] = global_adaptive_stats[i] = 0;
+    {
+      std::lock_guard<std::mutex> lock(global_pmem_op_stats_lock);
+      for(int op = 0; op < PMEM_NUM_OPS; op++)
+        for(int success = 0; success < 2; success++)
+          pmem_op_stats[op][success] = global_pmem_op_stats[op][success] = {0, 0, 0, 0, 0};
+    }
+    #ifdef PMEM_PROFILE
+      reset_pmem_profile();
+    #endif
   }
 
   void aggregate_pmem_stats() {
     global_flush_count += flush_count;
+    global_issued_flush_count += issued_flush_count;
     global_fence_count += fence_count;
     global_cas_count += cas_count;
+    global_failed_cas_count += failed_cas_count;
+    global_streamed_line_count += streamed_line_count;
+    for(int i = 0; i < ADAPTIVE_NUM_STATS; i++) global_adaptive_stats[i] += adaptive_stats[i];
+    {
+      std::lock_guard<std::mutex> lock(global_pmem_op_stats_lock);
+      for(int op = 0; op < PMEM_NUM_OPS; op++)
+        for(int success = 0; success < 2; success++) {
+          pmem_counters& g = global_pmem_op_stats[op][success];
+          const pmem_counters& t = pmem_op_stats[op][success];
+          g.ops += t.ops;
+          g.flushes += t.flushes;
+          g.fences += t.fences;
+          g.cases += t.cases;
+          g.failed_cases += t.failed_cases;
+        }
+    }
+    #ifdef PMEM_PROFILE
+      aggregate_pmem_profile();
+    #endif
   }
 
   void print_pmem_stats() {
     std::cout << "Flush count: " << global_flush_count << std::endl;
+    std::cout << "Issued flush count: " << global_issued_flush_count << std::endl;
     std::cout << "Fence count: " << global_fence_count << std::endl;
     std::cout << "CAS count: " << global_cas_count << std::endl;
+    std::cout << "Failed CAS count: " << global_failed_cas_count << std::endl;
+    if(global_streamed_line_count) std::cout << "Streamed line count: " << global_streamed_line_count << std::endl;
+    for(int i = 0; i < ADAPTIVE_NUM_STATS; i++)
+      if(global_adaptive_stats[i]) std::cout << adaptive_stat_names[i] << ": " << global_adaptive_stats[i] << std::endl;
   }
 
   void print_pmem_stats(uint64_t num_operations) {
     std::cout << "Flushes per operation: " << 1.0*global_flush_count/num_operations << std::endl;
+    std::cout << "Issued flushes per operation: " << 1.0*global_issued_flush_count/num_operations << std::endl;
     std::cout << "Fences per operation: " << 1.0*global_fence_count/num_operations << std::endl;
     std::cout << "CASes per operation: " << 1.0*global_cas_count/num_operations << std::endl;
+    std::cout << "Failed CASes per operation: " << 1.0*global_failed_cas_count/num_operations << std::endl;
+    if(global_streamed_line_count) std::cout << "Streamed lines per operation: " << 1.0*global_streamed_line_count/num_operations << std::endl;
+    for(int i = 0; i < ADAPTIVE_NUM_STATS; i++)
+      if(global_adaptive_stats[i]) std::cout << adaptive_stat_names[i] << " per operation: " << 1.0*global_adaptive_stats[i]/num_operations << std::endl;
+    #ifdef PMEM_PROFILE
+      print_pmem_profile(num_operations);
+    #endif
+  }
+
+  // Per operation type breakdown. Only buckets that saw operations are shown.
+  void print_pmem_op_stats() {
+    std::cout << "Per operation type: ops, flushes/op, fences/op, CASes/op, failed CASes/op" << std::endl;
+    for(int op = 0; op < PMEM_NUM_OPS; op++)
+      for(int success = 1; success >= 0; success--) {
+        const pmem_counters& c = global_pmem_op_stats[op][success];
+        if(c.ops == 0) continue;
+        std::cout << "  " << pmem_op_names[op] << (success ? " (success)" : " (fail)") << ": "
+                  << c.ops << ", " << 1.0*c.flushes/c.ops << ", " << 1.0*c.fences/c.ops << ", "
+                  << 1.0*c.cases/c.ops << ", " << 1.0*c.failed_cases/c.ops << std::endl;
+      }
+  }
+
+  // Same breakdown as CSV, one row per operation type and outcome (totals)
+  void write_pmem_op_stats(std::ostream& out) {
+    out << "op,success,ops,flushes,fences,cas,failed_cas" << std::endl;
+    for(int op = 0; op < PMEM_NUM_OPS; op++)
+      for(int success = 1; success >= 0; success--) {
+        const pmem_counters& c = global_pmem_op_stats[op][success];
+        out << pmem_op_names[op] << "," << success << "," << c.ops << "," << c.flushes << ","
+            << c.fences << "," << c.cases << "," << c.failed_cases << std::endl;
+      }
   }
 #endif
 
-template <class ET>
-inline void FLUSH(ET *p)
+// Counts a CAS issued by a persist wrapper and passes its outcome through
+inline bool count_cas(bool success)
 {
-  // if(disable_flushes) return;
   #ifdef PMEM_STATS
-    flush_count++;
+    cas_count++;
+    if(!success) failed_cas_count++;
+  #endif
+  return success;
+}
+
+// Flush instruction selection.
+// If one of PWB_IS_CLFLUSH, PWB_IS_CLFLUSHOPT, PWB_IS_CLWB or PWB_IS_EADR is
+// defined, the flush instruction is fixed at compile time. Otherwise CPUID is
+// probed once at startup and the best supported instruction
+// (CLWB > CLFLUSHOPT > CLFLUSH) is installed behind a function pointer, so
+// the hot path stays branch free. The choice can be forced with the
+// PWB_INSTRUCTION environment variable or set_flush_instruction(),
+// e.g. PWB_INSTRUCTION=clflushopt.
+// PWB_IS_EADR (or PWB_INSTRUCTION=eadr) is for platforms whose persistence
+// domain includes the CPU caches: no flush instructions are issued and
+// FENCE() does not execute an sfence.
+#if !defined(PWB_IS_CLFLUSH) && !defined(PWB_IS_CLFLUSHOPT) && !defined(PWB_IS_CLWB) && !defined(PWB_IS_EADR)
+  #define PWB_IS_RUNTIME
+#endif
+
+// NVM latency emulation for hosts without persistent memory.
+// With -DPMEM_EMULATION every issued flush spins for a configurable write-back
+// latency and queues one cache line of write-back on a per-thread bandwidth
+// limited channel; every FENCE() waits for that queue to drain and then spins
+// for a configurable drain cost. Delays are TSC-calibrated busy waits and are
+// disabled until set_pmem_emulation() is called.
+#ifdef PMEM_EMULATION
+  uint64_t pmem_emulation_flush_cycles = 0;
+  uint64_t pmem_emulation_fence_cycles = 0;
+  uint64_t pmem_emulation_line_cycles = 0;  // 0 = unlimited bandwidth
+  double pmem_emulation_cycles_per_ns = 0;
+
+  // TSC value at which this thread's queued write-backs are complete.
+  thread_local uint64_t pmem_emulation_writeback_done = 0;
+
+  inline double calibrate_tsc() {
+    auto start_time = std::chrono::steady_clock::now();
+    uint64_t start_tsc = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t end_tsc = __rdtsc();
+    auto end_time = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end_time - start_time).count();
+    return (end_tsc - start_tsc) / ns;
+  }
+
+  // bandwidth is per thread, in MB/s (0 = unlimited).
+  // Must be called before other threads start flushing.
+  inline void set_pmem_emulation(double flush_ns, double fence_ns, double bandwidth_mb_per_s) {
+    if(pmem_emulation_cycles_per_ns == 0)
+      pmem_emulation_cycles_per_ns = calibrate_tsc();
+    pmem_emulation_flush_cycles = flush_ns * pmem_emulation_cycles_per_ns;
+    pmem_emulation_fence_cycles = fence_ns * pmem_emulation_cycles_per_ns;
+    if(bandwidth_mb_per_s > 0) {
+      double line_ns = 64.0 * 1000.0 / bandwidth_mb_per_s;
+      pmem_emulation_line_cycles = line_ns * pmem_emulation_cycles_per_ns;
+    }
+    else pmem_emulation_line_cycles = 0;
+  }
+
+  inline void pmem_emulation_spin_until(uint64_t tsc) {
+    while(__rdtsc() < tsc) _mm_pause();
+  }
+
+  inline void pmem_emulation_flush() {
+    if(pmem_emulation_flush_cycles == 0 && pmem_emulation_line_cycles == 0) return;
+    uint64_t now = __rdtsc();
+    if(pmem_emulation_line_cycles) {
+      uint64_t start = std::max(now, pmem_emulation_writeback_done);
+      pmem_emulation_writeback_done = start + pmem_emulation_line_cycles;
+    }
+    pmem_emulation_spin_until(now + pmem_emulation_flush_cycles);
+  }
+
+  inline void pmem_emulation_fence() {
+    if(pmem_emulation_fence_cycles == 0 && pmem_emulation_line_cycles == 0) return;
+    uint64_t drained = std::max<uint64_t>(__rdtsc(), pmem_emulation_writeback_done);
+    pmem_emulation_spin_until(drained + pmem_emulation_fence_cycles);
+  }
+
+  inline std::string get_pmem_emulation() {
+    double cpn = pmem_emulation_cycles_per_ns;
+    if(cpn == 0) return "NVM emulation off";
+    return "NVM emulation: flush = " + std::to_string((int) (pmem_emulation_flush_cycles/cpn)) +
+           "ns, fence = " + std::to_string((int) (pmem_emulation_fence_cycles/cpn)) +
+           "ns, write-back = " + (pmem_emulation_line_cycles ? 
+               std::to_string((int) (pmem_emulation_line_cycles/cpn)) + "ns/line" : "unlimited");
+  }
+#endif
+
+// Number of flush instructions this thread issued since its last FENCE().
+thread_local int64_t unfenced_flush_count = 0;
+
+// Bookkeeping done for every flush instruction that is actually issued.
+inline void pwb_account()
+{
+  #ifdef PMEM_STATS
+    issued_flush_count++;
   #endif
+  unfenced_flush_count++;
+  #ifdef PMEM_EMULATION
+    pmem_emulation_flush();
+  #endif
+}
+
+#ifdef PWB_IS_RUNTIME
+  // PWB_EADR is for platforms whose persistence domain includes the CPU
+  // caches (eADR): flushes and fences become no-ops.
+  enum pwb_instruction_t { PWB_CLFLUSH = 0, PWB_CLFLUSHOPT = 1, PWB_CLWB = 2, PWB_EADR = 3 };
+
+  template <int INSTRUCTION>
+  void pwb_impl(void *p);
+
+  template <>
+  void pwb_impl<PWB_CLFLUSH>(void *p) {
+    pwb_account();
+    asm volatile ("clflush (%0)" :: "r"(p));
+  }
+
+  template <>
+  void pwb_impl<PWB_CLFLUSHOPT>(void *p) {
+    pwb_account();
+    asm volatile(".byte 0x66; clflush %0" : "+m" (*(volatile char *)(p)));    // clflushopt (Kaby Lake)
+  }
+
+  template <>
+  void pwb_impl<PWB_CLWB>(void *p) {
+    pwb_account();
+    asm volatile(".byte 0x66; xsaveopt %0" : "+m" (*(volatile char *)(p)));  // clwb() only for Ice Lake onwards
+  }
+
+  template <>
+  void pwb_impl<PWB_EADR>(void *p) {}
+
+  // CLFLUSH is already ordered with respect to other stores, so it does not need a fence
+  template <int INSTRUCTION>
+  void pfence_impl() {
+    #ifdef PMEM_EMULATION
+      if(INSTRUCTION != PWB_EADR) pmem_emulation_fence();
+    #endif
+    if(INSTRUCTION != PWB_CLFLUSH && INSTRUCTION != PWB_EADR) {
+      asm volatile ("sfence" ::: "memory");
+      #ifdef PMEM_STATS
+        fence_count++;
+      #endif
+    }
+  }
+
+  void pwb_resolve(void *p);
+  void pfence_resolve();
+
+  // Both pointers start at a resolver so that FLUSH/FENCE are safe to call
+  // before static initialization has selected an instruction.
+  void (*pwb_fn)(void*) = pwb_resolve;
+  void (*pfence_fn)() = pfence_resolve;
+  pwb_instruction_t pwb_instruction = PWB_CLFLUSH;
+
+  inline bool pwb_is_supported(pwb_instruction_t instruction) {
+    if(instruction == PWB_CLFLUSH || instruction == PWB_EADR) return true;
+    unsigned int eax, ebx, ecx, edx;
+    if(__get_cpuid_max(0, nullptr) < 7) return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if(instruction == PWB_CLFLUSHOPT) return ebx & (1u << 23);
+    else return ebx & (1u << 24);
+  }
+
+  inline void install_flush_instruction(pwb_instruction_t instruction) {
+    pwb_instruction = instruction;
+    switch(instruction) {
+      case PWB_CLFLUSH:
+        pfence_fn = pfence_impl<PWB_CLFLUSH>;
+        pwb_fn = pwb_impl<PWB_CLFLUSH>;
+        break;
+      case PWB_CLFLUSHOPT:
+        pfence_fn = pfence_impl<PWB_CLFLUSHOPT>;
+        pwb_fn = pwb_impl<PWB_CLFLUSHOPT>;
+        break;
+      case PWB_CLWB:
+        pfence_fn = pfence_impl<PWB_CLWB>;
+        pwb_fn = pwb_impl<PWB_CLWB>;
+        break;
+      case PWB_EADR:
+        pfence_fn = pfence_impl<PWB_EADR>;
+        pwb_fn = pwb_impl<PWB_EADR>;
+        break;
+    }
+  }
+
+  // Returns false if the name is unknown or the instruction is not supported by this CPU.
+  // Must be called before any other thread starts flushing.
+  inline bool set_flush_instruction(const std::string& name) {
+    pwb_instruction_t instruction;
+    if(name == "auto") {
+      if(pwb_is_supported(PWB_CLWB)) instruction = PWB_CLWB;
+      else if(pwb_is_supported(PWB_CLFLUSHOPT)) instruction = PWB_CLFLUSHOPT;
+      else instruction = PWB_CLFLUSH;
+    }
+    else if(name == "clflush" || name == "CLFLUSH") instruction = PWB_CLFLUSH;
+    else if(name == "clflushopt" || name == "CLFLUSHOPT") instruction = PWB_CLFLUSHOPT;
+    else if(name == "clwb" || name == "CLWB") instruction = PWB_CLWB;
+    else if(name == "eadr" || name == "eADR") instruction = PWB_EADR;
+    else {
+      std::cerr << "Unknown flush instruction: " << name << std::endl;
+      return false;
+    }
+    if(!pwb_is_supported(instruction)) {
+      std::cerr << "Flush instruction " << name << " is not supported by this CPU" << std::endl;
+      return false;
+    }
+    install_flush_instruction(instruction);
+    return true;
+  }
+
+  inline void init_flush_instruction() {
+    const char* forced = std::getenv("PWB_INSTRUCTION");
+    if(forced == nullptr || !set_flush_instruction(forced))
+      set_flush_instruction("auto");
+  }
+
+  void pwb_resolve(void *p) {
+    init_flush_instruction();
+    pwb_fn(p);
+  }
+
+  void pfence_resolve() {
+    init_flush_instruction();
+    pfence_fn();
+  }
+
+  struct pwb_initializer {
+    pwb_initializer() { init_flush_instruction(); }
+  } pwb_initializer_obj;
+#endif
+
+// Issues the flush instruction for the cache line containing p.
+template <class ET>
+inline void PWB(ET *p)
+{
   // std::raise(SIGINT);
 
   #ifdef PWB_IS_CLFLUSH
+    pwb_account();
     asm volatile ("clflush (%0)" :: "r"(p));
   #elif PWB_IS_CLFLUSHOPT
-      asm volatile(".byte 0x66; clflush %0" : "+m" (*(volatile char *)(p)));    // clflushopt (Kaby Lake)
+    pwb_account();
+    asm volatile(".byte 0x66; clflush %0" : "+m" (*(volatile char *)(p)));    // clflushopt (Kaby Lake)
   #elif PWB_IS_CLWB
-      asm volatile(".byte 0x66; xsaveopt %0" : "+m" (*(volatile char *)(p)));  // clwb() only for Ice Lake onwards
+    pwb_account();
+    asm volatile(".byte 0x66; xsaveopt %0" : "+m" (*(volatile char *)(p)));  // clwb() only for Ice Lake onwards
+  #elif PWB_IS_EADR
+    // caches are in the persistence domain
   #else
-  #error "You must define what PWB is. Choose PWB_IS_CLFLUSH if you don't know what your CPU is capable of"
+    pwb_fn((void*) p);  // pwb_impl does the accounting
+  #endif
+}
+
+// With FLUSH_COALESCING, FLUSH() only records the cache line in a thread local
+// pending set. Pending lines are deduplicated and issued in one burst by
+// drain_pending_flushes(), which runs before every FENCE() (and therefore at
+// the end of each OperationLifetime) and before every write through one of the
+// persist wrappers, so a deferred flush is never reordered after a store that
+// could publish the data it covers.
+// Flushes that a flush marking protocol depends on (the ones issued before the
+// flush counter is decremented or the flush bit is set) must use FLUSH_NOW().
+#ifdef FLUSH_COALESCING
+  #ifndef FLUSH_COALESCING_SIZE
+    #define FLUSH_COALESCING_SIZE 32
+  #endif
+
+  struct pending_flush_set {
+    uint64_t lines[FLUSH_COALESCING_SIZE];
+    int count = 0;
+  };
+
+  thread_local pending_flush_set pending_flushes;
+#endif
+
+inline void drain_pending_flushes()
+{
+  #ifdef FLUSH_COALESCING
+    for(int i = 0; i < pending_flushes.count; i++)
+      PWB((void*) pending_flushes.lines[i]);
+    pending_flushes.count = 0;
+  #endif
+}
+
+// Flushes immediately, bypassing the pending set.
+template <class ET>
+inline void FLUSH_NOW(ET *p PMEM_SITE_ARG)
+{
+  PMEM_SITE_SCOPE;
+  #ifdef PMEM_STATS
+    flush_count++;
+  #endif
+  #ifdef PMEM_PROFILE
+    pmem_profile_flush(p);
+  #endif
+  #ifdef FLUSH_COALESCING
+    // this flush supersedes an earlier pending flush of the same line
+    uint64_t line = ((uint64_t) p) & CACHELINE_MASK;
+    for(int i = 0; i < pending_flushes.count; i++)
+      if(pending_flushes.lines[i] == line) {
+        pending_flushes.lines[i] = pending_flushes.lines[--pending_flushes.count];
+        break;
+      }
+  #endif
+  PWB(p);
+}
+
+template <class ET>
+inline void FLUSH(ET *p PMEM_SITE_ARG)
+{
+  PMEM_SITE_SCOPE;
+  // if(disable_flushes) return;
+  #ifdef FLUSH_COALESCING
+    #ifdef PMEM_STATS
+      flush_count++;
+    #endif
+    #ifdef PMEM_PROFILE
+      pmem_profile_flush(p);
+    #endif
+    uint64_t line = ((uint64_t) p) & CACHELINE_MASK;
+    for(int i = 0; i < pending_flushes.count; i++)
+      if(pending_flushes.lines[i] == line) return;
+    if(pending_flushes.count == FLUSH_COALESCING_SIZE)
+      drain_pending_flushes();
+    pending_flushes.lines[pending_flushes.count++] = line;
+  #else
+    FLUSH_NOW(p);
   #endif
 }
 
 // assumes that ptr + size will not go out of the struct
 // also assumes that structs fit in one cache line when aligned
 template <class ET>
-inline void FLUSH_STRUCT(ET *ptr, size_t size)
+inline void FLUSH_STRUCT(ET *ptr, size_t size PMEM_SITE_ARG)
 {
+  PMEM_SITE_SCOPE;
   #if defined(CACHE_ALIGN)
     FLUSH(ptr);
   #else
@@ -89,8 +664,9 @@ inline void FLUSH_STRUCT(ET *ptr, size_t size)
 }  
 
 template <class ET>
-inline void FLUSH_STRUCT(ET *ptr)
+inline void FLUSH_STRUCT(ET *ptr PMEM_SITE_ARG)
 {
+  PMEM_SITE_SCOPE;
   #if defined(CACHE_ALIGN)
     FLUSH(ptr);
   #else
@@ -102,8 +678,9 @@ inline void FLUSH_STRUCT(ET *ptr)
 
 // flush word pointed to by ptr in node n
 template <class ET, class NODE_T>
-inline void FLUSH_node(ET *ptr, NODE_T *n)
+inline void FLUSH_node(ET *ptr, NODE_T *n PMEM_SITE_ARG)
 {
+  PMEM_SITE_SCOPE;
   //if(!SAME_CACHELINE(ptr, n))
   //  std::cerr << "FLUSH NOT ON SAME_CACHELINE" << std::endl;
   #ifdef MARK_FLUSHED
@@ -116,8 +693,9 @@ inline void FLUSH_node(ET *ptr, NODE_T *n)
 
 // flush entire node pointed to by ptr
 template <class ET>
-inline void FLUSH_node(ET *ptr)
+inline void FLUSH_node(ET *ptr PMEM_SITE_ARG)
 {
+  PMEM_SITE_SCOPE;
   #ifdef MARK_FLUSHED
     if(ptr->flushed)
       FLUSH_STRUCT(ptr);
@@ -126,9 +704,18 @@ inline void FLUSH_node(ET *ptr)
   #endif
 }
 
-inline void FENCE()
+inline void FENCE(PMEM_SITE)
 {
+  PMEM_SITE_SCOPE;
   // if(disable_flushes) return;
+  #ifdef PMEM_PROFILE
+    pmem_profile_fence();
+  #endif
+  drain_pending_flushes();
+  unfenced_flush_count = 0;
+  #if defined(PMEM_EMULATION) && !defined(PWB_IS_RUNTIME) && !defined(PWB_IS_EADR)
+    pmem_emulation_fence();
+  #endif
   #ifdef PWB_IS_CLFLUSH
     //MFENCE();
   #elif PWB_IS_CLFLUSHOPT
@@ -141,11 +728,32 @@ inline void FENCE()
     #ifdef PMEM_STATS
       fence_count++;
     #endif
+  #elif PWB_IS_EADR
+    // stores are durable once visible, TSO already orders them
   #else
-    #error "You must define what PWB is. Choose PWB_IS_CLFLUSH if you don't know what your CPU is capable of"
+    pfence_fn();  // pfence_impl does the accounting
   #endif
 }
 
+// Fences only if this thread issued a flush since its last fence,
+// e.g. read-only operations that found nothing to flush skip the fence.
+inline void FENCE_IF_FLUSHED(PMEM_SITE)
+{
+  PMEM_SITE_SCOPE;
+  drain_pending_flushes();
+  if(unfenced_flush_count) FENCE();
+}
+
+// Called at the start and end of every OperationLifetime while installed,
+// e.g. by the persistence epochs of buffered_epochs.hpp. Install before
+// worker threads start and remove after they stopped.
+struct operation_hooks_t {
+  void (*begin)();
+  void (*end)();
+};
+
+const operation_hooks_t* operation_hooks = nullptr;
+
 inline std::string get_flush_instruction() {
   #ifdef PWB_IS_CLFLUSH
     return "CLFLUSH";
@@ -153,7 +761,15 @@ inline std::string get_flush_instruction() {
     return "CLFLUSHOPT";
   #elif PWB_IS_CLWB
     return "CLWB";
+  #elif PWB_IS_EADR
+    return "eADR";
   #else
+    switch(pwb_instruction) {
+      case PWB_CLFLUSH: return "CLFLUSH (runtime)";
+      case PWB_CLFLUSHOPT: return "CLFLUSHOPT (runtime)";
+      case PWB_CLWB: return "CLWB (runtime)";
+      case PWB_EADR: return "eADR (runtime)";
+    }
     return "Flush Instruction Undefined";
   #endif
 }
@@ -0,0 +1,239 @@
+
+#ifndef PMWCAS_HPP_
+#define PMWCAS_HPP_
+
+#include <atomic>
+#include <assert.h>
+#include <cstddef>
+#include <vector>
+#include <common/ssmem_wrapper.hpp>
+#include <common/recovery.hpp>
+#include "persist.hpp"
+#include "persist_counter.hpp"
+
+// Durable multi-word compare-and-swap.
+//
+// Follows the descriptor based MwCAS of Harris, Fraser and Pratt: each target
+// word is first switched to a pointer to its word entry (an RDCSS step that
+// only succeeds while the operation is undecided), then to a pointer to the
+// whole descriptor. Once every word is installed the status is decided with a
+// single CAS and the words are switched to their final values. Any thread that
+// finds a descriptor pointer helps the operation finish.
+//
+// Persistence comes from FliT: each target word and the status word are
+// PERSIST<std::atomic<uint64_t>> objects, so a write is flushed by its writer
+// and a reader only flushes words whose flush counter is non-zero. The
+// descriptor is flushed before it is published and there is a fence before the
+// status is decided, so a persisted decision always implies persisted installs.
+//
+// Values stored in pmwcas words must leave the top two bits clear.
+//
+// Descriptors are allocated with ssmem (in their own size class, apart from
+// the nodes) and are freed once the operation has completed. ssmem only
+// reuses a descriptor two epochs after it was freed (or, with
+// SSMEM_RECLAIM_TIMESTAMPS, after every thread has advanced its timestamp),
+// so a helper still holding a pointer to it keeps it alive.
+//
+// After a restart, words may still hold the descriptor of an operation that
+// was in flight at the crash. recover() takes the words of a structure and
+// rolls each of them forward or back by the persisted status of its
+// descriptor; an operation that was still undecided is failed.
+//
+// Usage:
+//   pmwcas<>::word a(1), b(2);
+//   pmwcas<> op;
+//   op.add(a, 1, 10);
+//   op.add(b, 2, 20);
+//   bool success = op.execute();
+//   uint64_t v = pmwcas<>::read(a);
+
+template<template<typename, bool> typename PERSIST = persist_counter>
+class pmwcas {
+public:
+  static const int MAX_WORDS = 8;
+
+  using word = PERSIST<std::atomic<uint64_t>, flush_option::flush>;
+
+private:
+  static const uint64_t MWCAS_FLAG = 1ull << 63;
+  static const uint64_t RDCSS_FLAG = 1ull << 62;
+  static const uint64_t FLAG_MASK = MWCAS_FLAG | RDCSS_FLAG;
+
+  enum status_t : uint64_t {UNDECIDED, SUCCEEDED, FAILED};
+
+  struct descriptor;
+
+  struct word_entry {
+    word* addr;
+    uint64_t old_val;
+    uint64_t new_val;
+    descriptor* parent;
+  };
+
+  struct alignas(64) descriptor {
+    word status;
+    int count;
+    word_entry words[MAX_WORDS];
+
+    descriptor() : status(UNDECIDED, flush_option::no_flush), count(0) {}
+  };
+
+  descriptor* desc;
+
+  static bool is_mwcas(uint64_t v) { return v & MWCAS_FLAG; }
+  static bool is_rdcss(uint64_t v) { return v & RDCSS_FLAG; }
+  static descriptor* to_descriptor(uint64_t v) { return (descriptor*) (v & ~FLAG_MASK); }
+  static word_entry* to_entry(uint64_t v) { return (word_entry*) (v & ~FLAG_MASK); }
+
+  // Second half of RDCSS: keep the install only if the operation is undecided
+  static void complete_install(word_entry* e) {
+    descriptor* d = e->parent;
+    uint64_t expected = ((uint64_t) e) | RDCSS_FLAG;
+    uint64_t new_val = (d->status.load() == UNDECIDED) ? (((uint64_t) d) | MWCAS_FLAG) : e->old_val;
+    e->addr->compare_exchange_strong(expected, new_val);
+  }
+
+  // Returns the value found in the word, which is e->old_val if the install succeeded
+  static uint64_t install(word_entry* e) {
+    while(true) {
+      uint64_t v = e->old_val;
+      if(e->addr->compare_exchange_strong(v, ((uint64_t) e) | RDCSS_FLAG)) {
+        complete_install(e);
+        return e->old_val;
+      }
+      if(!is_rdcss(v)) return v;
+      complete_install(to_entry(v));
+    }
+  }
+
+  static bool help(descriptor* d) {
+    if(d->status.load() == UNDECIDED) {
+      uint64_t new_status = SUCCEEDED;
+      for(int i = 0; i < d->count && new_status == SUCCEEDED; i++) {
+        word_entry* e = &d->words[i];
+        while(true) {
+          uint64_t v = install(e);
+          if(v == e->old_val || v == (((uint64_t) d) | MWCAS_FLAG)) break;
+          if(is_mwcas(v)) help(to_descriptor(v));
+          else {
+            new_status = FAILED;
+            break;
+          }
+        }
+      }
+      // installs must persist before the decision
+      FENCE();
+      uint64_t expected = UNDECIDED;
+      d->status.compare_exchange_strong(expected, new_status);
+      FENCE();
+    }
+    bool succeeded = (d->status.load() == SUCCEEDED);
+    for(int i = 0; i < d->count; i++) {
+      word_entry* e = &d->words[i];
+      uint64_t expected = ((uint64_t) d) | MWCAS_FLAG;
+      e->addr->compare_exchange_strong(expected, succeeded ? e->new_val : e->old_val);
+    }
+    return succeeded;
+  }
+
+  // Descriptor that v points to, nullptr for a plain value
+  static descriptor* owner(uint64_t v) {
+    if(is_rdcss(v)) return to_entry(v)->parent;
+    if(is_mwcas(v)) return to_descriptor(v);
+    return nullptr;
+  }
+
+  // Switches w, which holds v (a pointer into descriptor d), to its value
+  // after d. An entry pointer was never followed by the descriptor pointer,
+  // so it always goes back to the old value.
+  static void roll(word* w, uint64_t v, descriptor* d) {
+    uint64_t expected = UNDECIDED;
+    d->status.compare_exchange_strong(expected, FAILED);
+    if(is_rdcss(v)) {
+      w->compare_exchange_strong(v, to_entry(v)->old_val);
+      return;
+    }
+    bool succeeded = (d->status.load() == SUCCEEDED);
+    for(int i = 0; i < d->count; i++)
+      if(d->words[i].addr == w)
+        w->compare_exchange_strong(v, succeeded ? d->words[i].new_val : d->words[i].old_val);
+  }
+
+public:
+  pmwcas() {
+    desc = static_cast<descriptor*>(ssmem.alloc(sizeof(descriptor)));
+    new (desc) descriptor();
+  }
+
+  ~pmwcas() {
+    if(desc != nullptr) ssmem.free(desc);
+  }
+
+  pmwcas(const pmwcas&) = delete;
+  pmwcas& operator=(const pmwcas&) = delete;
+
+  // Adds a target word. Words are kept sorted by address so that concurrent
+  // operations install in the same order and helping cannot cycle.
+  void add(word& w, uint64_t old_val, uint64_t new_val) {
+    assert(desc != nullptr && desc->count < MAX_WORDS);
+    assert(((old_val | new_val) & FLAG_MASK) == 0);
+    int i = desc->count++;
+    for(; i > 0 && desc->words[i-1].addr > &w; i--)
+      desc->words[i] = desc->words[i-1];
+    assert(i == 0 || desc->words[i-1].addr != &w);
+    desc->words[i] = {&w, old_val, new_val, desc};
+  }
+
+  // Runs the operation. Can only be called once.
+  bool execute(PMEM_SITE) {
+    PMEM_SITE_SCOPE;
+    assert(desc != nullptr);
+    // only the used part of the descriptor needs to persist
+    FLUSH_STRUCT(desc, offsetof(descriptor, words) + desc->count*sizeof(word_entry));
+    FENCE();
+    bool b = help(desc);
+    ssmem.free(desc);
+    desc = nullptr;
+    return b;
+  }
+
+  // Reads a pmwcas word, helping any operation that is in progress on it
+  static uint64_t read(word& w PMEM_SITE_ARG) {
+    PMEM_SITE_SCOPE;
+    while(true) {
+      uint64_t v = w.load();
+      if(is_rdcss(v)) complete_install(to_entry(v));
+      else if(is_mwcas(v)) help(to_descriptor(v));
+      else return v;
+    }
+  }
+
+  // Recovery after a restart, for the n words of a structure. Must run
+  // before any operation starts. Between recovery::begin() and end(), the
+  // descriptors that a word outside of words still points to are reported
+  // reachable, so that their slots are not handed back to ssmem; the others
+  // are no longer referenced and are reclaimed.
+  static void recover(word** words, size_t n) {
+    std::vector<descriptor*> found;
+    for(size_t i = 0; i < n; i++) {
+      uint64_t v = words[i]->load();
+      descriptor* d = owner(v);
+      if(d == nullptr) continue;
+      roll(words[i], v, d);
+      found.push_back(d);
+    }
+    FENCE();
+    for(descriptor* d : found)
+      for(int i = 0; i < d->count; i++)
+        if(owner(d->words[i].addr->load()) == d) {
+          recovery::reachable(d);
+          break;
+        }
+  }
+
+  static std::string get_name() {
+    return "pmwcas, " + word::get_name();
+  }
+};
+
+#endif /* PMWCAS_HPP_ */
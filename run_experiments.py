@@ -54,7 +54,7 @@ if test_only:
   repeats = 1
 
 #binary location
-binary = 'build/bench'
+binary = 'build/bench-stats'
 
 jemalloc='LD_PRELOAD=`jemalloc-config --libdir`/libjemalloc.so.`jemalloc-config --revision`'
 nvmmalloc='LD_PRELOAD=libvmmalloc.so.1'
@@ -0,0 +1,89 @@
+#include <assert.h>
+#include <vector>
+#include <thread>
+
+#ifndef PMEM_STATS
+  #error "build with -DPMEM_STATS (make test-adaptive)"
+#endif
+
+#include <persist/persist_adaptive.hpp>
+
+#ifndef PWB_IS_RUNTIME
+  #error "the test hooks into the runtime flush backend, build without PWB_IS_*"
+#endif
+
+using namespace std;
+
+using adaptive_word = persist_adaptive_16<std::atomic<uint64_t>>;
+
+const int NUM_THREADS = 4;
+const int MAX_ITER = 1000000;
+
+alignas(64) adaptive_word w(0);
+
+thread_local bool writing = false;
+thread_local bool in_hook = false;
+
+std::atomic<int> skipped_flushes(0);
+// Steps of the migration cycle seen so far: 1 = TO_HASHED, 2 = HASHED,
+// 3 = ADJACENT again (which can only be reached through TO_ADJACENT)
+std::atomic<int> stage(0);
+
+void observe_mode() {
+  uint8_t m = w.get_mode();
+  int s = stage.load();
+  if((s == 0 && m == adaptive_word::TO_HASHED) || (s == 1 && m == adaptive_word::HASHED) ||
+     (s == 2 && m == adaptive_word::ADJACENT))
+    stage.compare_exchange_strong(s, s+1);
+}
+
+// Installed as the flush instruction. A writer of w flushes it inside its
+// marking window, so a reader checking w at this point must flush as well,
+// whichever counter the migration currently points readers at. Until w has
+// moved to the hashed table the writer also loads w here: the loads find the
+// raised counter, so they count as hits and heat w up.
+void check_window(void* p) {
+  if(writing && !in_hook && p == (void*) &w) {
+    in_hook = true;
+    if(!w.is_flush_needed()) skipped_flushes++;
+    if(stage < 2 && w.get_mode() != adaptive_word::HASHED) {
+      for(uint32_t i = 0; i < 2*ADAPTIVE_SAMPLE_PERIOD; i++) w.load();
+      observe_mode();
+      // the loads may have started a migration away from our counter
+      if(!w.is_flush_needed()) skipped_flushes++;
+    }
+    in_hook = false;
+  }
+  pwb_impl<PWB_CLFLUSH>(p);
+}
+
+// Drives w through ADJACENT -> TO_HASHED -> HASHED -> TO_ADJACENT -> ADJACENT
+// with several writers. Once w is hashed the writers stop loading it in their
+// window, so their sampled writes are misses and w cools down again.
+void test_migration_cycle() {
+  reset_pmem_stats();
+  pwb_fn = check_window;
+  vector<thread> threads;
+  for(int p = 0; p < NUM_THREADS; p++) {
+    threads.emplace_back([] () {
+      for(int i = 0; i < MAX_ITER && stage < 3; i++) {
+        writing = true;
+        w.store(i);
+        writing = false;
+        observe_mode();
+      }
+      aggregate_pmem_stats();
+    });
+  }
+  for (auto& t : threads) t.join();
+  install_flush_instruction(pwb_instruction);
+
+  assert(stage == 3);
+  assert(skipped_flushes == 0);
+  for(int i = 0; i < ADAPTIVE_NUM_STATS; i++) assert(global_adaptive_stats[i] > 0);
+}
+
+int main() {
+  test_migration_cycle();
+  return 0;
+}
@@ -15,8 +15,10 @@
 #include <persist/persist_hash.hpp>
 #include <persist/persist_offset.hpp>
 #include <persist/persist_hash_cacheline.hpp>
+#include <persist/persist_striped.hpp>
 #include <persist/persist_interface.hpp>
 #include <persist/persist_simple.hpp>
+#include <persist/persist_eadr.hpp>
 
 #include <common/barrier.hpp>
 
@@ -85,16 +87,20 @@ void run_all_tests() {
 int main() {
   run_all_tests<AravindBstDurableManual<int, persist_counter>>();
   run_all_tests<AravindBstDurableManual<int, persist_simple>>();
+  run_all_tests<AravindBstDurableManual<int, persist_eadr>>();
   run_all_tests<AravindBstDurableManual<int, persist_hash>>();
   run_all_tests<AravindBstDurableManual<int, persist_hash_cacheline_16>>();
+  run_all_tests<AravindBstDurableManual<int, persist_striped_16>>();
   run_all_tests<AravindBstDurableManual<int, persist_interface>>();
   // run_all_tests<AravindBstDurableManual<int, persist_offset_spec>>();
   run_all_tests<AravindBstDurableManual<int, link_and_persist_2>>();
 
   run_all_tests<AravindBstDurableNvTraverse<int, persist_counter>>();
   run_all_tests<AravindBstDurableNvTraverse<int, persist_simple>>();
+  run_all_tests<AravindBstDurableNvTraverse<int, persist_eadr>>();
   run_all_tests<AravindBstDurableNvTraverse<int, persist_hash>>();
   run_all_tests<AravindBstDurableNvTraverse<int, persist_hash_cacheline_16>>();
+  run_all_tests<AravindBstDurableNvTraverse<int, persist_striped_16>>();
   run_all_tests<AravindBstDurableNvTraverse<int, persist_interface>>();
   // run_all_tests<AravindBstDurableNvTraverse<int, persist_offset_spec>>();
   run_all_tests<AravindBstDurableNvTraverse<int, link_and_persist_2>>();
@@ -102,8 +108,10 @@ int main() {
   run_all_tests<AravindBstOriginal<int>>();
   run_all_tests<AravindBstDurableAutomatic<int, persist_counter>>();
   run_all_tests<AravindBstDurableAutomatic<int, persist_simple>>();
+  run_all_tests<AravindBstDurableAutomatic<int, persist_eadr>>();
   run_all_tests<AravindBstDurableAutomatic<int, persist_hash>>();
   run_all_tests<AravindBstDurableAutomatic<int, persist_hash_cacheline_16>>();
+  run_all_tests<AravindBstDurableAutomatic<int, persist_striped_16>>();
   run_all_tests<AravindBstDurableAutomatic<int, persist_interface>>();
   // run_all_tests<AravindBstDurableAutomatic<int, persist_offset_spec>>();
   run_all_tests<AravindBstDurableAutomatic<int, link_and_persist_2>>();
@@ -0,0 +1,215 @@
+#include <assert.h>
+#include <vector>
+#include <thread>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef DETECTABLE_OPS
+  #error "build with -DDETECTABLE_OPS (make test-detectable)"
+#endif
+
+#include <harris-linkedlist/ListDurableManual.hpp>
+#include <hashtable/HashtableDurableManual.hpp>
+
+#include <persist/persist.hpp>
+#include <persist/persist_counter.hpp>
+#include <persist/persist_hash_cacheline.hpp>
+#include <persist/persist_offset.hpp>
+#include <persist/detectable.hpp>
+
+#include <common/barrier.hpp>
+#include <common/ssmem_pool.h>
+
+using namespace std;
+
+const int NUM_THREADS = 4;
+const int NUM_ITER = 2000;
+
+// per process, so that runs at the same time do not share a pool
+const string POOL_FILE = "/tmp/ssmem-detectable-" + to_string(getpid()) + ".pool";
+const char* POOL_PATH = POOL_FILE.c_str();
+const size_t POOL_SIZE = 1ull << 30;  // sparse, only touched pages use space
+
+// Rewinds the record of the calling thread's last op to PENDING, as if the
+// thread had crashed before storing the result
+void forget_result() {
+  detectable::op_record& rec = detectable::record(detectable::thread_id());
+  rec.state = (detectable::last_op_id << 2) | detectable::PENDING;
+}
+
+template<class Set>
+void test_recovery() {
+  Set set;
+  int tid = detectable::thread_id();
+
+  uint64_t id = detectable::next_op_id();
+  assert(set.add(1, 1));
+  assert(detectable::recover_op(set, tid, id) == detectable::RETURNED_TRUE);
+  assert(detectable::recover_op(set, tid, id-1) == detectable::UNKNOWN);
+
+  id = detectable::next_op_id();
+  assert(!set.add(1, 1));
+  assert(detectable::recover_op(set, tid, id) == detectable::RETURNED_FALSE);
+
+  // crash after the node was linked: the node is the evidence
+  id = detectable::next_op_id();
+  assert(set.add(2, 2));
+  forget_result();
+  assert(detectable::recover_op(set, tid, id) == detectable::RETURNED_TRUE);
+  assert(detectable::recover_op(set, tid, id) == detectable::RETURNED_TRUE);
+
+  // crash of a failed add: no effect
+  id = detectable::next_op_id();
+  assert(!set.add(2, 2));
+  forget_result();
+  assert(detectable::recover_op(set, tid, id) == detectable::NO_EFFECT);
+
+  // crash after linking, then another thread removes (and unlinks) the node:
+  // the remover completes the add before the evidence disappears
+  id = detectable::next_op_id();
+  assert(set.add(3, 3));
+  forget_result();
+  thread([&set] () { assert(set.remove(3)); }).join();
+  assert(!set.contains(3));
+  assert(detectable::recover_op(set, tid, id) == detectable::RETURNED_TRUE);
+
+  id = detectable::next_op_id();
+  assert(set.remove(1));
+  assert(detectable::recover_op(set, tid, id) == detectable::RETURNED_TRUE);
+  id = detectable::next_op_id();
+  assert(!set.remove(1));
+  assert(detectable::recover_op(set, tid, id) == detectable::RETURNED_FALSE);
+  assert(set.size() == 1);
+}
+
+// Threads fight over a few keys. Once they are done, the record of each
+// thread's last op must agree with what the op returned, and the successful
+// ops must account for the final size.
+template<class Set>
+void stress_test() {
+  Set set;
+  Barrier barrier(NUM_THREADS);
+  vector<long long> balance(NUM_THREADS);
+  vector<int> tids(NUM_THREADS);
+  vector<uint64_t> last_ids(NUM_THREADS);
+  vector<bool> last_results(NUM_THREADS);
+  vector<thread> threads;
+  for(int p = 0; p < NUM_THREADS; p++) {
+    threads.emplace_back([p, &set, &barrier, &balance, &tids, &last_ids, &last_results] () {
+      tids[p] = detectable::thread_id();
+      unsigned int seed = p+1;
+      barrier.wait();
+      for(int i = 0; i < NUM_ITER; i++) {
+        int key = rand_r(&seed) % 8;
+        last_ids[p] = detectable::next_op_id();
+        bool add = rand_r(&seed) % 2;
+        bool result = add ? set.add(key, key) : set.remove(key);
+        if(result) balance[p] += add ? 1 : -1;
+        last_results[p] = result;
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  long long expected = 0;
+  for(int p = 0; p < NUM_THREADS; p++) {
+    expected += balance[p];
+    assert(detectable::recover_op(set, tids[p], last_ids[p]) ==
+           (last_results[p] ? detectable::RETURNED_TRUE : detectable::RETURNED_FALSE));
+  }
+  assert(set.size() == expected);
+}
+
+// Records of threads that exited are reused, and a reused record does not
+// answer for the ops of its previous owner
+template<class Set>
+void test_reuse() {
+  Set set;
+  int tid = -1;
+  uint64_t id = 0;
+  for(int i = 0; i < 2 * detectable::MAX_THREADS; i++) {
+    thread([&set, &tid, &id, i] () {
+      int t = detectable::thread_id();
+      assert(tid < 0 || t == tid);
+      if(tid >= 0)
+        assert(detectable::recover_op(set, tid, id) == detectable::RETURNED_TRUE);
+      tid = t;
+      id = detectable::next_op_id();
+      assert(set.add(i, i));
+    }).join();
+  }
+  assert(detectable::recover_op(set, tid, id-1) == detectable::UNKNOWN);
+  assert(detectable::recover_op(set, tid, id) == detectable::RETURNED_TRUE);
+}
+
+using PoolList = ListDurableManual<int, persist_counter>;
+
+// The first process completes op 1 (add 1) and crashes during op 2 (add 2)
+// after linking its node, before the result is stored
+void crash_with_pending_op() {
+  assert(ssmem_pool_open(POOL_PATH, POOL_SIZE) == 1);
+  PoolList* set = ssmem_pool_root<PoolList>("list");
+  assert(detectable::thread_id() == 0);
+  assert(detectable::next_op_id() == 1);
+  assert(set->add(1, 1));
+  assert(set->add(2, 2));
+  forget_result();
+  exit(0);
+}
+
+// The records survive closing the pool: after reopening it the last op of the
+// crashed thread can still be recovered, and its record continues its op ids
+void test_reopen() {
+  unlink(POOL_PATH);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if(pid == 0) crash_with_pending_op();
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  assert(ssmem_pool_open(POOL_PATH, 0) == 0);
+  PoolList* set = ssmem_pool_root<PoolList>("list");
+  assert(detectable::record(0).state.load() == ((2 << 2) | detectable::PENDING));
+  assert(detectable::recover_op(*set, 0, 1) == detectable::UNKNOWN);
+  assert(detectable::recover_op(*set, 0, 2) == detectable::RETURNED_TRUE);
+  assert(detectable::record(0).state.load() == ((2 << 2) | detectable::DONE_TRUE));
+
+  // the new thread 0 takes over the record without resetting it
+  assert(detectable::thread_id() == 0);
+  assert(detectable::next_op_id() == 3);
+  assert(set->remove(1));
+  assert(detectable::recover_op(*set, 0, 3) == detectable::RETURNED_TRUE);
+  assert(set->size() == 1);
+  ssmem_pool_close();
+  unlink(POOL_PATH);
+}
+
+// Each test opens a pool before its first allocation, in a process of its own
+void fork_and_wait(void (*f)()) {
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if(pid == 0) {
+    f();
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+template<class Set>
+void run_all_tests() {
+  test_recovery<Set>();
+  stress_test<Set>();
+  test_reuse<Set>();
+}
+
+int main() {
+  fork_and_wait(test_reopen);
+  run_all_tests<ListDurableManual<int, persist_counter>>();
+  run_all_tests<ListDurableManual<int, persist_hash_cacheline_16>>();
+  run_all_tests<ListDurableManual<int, persist_offset_spec>>();
+  run_all_tests<HashtableDurableManual<int, persist_counter>>();
+  return 0;
+}
@@ -14,8 +14,13 @@
 #include <persist/persist_hash.hpp>
 #include <persist/persist_offset.hpp>
 #include <persist/persist_hash_cacheline.hpp>
+#include <persist/persist_striped.hpp>
+#include <persist/persist_adaptive.hpp>
+#include <persist/persist_hash_numa.hpp>
 #include <persist/persist_interface.hpp>
 #include <persist/persist_simple.hpp>
+#include <persist/persist_eadr.hpp>
+#include <persist/persist_buffered.hpp>
 
 #include <common/barrier.hpp>
 
@@ -82,28 +87,54 @@ void run_all_tests() {
   stress_test<List>();  
 }
 
+// persist_buffered with a flusher closing epochs during the tests
+template<class List>
+void run_buffered_tests() {
+  buffered_epochs::start(100);
+  run_all_tests<List>();
+  buffered_epochs::stop();
+}
+
 int main() {
   run_all_tests<ListDurableManual<int, persist_counter>>();
+  run_all_tests<ListDurableManual<int, persist_counter_w32>>();
   run_all_tests<ListDurableManual<int, persist_simple>>();
+  run_all_tests<ListDurableManual<int, persist_eadr>>();
+  run_buffered_tests<ListDurableManual<int, persist_buffered>>();
   run_all_tests<ListDurableManual<int, persist_hash>>();
   run_all_tests<ListDurableManual<int, persist_hash_cacheline_16>>();
+  run_all_tests<ListDurableManual<int, persist_striped_16>>();
+  run_all_tests<ListDurableManual<int, persist_adaptive_16>>();
+  run_all_tests<ListDurableManual<int, persist_hash_numa_16>>();
   run_all_tests<ListDurableManual<int, persist_interface>>();
   run_all_tests<ListDurableManual<int, persist_offset_spec>>();
   run_all_tests<ListDurableManual<int, link_and_persist_2>>();
 
   run_all_tests<ListDurableNvTraverse<int, persist_counter>>();
+  run_all_tests<ListDurableNvTraverse<int, persist_counter_w32>>();
   run_all_tests<ListDurableNvTraverse<int, persist_simple>>();
+  run_all_tests<ListDurableNvTraverse<int, persist_eadr>>();
+  run_buffered_tests<ListDurableNvTraverse<int, persist_buffered>>();
   run_all_tests<ListDurableNvTraverse<int, persist_hash>>();
   run_all_tests<ListDurableNvTraverse<int, persist_hash_cacheline_16>>();
+  run_all_tests<ListDurableNvTraverse<int, persist_striped_16>>();
+  run_all_tests<ListDurableNvTraverse<int, persist_adaptive_16>>();
+  run_all_tests<ListDurableNvTraverse<int, persist_hash_numa_16>>();
   run_all_tests<ListDurableNvTraverse<int, persist_interface>>();
   run_all_tests<ListDurableNvTraverse<int, persist_offset_spec>>();
   run_all_tests<ListDurableNvTraverse<int, link_and_persist_2>>();
 
   run_all_tests<ListOriginal<int>>();
   run_all_tests<ListDurableAutomatic<int, persist_counter>>();
+  run_all_tests<ListDurableAutomatic<int, persist_counter_w32>>();
   run_all_tests<ListDurableAutomatic<int, persist_simple>>();
+  run_all_tests<ListDurableAutomatic<int, persist_eadr>>();
+  run_buffered_tests<ListDurableAutomatic<int, persist_buffered>>();
   run_all_tests<ListDurableAutomatic<int, persist_hash>>();
   run_all_tests<ListDurableAutomatic<int, persist_hash_cacheline_16>>();
+  run_all_tests<ListDurableAutomatic<int, persist_striped_16>>();
+  run_all_tests<ListDurableAutomatic<int, persist_adaptive_16>>();
+  run_all_tests<ListDurableAutomatic<int, persist_hash_numa_16>>();
   run_all_tests<ListDurableAutomatic<int, persist_interface>>();
   run_all_tests<ListDurableAutomatic<int, persist_offset_spec>>();
   run_all_tests<ListDurableAutomatic<int, link_and_persist_2>>();
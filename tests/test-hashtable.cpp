@@ -15,8 +15,10 @@
 #include <persist/persist_hash.hpp>
 #include <persist/persist_offset.hpp>
 #include <persist/persist_hash_cacheline.hpp>
+#include <persist/persist_striped.hpp>
 #include <persist/persist_interface.hpp>
 #include <persist/persist_simple.hpp>
+#include <persist/persist_eadr.hpp>
 
 #include <common/barrier.hpp>
 
@@ -85,16 +87,20 @@ void run_all_tests() {
 int main() {
   run_all_tests<HashtableDurableManual<int, persist_counter>>();
   run_all_tests<HashtableDurableManual<int, persist_simple>>();
+  run_all_tests<HashtableDurableManual<int, persist_eadr>>();
   run_all_tests<HashtableDurableManual<int, persist_hash>>();
   run_all_tests<HashtableDurableManual<int, persist_hash_cacheline_16>>();
+  run_all_tests<HashtableDurableManual<int, persist_striped_16>>();
   run_all_tests<HashtableDurableManual<int, persist_interface>>();
   run_all_tests<HashtableDurableManual<int, persist_offset_spec>>();
   run_all_tests<HashtableDurableManual<int, link_and_persist_2>>();
 
   run_all_tests<HashtableDurableNvTraverse<int, persist_counter>>();
   run_all_tests<HashtableDurableNvTraverse<int, persist_simple>>();
+  run_all_tests<HashtableDurableNvTraverse<int, persist_eadr>>();
   run_all_tests<HashtableDurableNvTraverse<int, persist_hash>>();
   run_all_tests<HashtableDurableNvTraverse<int, persist_hash_cacheline_16>>();
+  run_all_tests<HashtableDurableNvTraverse<int, persist_striped_16>>();
   run_all_tests<HashtableDurableNvTraverse<int, persist_interface>>();
   run_all_tests<HashtableDurableNvTraverse<int, persist_offset_spec>>();
   run_all_tests<HashtableDurableNvTraverse<int, link_and_persist_2>>();
@@ -102,8 +108,10 @@ int main() {
   run_all_tests<HashtableOriginal<int>>();
   run_all_tests<HashtableDurableAutomatic<int, persist_counter>>();
   run_all_tests<HashtableDurableAutomatic<int, persist_simple>>();
+  run_all_tests<HashtableDurableAutomatic<int, persist_eadr>>();
   run_all_tests<HashtableDurableAutomatic<int, persist_hash>>();
   run_all_tests<HashtableDurableAutomatic<int, persist_hash_cacheline_16>>();
+  run_all_tests<HashtableDurableAutomatic<int, persist_striped_16>>();
   run_all_tests<HashtableDurableAutomatic<int, persist_interface>>();
   run_all_tests<HashtableDurableAutomatic<int, persist_offset_spec>>();
   run_all_tests<HashtableDurableAutomatic<int, link_and_persist_2>>();
@@ -0,0 +1,484 @@
+#include <assert.h>
+#include <vector>
+#include <thread>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <persist/persist.hpp>
+#include <persist/persist_counter.hpp>
+#include <persist/link_and_persist.hpp>
+#include <persist/persist_hash.hpp>
+#include <persist/persist_offset.hpp>
+#include <persist/persist_hash_cacheline.hpp>
+#include <persist/persist_striped.hpp>
+#include <persist/persist_adaptive.hpp>
+#include <persist/persist_hash_numa.hpp>
+#include <persist/persist_interface.hpp>
+#include <persist/persist_simple.hpp>
+#include <persist/persist_eadr.hpp>
+#include <persist/persist_dwcas.hpp>
+#include <persist/pmwcas.hpp>
+#include <persist/persist_range.hpp>
+#include <persist/persist_buffered.hpp>
+
+#include <common/barrier.hpp>
+
+using namespace std;
+
+const int NUM_THREADS = 4;
+const int NUM_ITER = 20000;
+
+// per process, so that runs at the same time do not share a pool
+const string POOL_FILE = "/tmp/ssmem-persist-" + to_string(getpid()) + ".pool";
+const char* POOL_PATH = POOL_FILE.c_str();
+const size_t POOL_SIZE = 1ull << 30;  // sparse, only touched pages use space
+
+// persist_offset needs its flush counter next to the value
+template<template<typename, bool> typename PERSIST, typename T>
+struct Word {
+  PERSIST<std::atomic<T>, flush_option::flush> val;
+  Word(T initial) : val(initial) {}
+};
+
+template<typename T>
+struct Word<persist_offset_spec, T> {
+  persist_offset<std::atomic<T>, sizeof(T), flush_option::flush> val;
+  flush_counter_t counter;
+  Word(T initial) : val(initial), counter(0) {}
+};
+
+template<template<typename, bool> typename PERSIST>
+void test_rmw() {
+  OperationLifetime op;
+  Word<PERSIST, uint64_t> w(5);
+  assert(w.val.fetch_add(3) == 5);
+  assert(w.val.load() == 8);
+  assert(w.val.fetch_sub(2) == 8);
+  assert(w.val.load() == 6);
+  assert(w.val.fetch_or(0x30) == 6);
+  assert(w.val.load() == 0x36);
+  assert(w.val.fetch_and(0x0f) == 0x36);
+  assert(w.val.load() == 6);
+  assert(w.val.fetch_add(1, std::memory_order_seq_cst, flush_option::no_flush) == 6);
+  assert(w.val.load() == 7);
+
+  uint64_t expected = 3;
+  assert(!w.val.compare_exchange_weak(expected, 10));
+  assert(expected == 7);
+  while(!w.val.compare_exchange_weak(expected, 10));
+  assert(w.val.load() == 10);
+  assert(!w.val.is_flush_needed() || w.val.get_name() == "persist_simple");
+}
+
+// link_and_persist reserves a bit of the value, so it is only used with pointers
+template<template<typename, bool> typename PERSIST>
+void test_rmw_pointer() {
+  OperationLifetime op;
+  uint64_t arr[8];
+  Word<PERSIST, uint64_t*> w(&arr[0]);
+  assert(w.val.fetch_add(4) == &arr[0]);
+  assert(w.val.load() == &arr[4]);
+  assert(w.val.fetch_sub(1) == &arr[4]);
+  assert(w.val.load() == &arr[3]);
+  uint64_t* expected = &arr[0];
+  assert(!w.val.compare_exchange_weak(expected, &arr[1]));
+  assert(expected == &arr[3]);
+}
+
+// An RMW whose result could have the flush bit of link_and_persist does not
+// compile: fetch_add and fetch_sub only exist for pointers to objects aligned
+// past the bit, fetch_or and fetch_and not at all
+template<typename W, typename = void>
+struct has_fetch_add : false_type {};
+template<typename W>
+struct has_fetch_add<W, void_t<decltype(declval<W&>().val.fetch_add(1))>> : true_type {};
+template<typename W, typename = void>
+struct has_fetch_or : false_type {};
+template<typename W>
+struct has_fetch_or<W, void_t<decltype(declval<W&>().val.fetch_or(1))>> : true_type {};
+
+static_assert(has_fetch_add<Word<link_and_persist_2, uint64_t*>>::value, "aligned pointer");
+static_assert(!has_fetch_add<Word<link_and_persist_2, uint32_t*>>::value, "pointer aligned to the flush bit");
+static_assert(!has_fetch_add<Word<link_and_persist_2, uint64_t>>::value, "integer");
+static_assert(!has_fetch_or<Word<link_and_persist_2, uint64_t*>>::value, "fetch_or");
+static_assert(has_fetch_or<Word<persist_counter, uint64_t>>::value, "other variants keep fetch_or");
+
+template<template<typename, bool> typename PERSIST>
+void stress_test_fetch_add() {
+  Word<PERSIST, uint64_t> w(0);
+  Barrier barrier(NUM_THREADS);
+  vector<thread> threads;
+  for(int p = 0; p < NUM_THREADS; p++) {
+    threads.emplace_back([&w, &barrier] () {
+      barrier.wait();
+      for(int i = 0; i < NUM_ITER; i++) {
+        OperationLifetime op;
+        w.val.fetch_add(1);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  assert(w.val.load() == NUM_THREADS*NUM_ITER);
+}
+
+template<template<typename, bool> typename PERSIST>
+void run_all_tests() {
+  test_rmw<PERSIST>();
+  test_rmw_pointer<PERSIST>();
+  stress_test_fetch_add<PERSIST>();
+}
+
+// Writers on different stripes of one slot keep raising and lowering its
+// summary; it must be back to zero once they are done
+void test_striped_summary() {
+  Word<persist_striped_16, uint64_t> w(0);
+  assert(!w.val.is_flush_needed());
+  Barrier barrier(NUM_THREADS);
+  vector<thread> threads;
+  for(int p = 0; p < NUM_THREADS; p++) {
+    threads.emplace_back([&w, &barrier, p] () {
+      flush_counter_stripe = p;
+      barrier.wait();
+      for(int i = 0; i < NUM_ITER; i++) {
+        OperationLifetime op;
+        w.val.fetch_add(1);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  assert(w.val.load() == NUM_THREADS*NUM_ITER);
+  assert(!w.val.is_flush_needed());
+}
+
+void test_dwcas() {
+  OperationLifetime op;
+  uint64_t arr[4];
+  persist_dw<std::atomic<tagged_ptr<uint64_t>>> w(tagged_ptr<uint64_t>(&arr[0], 0));
+  static_assert(sizeof(w) == 32 && alignof(decltype(w)) == 32, "value and counter must share a cache line");
+  assert(w.load() == tagged_ptr<uint64_t>(&arr[0], 0));
+
+  // Same pointer, stale version: ABA is detected
+  tagged_ptr<uint64_t> expected(&arr[0], 0);
+  assert(w.compare_exchange_strong(expected, expected.next(&arr[1])));
+  expected = w.load();
+  assert(w.compare_exchange_strong(expected, expected.next(&arr[0])));
+  expected = tagged_ptr<uint64_t>(&arr[0], 0);
+  assert(!w.compare_exchange_weak(expected, expected.next(&arr[2])));
+  assert(expected == tagged_ptr<uint64_t>(&arr[0], 2));
+
+  assert(w.exchange(tagged_ptr<uint64_t>(&arr[3], 7)) == tagged_ptr<uint64_t>(&arr[0], 2));
+  w.store(tagged_ptr<uint64_t>(nullptr, 8));
+  assert(w.load() == tagged_ptr<uint64_t>(nullptr, 8));
+  assert(!w.is_flush_needed());
+}
+
+// Both halves are always written together, so a torn read would show 
+// mismatching halves.
+void stress_test_dwcas() {
+  persist_dw<std::atomic<tagged_ptr<uint64_t>>> w(tagged_ptr<uint64_t>(nullptr, 0));
+  Barrier barrier(NUM_THREADS);
+  vector<thread> threads;
+  for(int p = 0; p < NUM_THREADS; p++) {
+    threads.emplace_back([&w, &barrier] () {
+      barrier.wait();
+      for(int i = 0; i < NUM_ITER; i++) {
+        OperationLifetime op;
+        tagged_ptr<uint64_t> old = w.load();
+        assert((uint64_t) old.ptr == old.tag);
+        tagged_ptr<uint64_t> next((uint64_t*) (old.tag+1), old.tag+1);
+        while(!w.compare_exchange_weak(old, next)) {
+          assert((uint64_t) old.ptr == old.tag);
+          next = tagged_ptr<uint64_t>((uint64_t*) (old.tag+1), old.tag+1);
+        }
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  assert(w.load().tag == NUM_THREADS*NUM_ITER);
+}
+
+template<template<typename, bool> typename PERSIST>
+void test_pmwcas() {
+  OperationLifetime op;
+  using word = typename pmwcas<PERSIST>::word;
+  word a(1), b(2), c(3);
+  {
+    pmwcas<PERSIST> m;
+    m.add(c, 3, 30);
+    m.add(a, 1, 10);
+    m.add(b, 2, 20);
+    assert(m.execute());
+  }
+  assert(pmwcas<PERSIST>::read(a) == 10 && pmwcas<PERSIST>::read(b) == 20 && pmwcas<PERSIST>::read(c) == 30);
+  {
+    pmwcas<PERSIST> m;
+    m.add(a, 10, 11);
+    m.add(b, 2, 21);  // stale
+    assert(!m.execute());
+  }
+  assert(pmwcas<PERSIST>::read(a) == 10 && pmwcas<PERSIST>::read(b) == 20);
+  { pmwcas<PERSIST> m; }  // unused descriptors are released
+}
+
+// Each operation moves one unit between NUM_WORDS words, so the total is 
+// preserved if the updates are atomic.
+template<template<typename, bool> typename PERSIST>
+void stress_test_pmwcas() {
+  const int NUM_WORDS = 8;
+  const uint64_t INITIAL = 1000000;
+  using word = typename pmwcas<PERSIST>::word;
+  word words[NUM_WORDS];
+  for(int i = 0; i < NUM_WORDS; i++) words[i].store(INITIAL);
+  Barrier barrier(NUM_THREADS);
+  vector<thread> threads;
+  for(int p = 0; p < NUM_THREADS; p++) {
+    threads.emplace_back([&words, &barrier, p] () {
+      barrier.wait();
+      for(int i = 0; i < NUM_ITER/4; i++) {
+        OperationLifetime op;
+        int from = (i+p) % NUM_WORDS, to = (i*7+p+1) % NUM_WORDS;
+        if(from == to) continue;
+        uint64_t from_val = pmwcas<PERSIST>::read(words[from]);
+        uint64_t to_val = pmwcas<PERSIST>::read(words[to]);
+        pmwcas<PERSIST> m;
+        m.add(words[from], from_val, from_val-1);
+        m.add(words[to], to_val, to_val+1);
+        m.execute();
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  uint64_t sum = 0;
+  for(int i = 0; i < NUM_WORDS; i++) sum += pmwcas<PERSIST>::read(words[i]);
+  assert(sum == NUM_WORDS*INITIAL);
+}
+
+struct pmwcas_words {
+  pmwcas<>::word a, b, c;
+  pmwcas_words() : a(1), b(2), c(3) {}
+};
+
+// The crashes need the runtime flush backend to hook into
+#ifdef PWB_IS_RUNTIME
+int flushes_until_crash = -1;
+
+// Installed as the flush instruction: ends the process at the given flush
+void crash_on_flush(void* p) {
+  if(flushes_until_crash-- == 0) _exit(0);
+  pwb_impl<PWB_CLFLUSH>(p);
+}
+
+// Crashes in the middle of an operation that moves a from 1 to 10 and b from
+// 2 to 20. Exits with 1 if the operation completed before the crash point.
+void crash_in_pmwcas(int crash_at) {
+  assert(ssmem_pool_open(POOL_PATH, POOL_SIZE) == 1);
+  pmwcas_words* w = ssmem_pool_root<pmwcas_words>("pmwcas");
+  pmwcas<> m;
+  m.add(w->a, 1, 10);
+  m.add(w->b, 2, 20);
+  flushes_until_crash = crash_at;
+  pwb_fn = crash_on_flush;
+  m.execute();
+  install_flush_instruction(pwb_instruction);
+  exit(1);
+}
+#endif
+
+// Recovers the words and exits with 10 if the operation was rolled back and
+// 20 if it was rolled forward. Recovering a and c first leaves the
+// descriptor reachable while b still points to it.
+void recover_pmwcas() {
+  assert(ssmem_pool_open(POOL_PATH, 0) == 0);
+  pmwcas_words* w = (pmwcas_words*) ssmem_pool_get_root("pmwcas");
+  recovery::begin();
+  uint64_t a = w->a.load(), b = w->b.load();
+  pmwcas<>::word* first[] = {&w->a, &w->c};
+  pmwcas<>::recover(first, 2);
+  if(b >> 62) assert(w->b.load() == b);
+  // a led recover() to the descriptor, which b holds (not one of its entries)
+  if((a >> 62) && (b >> 63)) assert(recovery::is_reachable((void*) (b & ~(3ull << 62))));
+  pmwcas<>::word* rest[] = {&w->b};
+  pmwcas<>::recover(rest, 1);
+  recovery::end();
+
+  uint64_t va = w->a.load(), vb = w->b.load();
+  assert((va == 1 && vb == 2) || (va == 10 && vb == 20));
+  assert(w->c.load() == 3);
+  // the words keep working
+  pmwcas<> m;
+  m.add(w->a, va, va+1);
+  m.add(w->b, vb, vb+1);
+  assert(m.execute());
+  assert(pmwcas<>::read(w->a) == va+1 && pmwcas<>::read(w->b) == vb+1);
+  ssmem_pool_close();
+  exit(va == 1 ? 10 : 20);
+}
+
+int run_in_child(void (*f)(int), int arg) {
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if(pid == 0) f(arg);
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status));
+  return WEXITSTATUS(status);
+}
+
+// Crashes a pmwcas at every flush it issues, and recovers it: the words end
+// up with all old or all new values, and with the new values once the
+// decision persisted
+void test_pmwcas_recovery() {
+#ifdef PWB_IS_RUNTIME
+  bool rolled_back = false, rolled_forward = false;
+  for(int crash_at = 0; ; crash_at++) {
+    unlink(POOL_PATH);
+    int crashed = run_in_child(crash_in_pmwcas, crash_at);
+    assert(crashed == 0 || crashed == 1);
+    if(crashed == 1) break;
+    int outcome = run_in_child([] (int) { recover_pmwcas(); }, 0);
+    assert(outcome == 10 || outcome == 20);
+    rolled_back |= (outcome == 10);
+    rolled_forward |= (outcome == 20);
+  }
+  assert(rolled_back && rolled_forward);
+  unlink(POOL_PATH);
+#endif
+}
+
+struct alignas(64) range_test_node {
+  int key;
+  int64_t vals[20];
+  range_test_node(int k) : key(k) {
+    for(int i = 0; i < 20; i++) vals[i] = k+i;
+  }
+};
+
+void test_persist_range() {
+  alignas(64) char src[200], dst[200];
+  for(int i = 0; i < 200; i++) { src[i] = i; dst[i] = -1; }
+  // 200 is not a multiple of 16, so this covers the tail as well
+  persist_range(dst, 200).stream_from(src);
+  assert(memcmp(src, dst, 200) == 0);
+  persist_range(dst+64, 72).zero();
+  for(int i = 0; i < 200; i++) assert(dst[i] == ((i >= 64 && i < 136) ? 0 : src[i]));
+
+  persist_array<int64_t, 37> arr;
+  arr.fill(7);
+  for(size_t i = 0; i < arr.size(); i++) assert(arr[i] == 7);
+  int64_t vals[37];
+  for(int i = 0; i < 37; i++) vals[i] = i*i;
+  arr.stream_from(vals);
+  for(int i = 0; i < 37; i++) assert(arr[i] == i*i);
+  static_assert(alignof(persist_array<char, 3>) == 64, "arrays start on a cache line");
+
+  range_test_node* n = (range_test_node*) aligned_alloc(64, sizeof(range_test_node));
+  construct_streamed(n, 5);
+  assert(n->key == 5 && n->vals[0] == 5 && n->vals[19] == 24);
+  free(n);
+}
+
+struct alignas(64) buffered_test_word {
+  persist_buffered<std::atomic<uint64_t>> val;
+  buffered_test_word() : val(0) {}
+};
+
+// Epochs replace the runtime flush backend
+void test_buffered_epochs() {
+#ifdef PWB_IS_RUNTIME
+  assert(buffered_epochs::start(0));  // no flusher, epochs are closed by hand
+  buffered_epochs::reset_stats();
+  buffered_test_word w[4];
+  uint64_t durable = buffered_epochs::durable_epoch;
+  {
+    OperationLifetime op;
+    for(int i = 0; i < 4; i++) w[i].val.store(i);
+    w[0].val.fetch_add(7);  // same line, recorded once
+  }
+  buffered_epochs::advance();
+  assert(buffered_epochs::durable_epoch > durable);
+  assert(buffered_epochs::lines_flushed == 4);
+  buffered_epochs::advance();
+  assert(buffered_epochs::lines_flushed == 4);
+
+  // an epoch does not close while one of its operations is running
+  std::atomic<bool> closed(false);
+  thread flusher;
+  {
+    OperationLifetime op;
+    w[1].val.store(10);
+    flusher = thread([&closed] () { buffered_epochs::advance(); closed = true; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    assert(!closed);
+  }
+  flusher.join();
+  assert(closed);
+  assert(buffered_epochs::lines_flushed == 5);
+  assert(buffered_epochs::epochs_completed == 3);
+
+  // an exiting thread writes back its lines itself and frees its slot,
+  // whose index goes to the next thread
+  int index = -1;
+  for(int i = 0; i < 2; i++) {
+    thread([&w, &index] () {
+      {
+        OperationLifetime op;
+        w[2].val.store(11);
+      }
+      assert(index < 0 || buffered_epochs::self.slot->index == index);
+      index = buffered_epochs::self.slot->index;
+    }).join();
+    assert(buffered_epochs::slots[index] == nullptr);
+  }
+  buffered_epochs::advance();
+  assert(buffered_epochs::lines_flushed == 5);
+  buffered_epochs::stop();
+  assert(!buffered_epochs::active);
+
+  // with a flusher thread closing epochs concurrently
+  buffered_epochs::start(50);
+  run_all_tests<persist_buffered>();
+  buffered_epochs::stop();
+#endif
+}
+
+// Wider counters fit in the padding after pointer sized values
+static_assert(sizeof(persist_counter_w32<std::atomic<void*>>) == sizeof(persist_counter<std::atomic<void*>>), 
+              "wide flush counter grew the persist word");
+static_assert(sizeof(persist_counter_w16<std::atomic<int>>) == sizeof(persist_counter<std::atomic<int>>), 
+              "wide flush counter grew the persist word");
+
+int main() {
+  test_pmwcas_recovery();
+  run_all_tests<persist>();
+  run_all_tests<persist_counter>();
+  run_all_tests<persist_counter_w16>();
+  run_all_tests<persist_counter_w32>();
+  run_all_tests<persist_simple>();
+  run_all_tests<persist_hash>();
+  run_all_tests<persist_hash_w32>();
+  run_all_tests<persist_hash_cacheline_16>();
+  run_all_tests<persist_hash_cacheline_20_w32>();
+  run_all_tests<persist_striped_16>();
+  test_striped_summary();
+  run_all_tests<persist_adaptive_16>();
+  run_all_tests<persist_hash_numa_16>();
+  run_all_tests<persist_interface>();
+  run_all_tests<persist_offset_spec>();
+  run_all_tests<persist_eadr>();
+  run_all_tests<persist_buffered>();
+  test_rmw_pointer<link_and_persist_2>();
+  test_dwcas();
+  stress_test_dwcas();
+  test_pmwcas<persist_counter>();
+  test_pmwcas<persist_hash_cacheline_16>();
+  test_pmwcas<persist_striped_16>();
+  test_pmwcas<persist_hash_numa_16>();
+  test_pmwcas<persist_simple>();
+  test_pmwcas<persist_eadr>();
+  stress_test_pmwcas<persist_counter>();
+  stress_test_pmwcas<persist_hash>();
+  test_persist_range();
+  test_buffered_epochs();
+  return 0;
+}
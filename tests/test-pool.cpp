@@ -0,0 +1,134 @@
+#include <assert.h>
+#include <vector>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <harris-linkedlist/ListDurableNvTraverse.hpp>
+#include <hashtable/HashtableDurableNvTraverse.hpp>
+#include <aravind-bst/AravindBstDurableNvTraverse.hpp>
+#include <skiplist/SkiplistDurableNvTraverse.hpp>
+
+#include <persist/persist.hpp>
+#include <persist/persist_counter.hpp>
+
+#include <common/ssmem_pool.h>
+
+using namespace std;
+
+// per process, so that runs at the same time do not share a pool
+const string POOL_FILE = "/tmp/ssmem-test-" + to_string(getpid()) + ".pool";
+const char* POOL_PATH = POOL_FILE.c_str();
+const size_t POOL_SIZE = 1ull << 30;  // sparse, only touched pages use space
+const int NUM_THREADS = 4;
+const int NUM_KEYS = 2000;
+
+using List = ListDurableNvTraverse<int, persist_counter>;
+using Hash = HashtableDurableNvTraverse<int, persist_counter>;
+using Bst = AravindBstDurableNvTraverse<int, persist_counter>;
+using Skiplist = SkiplistDurableNvTraverse<int, persist_counter>;
+
+template<class Set>
+void fill(Set* set) {
+  vector<thread> threads;
+  for(int p = 0; p < NUM_THREADS; p++) {
+    threads.emplace_back([set, p] () {
+      for(int k = p; k < NUM_KEYS; k += NUM_THREADS) assert(set->add(k, k));
+    });
+  }
+  for (auto& t : threads) t.join();
+}
+
+template<class Set>
+void check(Set* set) {
+  assert(set->size() == NUM_KEYS);
+  assert(set->keySum() == (long long) NUM_KEYS*(NUM_KEYS-1)/2);
+  for(int k = 0; k < NUM_KEYS; k++) assert(set->contains(k));
+  assert(!set->contains(NUM_KEYS));
+  // the reopened structure keeps working, with memory from new chunks
+  assert(set->remove(0));
+  assert(set->add(NUM_KEYS, NUM_KEYS));
+  assert(!set->contains(0));
+  assert(set->contains(NUM_KEYS));
+  assert(set->size() == NUM_KEYS);
+}
+
+// Builds the structures in a child process, whose exit stands in for a restart
+void create_pool() {
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if(pid == 0) {
+    assert(ssmem_pool_open(POOL_PATH, POOL_SIZE) == 1);
+    fill(ssmem_pool_root<List>("list"));
+    fill(ssmem_pool_root<Hash>("hash", 64));
+    fill(ssmem_pool_root<Bst>("bst", NUM_KEYS));
+    fill(ssmem_pool_root<Skiplist>("skiplist", NUM_KEYS));
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void test_reopen() {
+  unlink(POOL_PATH);
+  create_pool();
+
+  assert(ssmem_pool_open(POOL_PATH, 0) == 0);
+  assert(ssmem_pool_global.base == SSMEM_POOL_DEFAULT_BASE);
+  size_t used = ssmem_pool_used();
+  assert(used > 0);
+  assert(ssmem_pool_get_root("queue") == nullptr);
+
+  // the root of an existing name is returned, not constructed again
+  List* list = ssmem_pool_root<List>("list");
+  assert(list == ssmem_pool_get_root("list"));
+  check(list);
+  check(ssmem_pool_root<Hash>("hash", 64));
+  check(ssmem_pool_root<Bst>("bst", NUM_KEYS));
+  check(ssmem_pool_root<Skiplist>("skiplist", NUM_KEYS));
+  assert(ssmem_pool_used() > used);
+
+  ssmem_pool_close();
+  unlink(POOL_PATH);
+}
+
+// A crash between extending the file and persisting the magic number leaves
+// a file of zeros, which is created again. Files that are not pools are kept.
+void test_incomplete_create() {
+  unlink(POOL_PATH);
+  int fd = open(POOL_PATH, O_RDWR | O_CREAT, 0644);
+  assert(fd >= 0);
+  assert(ftruncate(fd, 4096) == 0);
+  close(fd);
+  create_pool();
+  assert(ssmem_pool_open(POOL_PATH, 0) == 0);
+  check(ssmem_pool_root<List>("list"));
+  ssmem_pool_close();
+
+  fd = open(POOL_PATH, O_RDWR);
+  uint64_t garbage = 1;
+  assert(pwrite(fd, &garbage, sizeof(garbage), 0) == sizeof(garbage));
+  close(fd);
+  assert(ssmem_pool_open(POOL_PATH, POOL_SIZE) == -1);
+  unlink(POOL_PATH);
+}
+
+// Each test opens a pool before its first allocation, in a process of its own
+void fork_and_wait(void (*f)()) {
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if(pid == 0) {
+    f();
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main() {
+  fork_and_wait(test_reopen);
+  fork_and_wait(test_incomplete_create);
+  return 0;
+}
@@ -0,0 +1,211 @@
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <vector>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <harris-linkedlist/ListDurableManual.hpp>
+#include <harris-linkedlist/ListDurableNvTraverse.hpp>
+#include <hashtable/HashtableDurableNvTraverse.hpp>
+#include <aravind-bst/AravindBstDurableAutomatic.hpp>
+#include <aravind-bst/AravindBstDurableNvTraverse.hpp>
+#include <skiplist/SkiplistDurableAutomatic.hpp>
+#include <skiplist/SkiplistDurableManual.hpp>
+#include <skiplist/SkiplistDurableNvTraverse.hpp>
+
+#include <persist/persist.hpp>
+#include <persist/persist_counter.hpp>
+
+#include <common/ssmem_pool.h>
+#include <common/recovery.hpp>
+
+using namespace std;
+
+// per process, so that runs at the same time do not share a pool
+const string POOL_FILE = "/tmp/ssmem-recovery-test-" + to_string(getpid()) + ".pool";
+const char* POOL_PATH = POOL_FILE.c_str();
+const size_t POOL_SIZE = 2ull << 30;  // sparse, only touched pages use space
+const int NUM_THREADS = 4;
+const int KEY_RANGE = 128;  // small, so that crashes hit operations on the same nodes
+const int NUM_CRASHES = 8;
+
+template<class Set>
+Set* open_and_recover() {
+  assert(ssmem_pool_open(POOL_PATH, POOL_SIZE) == 0);
+  Set* set = (Set*) ssmem_pool_get_root("set");
+  assert(set != nullptr);
+  recovery::begin();
+  set->recover(NUM_THREADS);
+  recovery::end(NUM_THREADS);
+  return set;
+}
+
+// Runs updates on the pool until the parent kills the process
+template<class Set>
+void run_until_killed(bool create) {
+  Set* set;
+  if(create) {
+    assert(ssmem_pool_open(POOL_PATH, POOL_SIZE) == 1);
+    set = ssmem_pool_root<Set>("set", KEY_RANGE);
+  } else {
+    set = open_and_recover<Set>();
+  }
+  vector<thread> threads;
+  for(int p = 0; p < NUM_THREADS; p++) {
+    threads.emplace_back([set, p] () {
+      unsigned int seed = p+1;
+      while(true) {
+        int key = rand_r(&seed) % KEY_RANGE + 1;
+        if(rand_r(&seed) % 2) set->add(key, key);
+        else set->remove(key);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+}
+
+// After the last crash: the recovered set must be consistent, recovering it
+// again must find nothing to repair, and it must keep working with the
+// reclaimed memory.
+template<class Set>
+void check_recovered() {
+  Set* set = open_and_recover<Set>();
+  assert(recovery::nodes > 0);
+  long long reclaimed = recovery::reclaimed;
+
+  recovery::reset_stats();
+  set->recover(NUM_THREADS);
+  assert(recovery::unlinked == 0 && recovery::relinked == 0);
+
+  std::set<int> model;
+  long long sum = 0;
+  for(int k = 1; k <= KEY_RANGE; k++) {
+    if(set->contains(k)) {
+      model.insert(k);
+      sum += k;
+    }
+  }
+  assert(set->size() == (long long) model.size());
+  assert(set->keySum() == sum);
+
+  size_t recovered_sets = ssmem_recovered_num;
+  unsigned int seed = 42;
+  for(int i = 0; i < 20000; i++) {
+    int key = rand_r(&seed) % KEY_RANGE + 1;
+    if(rand_r(&seed) % 2) assert(set->add(key, key) == model.insert(key).second);
+    else assert(set->remove(key) == (model.erase(key) == 1));
+  }
+  sum = 0;
+  for(int k : model) sum += k;
+  assert(set->size() == (long long) model.size());
+  assert(set->keySum() == sum);
+  // new nodes came from the reclaimed slots
+  if(reclaimed > 0) assert(ssmem_recovered_num < recovered_sets);
+  ssmem_pool_close();
+}
+
+void fork_and_wait(void (*f)()) {
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if(pid == 0) {
+    f();
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+template<class Set>
+void test_crashes() {
+  unlink(POOL_PATH);
+  for(int c = 0; c < NUM_CRASHES; c++) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if(pid == 0) {
+      run_until_killed<Set>(c == 0);
+      exit(1);
+    }
+    this_thread::sleep_for(chrono::milliseconds(20 + rand() % 60));
+    kill(pid, SIGKILL);
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+  }
+  fork_and_wait(check_recovered<Set>);
+  unlink(POOL_PATH);
+}
+
+// A thread that replaces all the keys of a hash table before every crash
+// keeps carving out new nodes. After a restart, it takes them from the
+// reclaimed slots and then from the rest of the chunk it carved out of
+// before the crash, so the pool does not grow from one restart to the next.
+const int RESTART_KEYS = 20000;
+
+void replace_keys_and_crash(int run) {
+  typedef HashtableDurableNvTraverse<int, persist_counter> Set;
+  Set* set;
+  if(run == 0) {
+    assert(ssmem_pool_open(POOL_PATH, POOL_SIZE) == 1);
+    set = ssmem_pool_root<Set>("set", 1024);
+  } else {
+    set = open_and_recover<Set>();
+    assert(set->size() == RESTART_KEYS);
+    // the first run leaves the end of its last chunk, later runs may fill it
+    assert(recovery::reclaimed > 0 && (run > 1 || recovery::tails > 0));
+  }
+  thread t([set, run] () {
+    for(int k = 1; k <= RESTART_KEYS; k++) {
+      assert(set->add(run * RESTART_KEYS + k, k));
+      if(run > 0) assert(set->remove((run - 1) * RESTART_KEYS + k));
+    }
+  });
+  t.join();
+  raise(SIGKILL);
+}
+
+size_t pool_file_used() {
+  int fd = open(POOL_PATH, O_RDONLY);
+  assert(fd >= 0);
+  ssmem_pool_header_t h;
+  assert(pread(fd, &h, sizeof(h), 0) == sizeof(h));
+  close(fd);
+  return h.next.load();
+}
+
+void test_restarts() {
+  unlink(POOL_PATH);
+  size_t used = 0;
+  for(int run = 0; run < NUM_CRASHES; run++) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if(pid == 0) {
+      replace_keys_and_crash(run);
+      exit(1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+    if(run == 0) used = pool_file_used();
+    else assert(pool_file_used() == used);
+  }
+  unlink(POOL_PATH);
+}
+
+int main() {
+  test_restarts();
+  test_crashes<ListDurableManual<int, persist_counter>>();
+  test_crashes<ListDurableNvTraverse<int, persist_counter>>();
+  test_crashes<HashtableDurableNvTraverse<int, persist_counter>>();
+  test_crashes<AravindBstDurableAutomatic<int, persist_counter>>();
+  test_crashes<AravindBstDurableNvTraverse<int, persist_counter>>();
+  test_crashes<SkiplistDurableAutomatic<int, persist_counter>>();
+  test_crashes<SkiplistDurableManual<int, persist_counter>>();
+  test_crashes<SkiplistDurableNvTraverse<int, persist_counter>>();
+  return 0;
+}
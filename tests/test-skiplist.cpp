@@ -15,8 +15,11 @@
 #include <persist/persist_hash.hpp>
 #include <persist/persist_offset.hpp>
 #include <persist/persist_hash_cacheline.hpp>
+#include <persist/persist_striped.hpp>
+#include <persist/persist_adaptive.hpp>
 #include <persist/persist_interface.hpp>
 #include <persist/persist_simple.hpp>
+#include <persist/persist_eadr.hpp>
 
 #include <common/barrier.hpp>
 
@@ -85,16 +88,22 @@ void run_all_tests() {
 int main() {
   run_all_tests<SkiplistDurableManual<int, persist_counter>>();
   run_all_tests<SkiplistDurableManual<int, persist_simple>>();
+  run_all_tests<SkiplistDurableManual<int, persist_eadr>>();
   run_all_tests<SkiplistDurableManual<int, persist_hash>>();
   run_all_tests<SkiplistDurableManual<int, persist_hash_cacheline_16>>();
+  run_all_tests<SkiplistDurableManual<int, persist_striped_16>>();
+  run_all_tests<SkiplistDurableManual<int, persist_adaptive_16>>();
   run_all_tests<SkiplistDurableManual<int, persist_interface>>();
   // run_all_tests<SkiplistDurableManual<int, persist_offset_spec>>();
   run_all_tests<SkiplistDurableManual<int, link_and_persist_2>>();
 
   run_all_tests<SkiplistDurableNvTraverse<int, persist_counter>>();
   run_all_tests<SkiplistDurableNvTraverse<int, persist_simple>>();
+  run_all_tests<SkiplistDurableNvTraverse<int, persist_eadr>>();
   run_all_tests<SkiplistDurableNvTraverse<int, persist_hash>>();
   run_all_tests<SkiplistDurableNvTraverse<int, persist_hash_cacheline_16>>();
+  run_all_tests<SkiplistDurableNvTraverse<int, persist_striped_16>>();
+  run_all_tests<SkiplistDurableNvTraverse<int, persist_adaptive_16>>();
   run_all_tests<SkiplistDurableNvTraverse<int, persist_interface>>();
   // run_all_tests<SkiplistDurableNvTraverse<int, persist_offset_spec>>();
   run_all_tests<SkiplistDurableNvTraverse<int, link_and_persist_2>>();
@@ -102,8 +111,11 @@ int main() {
   run_all_tests<SkiplistOriginal<int>>();
   run_all_tests<SkiplistDurableAutomatic<int, persist_counter>>();
   run_all_tests<SkiplistDurableAutomatic<int, persist_simple>>();
+  run_all_tests<SkiplistDurableAutomatic<int, persist_eadr>>();
   run_all_tests<SkiplistDurableAutomatic<int, persist_hash>>();
   run_all_tests<SkiplistDurableAutomatic<int, persist_hash_cacheline_16>>();
+  run_all_tests<SkiplistDurableAutomatic<int, persist_striped_16>>();
+  run_all_tests<SkiplistDurableAutomatic<int, persist_adaptive_16>>();
   run_all_tests<SkiplistDurableAutomatic<int, persist_interface>>();
   // run_all_tests<SkiplistDurableAutomatic<int, persist_offset_spec>>();
   run_all_tests<SkiplistDurableAutomatic<int, link_and_persist_2>>();
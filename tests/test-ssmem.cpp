@@ -0,0 +1,314 @@
+#include <assert.h>
+#include <atomic>
+#include <set>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <common/ssmem_wrapper.hpp>
+
+using namespace std;
+
+const int WINDOW = 1000;
+const int NUM_ITER = 100000;
+
+static_assert(ssmem_size_class(1) == ssmem_size_class(16), "size classes");
+static_assert(ssmem_class_size(ssmem_size_class(24)) == 32, "size classes");
+static_assert(ssmem_class_size(ssmem_size_class(300)) == 320, "size classes");
+static_assert(ssmem_class_size(ssmem_size_class(1025)) == 2048, "size classes");
+
+// Replaces the objects of a window of live objects NUM_ITER times. Every
+// address handed out goes to allocated, every freed one to freed. Returns
+// how many objects were allocated in memory that had been freed before.
+template<size_t SIZE>
+int churn(set<void*>& freed, set<void*>& allocated) {
+  struct Object { char bytes[SIZE]; };
+  vector<Object*> window(WINDOW, nullptr);
+  int reused = 0;
+  for(int i = 0; i < NUM_ITER; i++) {
+    Object*& o = window[i % WINDOW];
+    if(o != nullptr) {
+      freed.insert(o);
+      ssmem.free(o);
+    }
+    o = static_cast<Object*>(ssmem.alloc(sizeof(Object)));
+    reused += freed.count(o);
+    allocated.insert(o);
+    // lets the other threads reach quiescent points on a single core
+    if(i % WINDOW == 0) this_thread::yield();
+  }
+  for(Object* o : window) {
+    freed.insert(o);
+    ssmem.free(o);
+  }
+  return reused;
+}
+
+// Freed memory is only handed out again for objects of the same size class
+void test_size_classes() {
+  thread t([] () {
+    set<void*> small_freed, small_allocated, large_freed, large_allocated;
+    assert(churn<48>(small_freed, small_allocated) > 0);
+    assert(churn<1024>(large_freed, large_allocated) > 0);
+    assert(churn<48>(small_freed, small_allocated) > 0);
+    for(void* p : large_allocated) assert(!small_freed.count(p));
+    for(void* p : small_allocated) assert(!large_freed.count(p));
+  });
+  t.join();
+}
+
+// The chunks of a size class start small and double up to the chunk size of
+// the allocator, so a thread that uses every class maps little memory
+void test_chunk_growth() {
+  thread t([] () {
+    for(int c = 0; c < SSMEM_NUM_CLASSES; c++) ssmem.alloc(ssmem_class_size(c));
+    ssmem_allocator_t* a = (ssmem_allocator_t*) ssmem_allocator_list->obj;
+    assert(a->tot_size == SSMEM_NUM_CLASSES * SSMEM_MEM_SIZE_MIN);
+
+    const size_t size = SSMEM_MAX_CLASS_SIZE;
+    while(a->tot_size < 3 * SSMEM_DEFAULT_MEM_SIZE) ssmem.alloc(size);
+    vector<size_t> lens;  // chunks of the largest class, oldest first
+    for(ssmem_list_t* l = a->mem_chunks; l != nullptr; l = l->next)
+      lens.insert(lens.begin(), l->len);
+    lens.erase(lens.begin(), lens.begin() + SSMEM_NUM_CLASSES - 1);
+    assert(lens[0] == SSMEM_MEM_SIZE_MIN);
+    for(size_t i = 1; i < lens.size(); i++)
+      assert(lens[i] == min(2 * lens[i-1], (size_t) SSMEM_DEFAULT_MEM_SIZE));
+    assert(lens.back() == SSMEM_DEFAULT_MEM_SIZE);
+  });
+  t.join();
+}
+
+// A thread that does not reach a quiescent point holds back the reuse of
+// everything freed meanwhile, which shows up as garbage of the freeing thread
+void test_stalled_thread() {
+  atomic<int> phase(0);
+  thread staller([&phase] () {
+    ssmem.alloc(64); // subscribes
+    phase = 1;
+    while(phase == 1) this_thread::yield();
+    while(phase == 2) SSMEM_SAFE_TO_RECLAIM();
+  });
+  while(phase == 0) this_thread::yield();
+
+  thread worker([&phase] () {
+    set<void*> freed, allocated;
+    assert(churn<64>(freed, allocated) == 0);
+    size_t garbage = ssmem_garbage_bytes(ssmem_get_id());
+    assert(garbage == (size_t) NUM_ITER * 64);
+    phase = 2;
+    assert(churn<64>(freed, allocated) > 0);
+    assert(ssmem_garbage_bytes(ssmem_get_id()) < garbage);
+    phase = 3;
+  });
+  worker.join();
+  staller.join();
+}
+
+#if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+// An idle thread that went offline does not hold back reclamation
+void test_offline_thread() {
+  atomic<int> phase(0);
+  thread idle([&phase] () {
+    ssmem.alloc(64);
+    ssmem_thread_offline();
+    phase = 1;
+    while(phase == 1) this_thread::yield();
+    ssmem_thread_online();
+  });
+  while(phase == 0) this_thread::yield();
+
+  thread worker([] () {
+    set<void*> freed, allocated;
+    assert(churn<64>(freed, allocated) > 0);
+  });
+  worker.join();
+  phase = 2;
+  idle.join();
+}
+#endif
+
+// Chunks of the current page policy are huge page aligned and hold objects.
+// Explicit huge pages fall back to 4KB pages when none are reserved.
+void test_page_policy() {
+  thread t([] () {
+    // the first object of a class starts its chunk
+    void* first = ssmem.alloc(64);
+    if(ssmem_page_policy != SSMEM_PAGES_DEFAULT) assert((uintptr_t) first % SSMEM_HUGE_PAGE_SIZE == 0);
+    set<void*> freed, allocated;
+    assert(churn<64>(freed, allocated) > 0);
+    ssmem.free(first, 64);
+  });
+  t.join();
+}
+
+// Objects freed by a thread on another node than the one their chunk is on
+// go back to the allocators of their home node. On a single node machine the
+// second node is simulated: the home thread pretends to run on node 1.
+void test_numa_routing() {
+  const int NUM_OBJS = 20000;
+  ssmem_numa_route = true;
+  // 2MB aligned chunks, so that the node of every object is recorded
+  assert(ssmem_set_page_policy("thp", false));
+  vector<void*> objs(NUM_OBJS);
+  atomic<int> phase(0);
+  thread home([&objs, &phase] () {
+    ssmem.alloc(16); // subscribes
+    ssmem_thread_set_node(1);
+    for(void*& o : objs) o = ssmem.alloc(64);
+    phase = 1;
+    while(phase == 1) {
+      SSMEM_SAFE_TO_RECLAIM();
+      this_thread::yield();
+    }
+    set<void*> routed(objs.begin(), objs.end());
+    int reused = 0;
+    for(int i = 0; i < NUM_OBJS; i++) reused += routed.count(ssmem.alloc(64));
+    assert(reused > 0);
+  });
+  while(phase == 0) this_thread::yield();
+
+  thread remote([&objs, &phase] () {
+    for(void* o : objs) ssmem.free(o, 64);
+    assert(ssmem_routed_objs(ssmem_get_id()) == (size_t) NUM_OBJS);
+    // the routed objects are not reused here
+    set<void*> freed, allocated;
+    churn<64>(freed, allocated);
+    for(void* o : objs) assert(!allocated.count(o));
+    phase = 2;
+  });
+  remote.join();
+  home.join();
+}
+
+// A remote set that does not fill up goes home as well: the thread that freed
+// its objects seals it at one of its quiescent points. Freeing the chunks
+// forgets the nodes of their regions.
+void test_numa_partial_set() {
+  const int NUM_OBJS = 100; // fewer than a free set holds
+  const int CLS = ssmem_size_class(64);
+  ssmem_numa_route = true;
+  assert(ssmem_set_page_policy("thp", false));
+  vector<void*> objs(NUM_OBJS);
+  atomic<int> phase(0);
+  thread home([&objs, &phase] () {
+    ssmem.alloc(16); // subscribes
+    ssmem_thread_set_node(1);
+    for(void*& o : objs) o = ssmem.alloc(64);
+    phase = 1;
+    while(phase == 1) {
+      SSMEM_SAFE_TO_RECLAIM();
+      this_thread::yield();
+    }
+    set<void*> routed(objs.begin(), objs.end());
+    int reused = 0;
+    for(int i = 0; i < NUM_OBJS; i++) reused += routed.count(ssmem.alloc(64));
+    assert(reused == NUM_OBJS);
+  });
+  while(phase == 0) this_thread::yield();
+
+  thread remote([&objs, &phase, CLS] () {
+    for(void* o : objs) ssmem.free(o, 64);
+    // no more frees, only quiescent points
+    for(int i = 0; i < 100 * SSMEM_REMOTE_FLUSH_PERIOD && ssmem_numa_inbox[1][CLS].load() == nullptr; i++) {
+      SSMEM_SAFE_TO_RECLAIM();
+      if(i % 1000 == 0) this_thread::yield();
+    }
+    assert(ssmem_numa_inbox[1][CLS].load() != nullptr);
+    phase = 2;
+  });
+  remote.join();
+  home.join();
+
+  assert(numa::recorded_region_node(objs[0]) == 1);
+  ssmem_term();
+  assert(numa::recorded_region_node(objs[0]) == -1);
+}
+
+// A thread that exits leaves its memory to the next threads: the freed
+// objects once they are safe, the rest of its chunks, and its id
+void test_thread_exit() {
+  set<void*> freed;
+  void* last_large = nullptr;
+  int id = -1;
+  thread first([&] () {
+    vector<void*> objs;
+    for(int i = 0; i < NUM_ITER; i++) objs.push_back(ssmem.alloc(64));
+    id = ssmem_get_id();
+    for(void* o : objs) {
+      freed.insert(o);
+      ssmem.free(o, 64);
+    }
+    last_large = ssmem.alloc(128);
+  });
+  first.join();
+
+  thread second([&] () {
+    ssmem.alloc(16);
+    assert(ssmem_get_id() == id);
+    // the chunk of the class continues where the first thread stopped
+    assert(ssmem.alloc(128) == (char*) last_large + 128);
+    set<void*> my_freed, allocated;
+    churn<64>(my_freed, allocated);
+    int reused = 0;
+    for(void* p : allocated) reused += freed.count(p);
+    assert(reused > 0);
+  });
+  second.join();
+
+  // threads that come and go do not add timestamps, chunks or free sets
+  uint32_t timestamps = ssmem_ts_list_len;
+  auto chunks = [] () {
+    int n = 0;
+    for(ssmem_list_t* c = ssmem_orphan_chunks; c != nullptr; c = c->next) n++;
+    return n;
+  };
+  int num_chunks = chunks();
+  size_t sets = ssmem_recovered_num + ssmem_orphan_pending_num;
+  for(int t = 0; t < 1000; t++) {
+    thread worker([] () {
+      for(int i = 0; i < 100; i++) ssmem.free(ssmem.alloc(64), 64);
+    });
+    worker.join();
+  }
+  assert(ssmem_ts_list_len == timestamps);
+  assert(chunks() == num_chunks);
+  // only the sets of the last threads are still pending
+  assert(ssmem_recovered_num + ssmem_orphan_pending_num <= sets + 2);
+}
+
+// Every test runs in its own process, so that it starts without the memory
+// and the timestamps left by the threads of the previous tests
+void fork_and_wait(void (*f)()) {
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if(pid == 0) {
+    f();
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main() {
+  fork_and_wait(test_size_classes);
+  fork_and_wait(test_chunk_growth);
+  fork_and_wait(test_stalled_thread);
+  for(const char* policy : {"default", "thp", "nothp", "2mb", "1gb"}) {
+    // a 1GB chunk that falls back to 4KB pages is not prefaulted
+    assert(ssmem_set_page_policy(policy, strcmp(policy, "1gb") != 0));
+    fork_and_wait(test_page_policy);
+  }
+  assert(!ssmem_set_page_policy("4kb", false));
+  assert(ssmem_set_page_policy("default", false));
+  fork_and_wait(test_numa_routing);
+  fork_and_wait(test_numa_partial_set);
+  fork_and_wait(test_thread_exit);
+  #if SSMEM_RECLAIM == SSMEM_RECLAIM_EPOCHS
+    fork_and_wait(test_offline_thread);
+  #endif
+  return 0;
+}